@@ -6,5 +6,5 @@ stdenv.mkDerivation {
   src = ./.;
   nativeBuildInputs = [ sqlite_modern_cpp pkgconfig python3 python37Packages.klein cmake gnumake lldb gdb ];
   depsBuildBuild = [ ccls ];
-  buildInputs = [ spdlog sqlite protobuf3_7 boost174 cryptopp clang-tools boost-build libsodium doxygen catch2 ];
+  buildInputs = [ spdlog sqlite protobuf3_7 boost174 cryptopp clang-tools boost-build libsodium zlib doxygen catch2 ];
 }
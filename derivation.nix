@@ -8,7 +8,7 @@ stdenv.mkDerivation {
 
   nativeBuildInputs = [ sqlite_modern_cpp pkgs.pkgconfig pkgs.cmake pkgs.gnumake42 ];
   depsBuildBuild = [ ];
-  buildInputs = [ pkgs.spdlog pkgs.sqlite pkgs.protobuf3_7 boost pkgs.cryptopp pkgs.clang-tools pkgs.boost-build pkgs.libsodium pkgs.doxygen pkgs.catch2 ];
+  buildInputs = [ pkgs.spdlog pkgs.sqlite pkgs.protobuf3_7 boost pkgs.cryptopp pkgs.clang-tools pkgs.boost-build pkgs.libsodium pkgs.zlib pkgs.doxygen pkgs.catch2 ];
 
   installPhase = ''
     mkdir -p $out/bin
@@ -3,57 +3,181 @@
 
 #include <boost/asio.hpp>
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 #include "peerpaste/concurrent_queue.hpp"
+#include "peerpaste/endpoint_cache.hpp"
+#include "peerpaste/frame_decoder.hpp"
 #include "peerpaste/message.hpp"
+#include "peerpaste/send_queue_limiter.hpp"
 #include "peerpaste/session.hpp"
 
 using boost::asio::ip::tcp;
 /* using DataBuffer = std::vector<uint8_t>; */
 
-// Forward declaration
-class MessageQueue;
-
 class BoostSession : public Session, public std::enable_shared_from_this<BoostSession>
 {
 public:
-	BoostSession(boost::asio::io_context &io_context,
-							 std::shared_ptr<peerpaste::ConcurrentQueue<std::pair<DataBuffer, SessionPtr>>> msg_queue);
+	BoostSession(boost::asio::io_context &io_context, std::shared_ptr<ReceiveQueue> msg_queue);
+	// takes over an accepted connection
+	BoostSession(boost::asio::io_context &io_context, std::shared_ptr<ReceiveQueue> msg_queue, tcp::socket socket);
 	~BoostSession();
-	void write(const DataBuffer &encoded_message) override;
-	void write_direct(const DataBuffer& encoded_message, const std::function<void(bool)>& handler) override;
-	void write_to(const DataBuffer &encoded_message, const std::string &address, const std::string &port) override;
+	void write(DataBuffer message,
+						 SendPolicy policy = SendPolicy::CLOSE,
+						 MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_direct(DataBuffer message,
+										const std::function<void(bool)> &handler,
+										SendPolicy policy = SendPolicy::BLOCK,
+										MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_to(DataBuffer message,
+								const std::string &address,
+								const std::string &port,
+								SendPolicy policy = SendPolicy::CLOSE,
+								MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_file(DataBuffer message,
+									FileRange range,
+									const std::function<void(bool)> &handler,
+									SendPolicy policy = SendPolicy::BLOCK,
+									MessagePriority priority = MessagePriority::DEFAULT) override;
 	void read() override;
 	std::string get_client_ip() const override;
+	SendQueueMetrics get_send_queue_metrics() const override;
+	void set_send_limits(const SendLimits &limits);
+	void set_timeouts(const SessionTimeouts &timeouts);
 
+	bool is_open() const override;
 	unsigned get_client_port() const;
 	boost::asio::ip::tcp::socket &get_socket();
 
+	/*
+	 * Resolved endpoints shared by all sessions
+	 */
+	static peerpaste::EndpointCache &get_endpoint_cache();
+
+	/*
+	 * Receive buffers shared by all sessions. Buffers are handed to the
+	 * dispatcher and return to the pool once the message is decoded.
+	 */
+	static const std::shared_ptr<peerpaste::BufferPool> &get_buffer_pool();
+
 private:
+	using FrameHeader = std::array<uint8_t, peerpaste::FrameDecoder::HEADER_SIZE>;
+
+	/*
+	 * A queued message together with its length prefix, so the payload
+	 * never has to be copied just to prepend the header
+	 */
+	struct OutgoingFrame
+	{
+		FrameHeader header;
+		DataBuffer payload;
+		std::function<void(bool)> on_write;
+		// sent from the file after the payload, the header covers both
+		std::optional<FileRange> file;
+		MessagePriority priority;
+	};
+
+	/*
+	 * A message sent with SendPolicy::BLOCK that waits for the send queue
+	 * of its priority to drain
+	 */
+	struct BlockedFrame
+	{
+		DataBuffer payload;
+		std::function<void(bool)> on_write;
+		std::optional<FileRange> file;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
 	void stop();
-	void queue_message(const DataBuffer &message);
+	void do_connect(peerpaste::Endpoints endpoints);
+	void handle_connect(const boost::system::error_code &ec);
+	void store_remote_endpoint();
+	void start_timeout_timer();
+	void arm_timeout_timer();
+	void handle_timeout_timer(const boost::system::error_code &ec);
+	void touch();
+	void send_message(DataBuffer message,
+										SendPolicy policy,
+										MessagePriority priority,
+										std::function<void(bool)> on_write = nullptr,
+										std::optional<FileRange> file = std::nullopt);
+	void block_message(DataBuffer message,
+										 MessagePriority priority,
+										 std::function<void(bool)> on_write,
+										 std::optional<FileRange> file);
+	void resume_blocked_frames();
+	bool has_expired_blocked_frames() const;
+	void fail_blocked_frames();
+	void release_send_queue(size_t frames, size_t bytes, MessagePriority priority);
+	void queue_message(DataBuffer message,
+										 MessagePriority priority,
+										 std::function<void(bool)> on_write = nullptr,
+										 std::optional<FileRange> file = std::nullopt);
+	bool has_queued_frames() const;
+	void take_queued_frames();
 	void start_packet_send();
+	void handle_packet_send(boost::system::error_code const &error);
+	void send_file_range();
 	void packet_send_done(boost::system::error_code const &error);
-	void handle_read_message(const boost::system::error_code &ec);
-	void do_read_message(unsigned msg_len);
-	void handle_read_header(const boost::system::error_code &error);
-	// TODO: this function has to post to the read_strand_
-	void do_read_header();
-	unsigned decode_header(const DataBuffer &buf) const;
-	void encode_header(DataBuffer &buf, unsigned size) const;
+	void complete_frames(std::deque<OutgoingFrame> &frames, size_t count, bool failed);
+	void fail_queued_frames();
+	void do_read();
+	void handle_read(const boost::system::error_code &ec, std::size_t bytes);
+	void handle_frames();
+	void do_read_partial_frame();
+	void handle_read_partial_frame(const boost::system::error_code &ec);
+	void handle_read_failed(const boost::system::error_code &ec);
+	void encode_header(FrameHeader &buf, unsigned size) const;
 
 	boost::asio::io_service &service_;
-	boost::asio::io_service::strand write_strand_;
-	boost::asio::io_service::strand read_strand_;
-	std::deque<DataBuffer> send_packet_queue;
-	DataBuffer readbuf_;
+	boost::asio::io_service::strand strand_;
+	// frames waiting to be sent, by priority
+	std::array<std::deque<OutgoingFrame>, MESSAGE_PRIORITY_COUNT> queued_frames_;
+	// frames waiting for space in the send queue, by priority
+	std::array<std::deque<BlockedFrame>, MESSAGE_PRIORITY_COUNT> blocked_frames_;
+	// frames taken from queued_frames_ for the next writes
+	std::deque<OutgoingFrame> send_packet_queue;
+	// frames at the front of send_packet_queue that are currently written
+	size_t frames_in_flight_ = 0;
+	// progress of the file range of the last frame in flight
+	size_t file_bytes_sent_ = 0;
+	peerpaste::FrameDecoder frame_decoder_;
 
 	tcp::socket socket_;
+	tcp::resolver resolver_;
+	peerpaste::Endpoints endpoints_;
+	// copied once connected, so the ip and port can be read without touching the socket
+	mutable std::mutex remote_endpoint_mutex_;
+	std::optional<tcp::endpoint> remote_endpoint_;
 	std::string name_;
-	const size_t header_size_ = 4;
+	std::atomic<bool> is_open_ = true;
+
+	boost::asio::steady_timer timeout_timer_;
+	std::atomic<bool> is_timer_running_ = false;
+	std::atomic<std::chrono::steady_clock::time_point> last_activity_;
+	// a frame was started but not completely received yet
+	std::atomic<bool> is_frame_pending_ = false;
+	// reading is paused because the receive queue is full
+	std::atomic<bool> is_read_paused_ = false;
+	SessionTimeouts timeouts_;
+
+	// send queue accounting, done by the writing threads before posting
+	peerpaste::SendQueueLimiter send_queue_limiter_;
+	std::atomic<bool> is_reading_ = false;
+	// only accessed on the strand_ once the session is shared
+	bool is_connected_ = true;
+	bool read_on_connect_ = false;
+	static constexpr std::chrono::milliseconds TIMEOUT_CHECK_INTERVAL{1000};
+	// upper bound of frames gathered into a single write
+	static constexpr size_t max_gathered_frames_ = 64;
 };
 
 #endif /* ifndef BOOSTSESSION_HPP */
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace peerpaste
+{
+
+class BufferPool;
+
+/*
+ * PooledBuffer
+ * Move-only byte buffer taken from a BufferPool. Its memory is not
+ * initialized on resize and goes back to the pool on destruction.
+ */
+class PooledBuffer
+{
+public:
+	struct Storage
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t capacity = 0;
+	};
+
+	PooledBuffer() = default;
+
+	PooledBuffer(Storage storage, size_t size, std::weak_ptr<BufferPool> pool)
+		: storage_(std::move(storage))
+		, size_(size)
+		, pool_(std::move(pool))
+	{
+	}
+
+	PooledBuffer(PooledBuffer &&other) noexcept
+		: storage_(std::move(other.storage_))
+		, size_(other.size_)
+		, pool_(std::move(other.pool_))
+	{
+		other.storage_.capacity = 0;
+		other.size_ = 0;
+	}
+
+	PooledBuffer &operator=(PooledBuffer &&other) noexcept
+	{
+		if(this != &other)
+		{
+			release();
+			storage_ = std::move(other.storage_);
+			size_ = other.size_;
+			pool_ = std::move(other.pool_);
+			other.storage_.capacity = 0;
+			other.size_ = 0;
+		}
+		return *this;
+	}
+
+	PooledBuffer(const PooledBuffer &) = delete;
+	PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+	~PooledBuffer()
+	{
+		release();
+	}
+
+	/*
+	 * Changes the size without initializing new bytes. Content is only
+	 * kept if the capacity is big enough already.
+	 */
+	void resize(size_t size)
+	{
+		if(size > storage_.capacity)
+		{
+			storage_.data.reset(new uint8_t[size]);
+			storage_.capacity = size;
+		}
+		size_ = size;
+	}
+
+	uint8_t *data()
+	{
+		return storage_.data.get();
+	}
+
+	const uint8_t *data() const
+	{
+		return storage_.data.get();
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	size_t capacity() const
+	{
+		return storage_.capacity;
+	}
+
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+	uint8_t *begin()
+	{
+		return data();
+	}
+
+	uint8_t *end()
+	{
+		return data() + size_;
+	}
+
+	const uint8_t *begin() const
+	{
+		return data();
+	}
+
+	const uint8_t *end() const
+	{
+		return data() + size_;
+	}
+
+private:
+	inline void release();
+
+	Storage storage_;
+	size_t size_ = 0;
+	std::weak_ptr<BufferPool> pool_;
+};
+
+/*
+ * BufferPool
+ * Keeps released receive buffers around so that the read path neither
+ * allocates nor zero-fills memory for every incoming message
+ */
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+	BufferPool(size_t max_buffers = DEFAULT_MAX_BUFFERS, size_t max_buffer_size = DEFAULT_MAX_BUFFER_SIZE)
+		: max_buffers_(max_buffers)
+		, max_buffer_size_(max_buffer_size)
+	{
+	}
+
+	PooledBuffer acquire(size_t size)
+	{
+		PooledBuffer::Storage storage;
+		{
+			std::scoped_lock lk{mutex_};
+			if(!free_.empty())
+			{
+				storage = std::move(free_.back());
+				free_.pop_back();
+			}
+		}
+
+		PooledBuffer buffer{std::move(storage), 0, weak_from_this()};
+		buffer.resize(size);
+		return buffer;
+	}
+
+	void give_back(PooledBuffer::Storage storage)
+	{
+		if(storage.capacity == 0 || storage.capacity > max_buffer_size_)
+		{
+			return;
+		}
+
+		std::scoped_lock lk{mutex_};
+		if(free_.size() < max_buffers_)
+		{
+			free_.push_back(std::move(storage));
+		}
+	}
+
+	size_t size() const
+	{
+		std::scoped_lock lk{mutex_};
+		return free_.size();
+	}
+
+	static constexpr size_t DEFAULT_MAX_BUFFERS = 256;
+	static constexpr size_t DEFAULT_MAX_BUFFER_SIZE = 64 * 1024;
+
+private:
+	const size_t max_buffers_;
+	const size_t max_buffer_size_;
+	mutable std::mutex mutex_;
+	std::vector<PooledBuffer::Storage> free_;
+};
+
+void PooledBuffer::release()
+{
+	if(storage_.capacity == 0)
+	{
+		return;
+	}
+
+	if(auto pool = pool_.lock())
+	{
+		pool->give_back(std::move(storage_));
+	}
+
+	storage_ = Storage{};
+	size_ = 0;
+}
+
+} // namespace peerpaste
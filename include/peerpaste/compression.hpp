@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace peerpaste
+{
+
+/*
+ * Payload encodings, combined into the accept_encoding bit set of a header
+ */
+enum Encoding : uint32_t
+{
+	IDENTITY = 0,
+	DEFLATE = 1 << 0,
+};
+
+// what this build can decode
+constexpr uint32_t SUPPORTED_ENCODINGS = Encoding::DEFLATE;
+
+struct CompressionOptions
+{
+	// payloads smaller than this are not worth compressing
+	size_t threshold = 1024;
+	// zlib levels from 1 (fastest) to 9, 0 sends the payload as it is.
+	// Compressed chunks have to be read into memory instead of being sent
+	// from the file, which only pays off for compressible files.
+	int chunk_level = 0;
+	int list_level = 6;
+};
+
+/*
+ * Deflates size bytes of data into out. Returns false if the result would
+ * not be smaller than the input, out is unspecified then.
+ */
+bool compress(const char *data, size_t size, int level, std::string &out);
+
+/*
+ * Inflates data into exactly out_size bytes at out. Returns false if data
+ * is corrupt or does not decode to out_size bytes.
+ */
+bool decompress(const char *data, size_t size, char *out, size_t out_size);
+
+} // namespace peerpaste
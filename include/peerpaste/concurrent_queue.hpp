@@ -1,11 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
 #include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
+#include <optional>
+#include <thread>
+#include <vector>
 
 namespace peerpaste
 {
@@ -14,83 +21,405 @@ using namespace std::chrono_literals;
 /*
  * ConcurrentQueue
  * Boost::Asio Session will push the received messages onto it
- * and a polling consumer will dispatch them to different performers
+ * and a consumer, woken by the push handler or blocking in a pop,
+ * will dispatch them to different performers.
+ * A lock-free bounded ring of sequence numbered cells, elements are stored
+ * in the cells. Only threads that have to wait take a lock.
+ * A queue with a high watermark is bounded: wait_and_push blocks and is_full
+ * reports true until the consumer drained it down to the low watermark.
+ * Pushes beyond the watermark are still accepted up to the capacity of the
+ * ring, push only blocks if the ring itself is full.
  */
 template<typename T>
 class ConcurrentQueue
 {
-	mutable std::mutex mutex_;
-	std::condition_variable condition_;
-	std::queue<std::shared_ptr<T>> queue_;
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		alignas(T) unsigned char storage[sizeof(T)];
+
+		T *value()
+		{
+			return std::launder(reinterpret_cast<T *>(storage));
+		}
+	};
+
+	static constexpr size_t CACHE_LINE_SIZE = 64;
+	static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+	const size_t high_watermark_;
+	const size_t low_watermark_;
+	const size_t mask_;
+	const std::unique_ptr<Cell[]> cells_;
+
+	// producers and consumers each get their own cache line
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos_ = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos_ = 0;
+	alignas(CACHE_LINE_SIZE) std::atomic<bool> is_full_ = false;
+
+	// waiting threads register before they check the queue a last time
+	// under the lock, so a push or pop only locks if someone waits
+	std::atomic<size_t> waiting_consumers_ = 0;
+	std::atomic<size_t> waiting_producers_ = 0;
+	std::mutex wait_mutex_;
+	std::condition_variable consumer_condition_;
+	std::condition_variable producer_condition_;
+
+	std::mutex drained_mutex_;
+	std::vector<std::function<void()>> drained_handlers_;
+
+	std::atomic<std::function<void()> *> push_handler_ = nullptr;
+	std::atomic<size_t> push_handler_users_ = 0;
+
+	static size_t round_capacity(size_t capacity)
+	{
+		size_t rounded = 2;
+		while(rounded < capacity)
+		{
+			rounded *= 2;
+		}
+		return rounded;
+	}
+
+	/*
+	 * Moves from value only if there was a free cell
+	 */
+	bool try_emplace(T &value)
+	{
+		auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+		while(true)
+		{
+			auto &cell = cells_[pos & mask_];
+			const auto sequence = cell.sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+			if(diff == 0)
+			{
+				if(enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					// before the element is visible, so its pop checks the watermark again
+					check_full(pos + 1);
+					new(cell.storage) T(std::move(value));
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = enqueue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	std::optional<T> try_dequeue()
+	{
+		auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+		while(true)
+		{
+			auto &cell = cells_[pos & mask_];
+			const auto sequence = cell.sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::ptrdiff_t>(sequence - (pos + 1));
+			if(diff == 0)
+			{
+				if(dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					std::optional<T> result(std::move(*cell.value()));
+					cell.value()->~T();
+					cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+					return result;
+				}
+			}
+			else if(diff < 0)
+			{
+				return std::nullopt;
+			}
+			else
+			{
+				pos = dequeue_pos_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void check_full(size_t enqueue_pos)
+	{
+		if(high_watermark_ != 0 && enqueue_pos - dequeue_pos_.load() >= high_watermark_)
+		{
+			is_full_ = true;
+		}
+	}
+
+	/*
+	 * Has to be called after every pop
+	 */
+	void popped()
+	{
+		if(is_full_ && size() <= low_watermark_ && is_full_.exchange(false))
+		{
+			std::vector<std::function<void()>> handlers;
+			{
+				std::scoped_lock lk(drained_mutex_);
+				handlers.swap(drained_handlers_);
+			}
+			for(auto &handler : handlers)
+			{
+				handler();
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiting_producers_ > 0)
+		{
+			std::scoped_lock lk(wait_mutex_);
+			producer_condition_.notify_all();
+		}
+	}
+
+	/*
+	 * Has to be called after every push
+	 */
+	void pushed()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(waiting_consumers_ > 0)
+		{
+			std::scoped_lock lk(wait_mutex_);
+			consumer_condition_.notify_one();
+		}
+
+		++push_handler_users_;
+		if(auto *handler = push_handler_.load())
+		{
+			(*handler)();
+		}
+		--push_handler_users_;
+	}
+
+	/*
+	 * Waits until ready or the deadline, forever without one. Returns
+	 * whether the queue got ready.
+	 */
+	template<typename Predicate>
+	bool wait_as_producer(Predicate ready, std::optional<std::chrono::steady_clock::time_point> deadline = std::nullopt)
+	{
+		std::unique_lock lk(wait_mutex_);
+		++waiting_producers_;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool is_ready = true;
+		if(deadline.has_value())
+		{
+			is_ready = producer_condition_.wait_until(lk, deadline.value(), ready);
+		}
+		else
+		{
+			producer_condition_.wait(lk, ready);
+		}
+		--waiting_producers_;
+		return is_ready;
+	}
+
+	/*
+	 * Waits for an element until the deadline, forever without one
+	 */
+	std::optional<T> wait_as_consumer(std::optional<std::chrono::steady_clock::time_point> deadline)
+	{
+		std::optional<T> result = try_dequeue();
+		if(!result.has_value())
+		{
+			std::unique_lock lk(wait_mutex_);
+			++waiting_consumers_;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const auto ready = [this, &result] {
+				result = try_dequeue();
+				return result.has_value();
+			};
+			if(deadline.has_value())
+			{
+				consumer_condition_.wait_until(lk, deadline.value(), ready);
+			}
+			else
+			{
+				consumer_condition_.wait(lk, ready);
+			}
+			--waiting_consumers_;
+		}
+
+		if(result.has_value())
+		{
+			popped();
+		}
+		return result;
+	}
 
 public:
-	ConcurrentQueue()
+	/*
+	 * The capacity gets rounded up to a power of two. Without one the ring
+	 * holds four times the high watermark, at least DEFAULT_CAPACITY.
+	 */
+	ConcurrentQueue(size_t high_watermark = 0, size_t low_watermark = 0, size_t capacity = 0)
+		: high_watermark_(high_watermark)
+		, low_watermark_(std::min(low_watermark, high_watermark))
+		, mask_(round_capacity(capacity ? capacity : std::max(DEFAULT_CAPACITY, 4 * high_watermark)) - 1)
+		, cells_(std::make_unique<Cell[]>(mask_ + 1))
+	{
+		for(size_t i = 0; i <= mask_; ++i)
+		{
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~ConcurrentQueue()
 	{
+		while(try_dequeue().has_value())
+		{
+		}
+		delete push_handler_.load();
 	}
 
+	ConcurrentQueue(const ConcurrentQueue &) = delete;
+	ConcurrentQueue &operator=(const ConcurrentQueue &) = delete;
+
 	bool try_pop(T &value)
 	{
-		std::unique_lock lk(mutex_);
-		if(queue_.empty())
+		auto result = try_pop();
+		if(!result.has_value())
 		{
 			return false;
 		}
 
-		value = *queue_.front().get();
-		queue_.pop();
-
+		value = std::move(result.value());
 		return true;
 	}
 
+	/*
+	 * Returns nullopt if the queue is empty
+	 */
+	std::optional<T> try_pop()
+	{
+		auto result = try_dequeue();
+		if(result.has_value())
+		{
+			popped();
+		}
+		return result;
+	}
+
 	void wait_and_pop(T &value)
 	{
-		std::unique_lock lk(mutex_);
-		condition_.wait(lk, [this] { return not queue_.empty(); });
-		value = std::move(*queue_.front());
-		queue_.pop();
+		value = std::move(wait_and_pop().value());
 	}
 
-	std::shared_ptr<T> wait_and_pop()
+	std::optional<T> wait_and_pop()
 	{
-		std::unique_lock lk(mutex_);
-		condition_.wait(lk, [this] { return not queue_.empty(); });
-		auto result = std::move(queue_.front());
-		queue_.pop();
-		return result;
+		return wait_as_consumer(std::nullopt);
+	}
+
+	std::optional<T> wait_for_and_pop(int dur = 1)
+	{
+		return wait_as_consumer(std::chrono::steady_clock::now() + dur * 1ms);
 	}
 
-	std::shared_ptr<T> wait_for_and_pop(int dur = 1)
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	/*
+	 * Includes pushes that are still in progress
+	 */
+	size_t size() const
+	{
+		const auto dequeue_pos = dequeue_pos_.load();
+		const auto enqueue_pos = enqueue_pos_.load();
+		return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+	}
+
+	size_t capacity() const
+	{
+		return mask_ + 1;
+	}
+
+	/*
+	 * True once the high watermark was reached, until the queue
+	 * drained to the low watermark again
+	 */
+	bool is_full() const
+	{
+		return is_full_;
+	}
+
+	/*
+	 * Calls the handler once the queue is not full anymore.
+	 * If it is not full right now the handler is called immediately.
+	 */
+	void on_drained(std::function<void()> handler)
 	{
-		std::unique_lock lk(mutex_);
-		if(condition_.wait_for(lk, dur*1ms, [this] { return not queue_.empty(); }))
 		{
-			auto result = std::move(queue_.front());
-			queue_.pop();
-			return result;
+			// a pop clears is_full_ before it takes the handlers
+			std::scoped_lock lk(drained_mutex_);
+			if(is_full_)
+			{
+				drained_handlers_.push_back(std::move(handler));
+				return;
+			}
 		}
-		return nullptr;
+
+		handler();
 	}
 
-	bool empty() const
+	/*
+	 * Calls the handler after every push, so a consumer can get scheduled
+	 * instead of waiting in a pop. An empty handler removes it, once this
+	 * returns the old handler is not running anymore.
+	 */
+	void set_push_handler(std::function<void()> handler)
 	{
-		std::scoped_lock lk(mutex_);
-		return queue_.empty();
+		auto *old_handler = push_handler_.exchange(handler ? new std::function<void()>(std::move(handler)) : nullptr);
+		while(push_handler_users_ > 0)
+		{
+			std::this_thread::yield();
+		}
+		delete old_handler;
 	}
 
 	void push_new(T &&new_value)
 	{
-		/* auto new_value_ptr = std::make_unique<T>(std::move(new_value)); */
-		std::scoped_lock lk(mutex_);
-		queue_.emplace(std::make_shared<T>(std::forward<T>(new_value)));
-		condition_.notify_one();
+		push(std::move(new_value));
 	}
 
+	/*
+	 * Never blocks below the capacity, producers that must not block check
+	 * is_full() instead
+	 */
 	void push(T new_value)
 	{
-		/* auto new_value_ptr = std::make_unique<T>(std::move(new_value)); */
-		std::scoped_lock lk(mutex_);
-		queue_.push(std::make_shared<T>(std::move(new_value)));
-		condition_.notify_one();
+		while(!try_emplace(new_value))
+		{
+			wait_as_producer([this] { return size() < capacity(); });
+		}
+		pushed();
+	}
+
+	/*
+	 * Blocks while the queue is full
+	 */
+	void wait_and_push(T new_value)
+	{
+		if(is_full_)
+		{
+			wait_as_producer([this] { return !is_full_; });
+		}
+		push(std::move(new_value));
+	}
+
+	/*
+	 * Waits while the queue is full, false if it still is at the deadline
+	 */
+	bool wait_while_full(std::chrono::steady_clock::time_point deadline)
+	{
+		return !is_full_ || wait_as_producer([this] { return !is_full_; }, deadline);
 	}
 };
 
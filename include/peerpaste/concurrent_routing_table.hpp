@@ -1,6 +1,8 @@
 #ifndef CONCURRENT_ROUTING_TABLE
 #define CONCURRENT_ROUTING_TABLE
 
+#include <array>
+#include <bit>
 #include <condition_variable>
 #include <iostream>
 #include <memory>
@@ -8,6 +10,7 @@
 #include <vector>
 
 #include "peerpaste/cryptowrapper.hpp"
+#include "peerpaste/node_id.hpp"
 
 namespace peerpaste
 {
@@ -157,6 +160,41 @@ public:
 		return successor_list_;
 	}
 
+	/*
+	 * Gets the last successor that lies between self and id, or self if none
+	 * does. The ids are checked in batches, without copying the peers.
+	 */
+	bool try_get_closest_preceding(const NodeId &id, T &value) const
+	{
+		std::scoped_lock lk(mutex_);
+		if(self_ == nullptr)
+		{
+			return false;
+		}
+
+		const auto self_id = self_->get_id();
+		std::array<NodeId, 64> batch;
+		for(size_t end = successor_list_.size(); end > 0;)
+		{
+			const size_t begin = end > batch.size() ? end - batch.size() : 0;
+			for(size_t i = begin; i < end; ++i)
+			{
+				batch[i - begin] = successor_list_[i].get_id();
+			}
+
+			const auto mask = util::between_mask(self_id, {batch.data(), end - begin}, id);
+			if(mask != 0)
+			{
+				value = successor_list_[begin + std::bit_width(mask) - 1];
+				return true;
+			}
+			end = begin;
+		}
+
+		value = *self_;
+		return true;
+	}
+
 	bool pop_front()
 	{
 		std::scoped_lock lk(mutex_);
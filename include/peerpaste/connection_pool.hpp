@@ -0,0 +1,90 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "peerpaste/session_factory.hpp"
+
+namespace peerpaste
+{
+
+/*
+ * ConnectionPool
+ * Keeps one outgoing session per ip:port open and reuses it for every
+ * following request to that peer. Responses are matched by their
+ * correlational id, so they can arrive on any pooled session.
+ */
+class ConnectionPool
+{
+public:
+	ConnectionPool(SessionFactory &session_factory)
+		: session_factory_(session_factory)
+	{
+	}
+
+	/*
+	 * Writes the message to the session connected to address:port.
+	 * A new session gets connected if there is none or the old one was closed.
+	 */
+	SessionPtr write_to(DataBuffer message,
+											const std::string &address,
+											const std::string &port,
+											SendPolicy policy = SendPolicy::CLOSE,
+											MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		std::scoped_lock lk{mutex_};
+		const auto key = address + ":" + port;
+
+		const auto search = sessions_.find(key);
+		if(search != sessions_.end() && search->second->is_open())
+		{
+			search->second->write(std::move(message), policy, priority);
+			return search->second;
+		}
+
+		// sessions close themselves on errors or when idle, drop them here
+		std::erase_if(sessions_, [](const auto &entry) { return !entry.second->is_open(); });
+
+		auto session = session_factory_.create();
+		session->write_to(std::move(message), address, port, policy, priority);
+		sessions_.insert_or_assign(key, session);
+		return session;
+	}
+
+	/*
+	 * Encodings accepted by the peer listening on address:port, known once
+	 * a response arrived on its pooled session
+	 */
+	uint32_t get_accept_encoding(const std::string &address, const std::string &port) const
+	{
+		std::scoped_lock lk{mutex_};
+		const auto search = sessions_.find(address + ":" + port);
+		if(search == sessions_.end() || !search->second->is_open())
+		{
+			return Encoding::IDENTITY;
+		}
+		return search->second->get_accept_encoding();
+	}
+
+	size_t size() const
+	{
+		std::scoped_lock lk{mutex_};
+		return sessions_.size();
+	}
+
+	void clear()
+	{
+		std::scoped_lock lk{mutex_};
+		sessions_.clear();
+	}
+
+private:
+	SessionFactory &session_factory_;
+
+	mutable std::mutex mutex_;
+	std::map<std::string, SessionPtr> sessions_;
+};
+
+} // namespace peerpaste
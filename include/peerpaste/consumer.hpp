@@ -5,25 +5,36 @@
 #include <boost/property_tree/ptree.hpp>
 #undef BOOST_BIND_GLOBAL_PLACEHOLDERS
 
+#include <algorithm>
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "peerpaste/boost_session.hpp"
+#include "peerpaste/compression.hpp"
 #include "peerpaste/concurrent_queue.hpp"
+#include "peerpaste/connection_pool.hpp"
+#include "peerpaste/io_context_pool.hpp"
 #include "peerpaste/message.hpp"
 #include "peerpaste/message_converter.hpp"
 #include "peerpaste/message_handler.hpp"
 #include "peerpaste/observer_base.hpp"
 #include "peerpaste/request_object.hpp"
 #include "peerpaste/session.hpp"
+#include "peerpaste/session_factory.hpp"
+#include "peerpaste/udp_transport.hpp"
+#include "peerpaste/weighted_queues.hpp"
 
 namespace peerpaste
 {
 
 using MsgPtr = std::unique_ptr<Message>;
 using SessionPtr = std::shared_ptr<Session>;
-using MsgBufPair = std::pair<std::vector<uint8_t>, SessionPtr>;
+using MsgBufPair = ReceivedMessage;
 using MsgPair = std::pair<MsgPtr, SessionPtr>;
 
 class MessageDispatcher
@@ -31,63 +42,106 @@ class MessageDispatcher
 public:
 	// TODO: should init both queues and provide getter() functions to get
 	// shared_ptrs of them
-	MessageDispatcher(std::shared_ptr<MessageHandler> msg_handler)
-		: msg_handler_(msg_handler)
-		, input_queue_(std::make_shared<ConcurrentQueue<MsgBufPair>>())
-		, output_queue_(std::make_shared<ConcurrentQueue<RequestObject>>())
+	MessageDispatcher(std::shared_ptr<MessageHandler> msg_handler,
+										unsigned thread_count = DEFAULT_THREAD_COUNT,
+										IoMode io_mode = IoMode::SHARED,
+										Transport transport = Transport::ASIO)
+		: io_context_pool_(thread_count, io_mode)
+		, msg_handler_(msg_handler)
+		// one decode lane per network thread, shared io_contexts have several
+		, input_queues_(make_receive_queues(io_context_pool_.get_thread_count()))
+		, datagram_queue_(make_receive_queues(1).front())
+		, receive_lanes_(std::make_unique<ReceiveLane[]>(input_queues_.size() + 1))
+		, session_factory_(io_context_pool_, input_queues_, transport)
+		, connection_pool_(session_factory_)
+		, udp_transport_(std::make_shared<UdpTransport>(io_context_pool_.get_io_context(0), datagram_queue_))
+		, dispatch_pool_(input_queues_.size() + 2)
+		, bulk_write_pool_(input_queues_.size())
 	{
+		for(size_t lane = 0; lane < input_queues_.size(); ++lane)
+		{
+			receive_lanes_[lane].queue = input_queues_[lane];
+		}
+		// maintenance requests mostly come as datagrams, a lane of their own
+		// keeps them from being dropped while the other lanes are full
+		receive_lanes_[input_queues_.size()].queue = datagram_queue_;
 	}
 
+	/*
+	 * The receive queue of the first decode lane, for producers that are
+	 * not sessions of the session factory
+	 */
 	std::shared_ptr<ConcurrentQueue<MsgBufPair>> get_receive_queue()
 	{
-		return input_queue_;
+		return input_queues_.front();
+	}
+
+	/*
+	 * Messages are serialized on the thread handing them over, the session
+	 * send queues carry the finished frames
+	 */
+	MessageHandler::SendFunction get_send_function()
+	{
+		return [this](const RequestObject &send_object) { send(send_object); };
 	}
 
-	std::shared_ptr<ConcurrentQueue<RequestObject>> get_send_queue()
+	IoContextPool &get_io_context_pool()
 	{
-		return output_queue_;
+		return io_context_pool_;
 	}
 
-	boost::asio::io_context &get_context()
+	SessionFactory &get_session_factory()
 	{
-		return io_context_;
+		return session_factory_;
+	}
+
+	const std::shared_ptr<UdpTransport> &get_udp_transport()
+	{
+		return udp_transport_;
 	}
 
 	/*
 	 * Should be called to start handling messages. Stoped by calling stop()
-	 * Pops Msg from Queue, converts it and dispatches it to the MessageHandler
+	 * Every push onto a receive queue schedules draining it on the
+	 * dispatch_pool_, so idle queues cost no wakeups. The receive queues are
+	 * decoded in parallel, each one in order.
 	 */
 	void run()
 	{
-		thread_pool_deprecated_.emplace_back([this] { run_internal(); });
-		thread_pool_deprecated_.emplace_back([this] { run_send_internal(); });
-
-		// TODO: add thread count instead of 4
-		for(int i = 0; i < 4; ++i)
+		for(size_t lane = 0; lane < get_receive_lane_count(); ++lane)
 		{
-			asio_pool_.emplace_back([this] { io_context_.run(); });
+			receive_lanes_[lane].queue->set_push_handler([this, lane] { schedule_receive(lane); });
+			// messages queued before run() did not schedule anything
+			schedule_receive(lane);
 		}
+		session_factory_.run();
+		io_context_pool_.run();
 	}
 
 	void stop()
 	{
 		run_ = false;
-		io_context_.stop();
+		// sessions of other nodes may still push after the dispatcher is gone
+		for(size_t lane = 0; lane < get_receive_lane_count(); ++lane)
+		{
+			receive_lanes_[lane].queue->set_push_handler(nullptr);
+		}
+		udp_transport_->close();
+		connection_pool_.clear();
+		session_factory_.stop();
+		io_context_pool_.stop();
+		dispatch_pool_.stop();
+		bulk_write_pool_.stop();
 		for(auto &thread_pool : thread_pool_deprecated_)
 		{
 			spdlog::debug("joining thread of thread_pool_deprecated_");
 			thread_pool.join();
 		}
-		while(not io_context_.stopped())
-		{
-			spdlog::debug("wait for io_context to stop");
-			std::this_thread::sleep_for(std::chrono::seconds(1));
-		}
-		for(auto &asio_pool : asio_pool_)
-		{
-			spdlog::debug("joining thread of asio_pool_");
-			asio_pool.join();
-		}
+		thread_pool_deprecated_.clear();
+		spdlog::debug("joining threads of io_context_pool_");
+		io_context_pool_.join();
+		dispatch_pool_.join();
+		bulk_write_pool_.join();
 	}
 
 	void join()
@@ -96,10 +150,9 @@ public:
 		{
 			it->join();
 		}
-		for(auto it2 = asio_pool_.begin(); it2 < asio_pool_.end(); it2++)
-		{
-			it2->join();
-		}
+		io_context_pool_.join();
+		dispatch_pool_.join();
+		bulk_write_pool_.join();
 	}
 
 	void send_routing_information()
@@ -107,95 +160,319 @@ public:
 		thread_pool_deprecated_.emplace_back([this] { send_routing_information_internal(); });
 	}
 
-	void run_internal()
+	/*
+	 * Converts a received message into the RequestObject to dispatch,
+	 * nullptr if the message could not be decoded
+	 */
+	std::unique_ptr<RequestObject> decode_received(MsgBufPair &msg_pair)
 	{
 		ProtobufMessageConverter converter;
-		while(run_)
+		// Convert msg_buffer into Message object
+		auto converted_message = converter.MessageFromSerialized(msg_pair.first.data(), msg_pair.first.size());
+		// hand the receive buffer back to the pool right after decoding
+		msg_pair.first = PooledBuffer{};
+		if(converted_message == nullptr)
 		{
-			// Get unique_ptr to MsgPair from queue
-			auto msg_pair = input_queue_->wait_for_and_pop();
-			if(msg_pair == nullptr)
-				continue;
-			// Convert msg_buffer into Message object
-			// TODO: handle failure on MessageFromSerialized!!!
-			auto converted_message = converter.MessageFromSerialized(std::get<0>(std::move(*msg_pair.get())));
-			// create RequestObject
-			auto data_object = std::make_unique<RequestObject>();
-			// set msg
-			data_object->set_message(std::move(converted_message));
-			// set conn
-			data_object->set_connection(std::move(std::get<1>(*msg_pair.get())));
-			// dispatch
-			dispatch(std::move(data_object));
+			return nullptr;
 		}
+		// create RequestObject
+		auto data_object = std::make_unique<RequestObject>();
+		data_object->set_accept_encoding(converted_message->get_header().get_accept_encoding());
+		// set msg
+		data_object->set_message(std::move(converted_message));
+		// set conn
+		data_object->set_connection(std::move(msg_pair.second));
+		remember_accept_encoding(*data_object);
+		return data_object;
 	}
 
-	void run_send_internal()
+	/*
+	 * Sets what sessions do with messages of the given type when their send
+	 * queue is full. Has to be called before run().
+	 */
+	void set_send_policy(MessageType type, SendPolicy policy)
 	{
-		ProtobufMessageConverter converter;
-		while(run_)
+		send_policies_.insert_or_assign(type, policy);
+	}
+
+	SendPolicy get_send_policy(MessageType type) const
+	{
+		const auto search = send_policies_.find(type);
+		if(search == send_policies_.end())
+		{
+			return SendPolicy::CLOSE;
+		}
+		return search->second;
+	}
+
+	/*
+	 * Sets whether requests of the given type to peers go over tcp or udp.
+	 * Has to be called before run(), the network threads read the table
+	 * without locking.
+	 */
+	void set_message_transport(MessageType type, MessageTransport transport)
+	{
+		message_transports_.insert_or_assign(type, transport);
+	}
+
+	MessageTransport get_message_transport(MessageType type) const
+	{
+		const auto search = message_transports_.find(type);
+		if(search == message_transports_.end())
+		{
+			return MessageTransport::TCP;
+		}
+		return search->second;
+	}
+
+	/*
+	 * Sets how file chunks and file lists get compressed for peers that
+	 * accept it. Has to be called before run().
+	 */
+	void set_compression_options(const CompressionOptions &options)
+	{
+		compression_options_ = options;
+	}
+
+	/*
+	 * Serializes a message and writes it to its session or peer. Called by
+	 * the thread that created the message.
+	 */
+	void send(const RequestObject &send_object)
+	{
+		if(!run_)
+		{
+			return;
+		}
+
+		ProtobufMessageConverter converter(compression_options_);
+		// get the message to send
+		const auto &message = send_object.get_message();
+		auto message_is_request = message->is_request();
+		const auto accepted_encodings = get_accepted_encodings(send_object);
+
+		// chunks that get compressed cannot be sent from the file, so they are read here
+		bool has_file_range = send_object.has_file_range();
+		if(has_file_range && converter.CompressesFileChunk(accepted_encodings, send_object.get_file_range().size))
 		{
-			// Get unique_ptr to RequestObject from queue
-			auto send_object = output_queue_->wait_for_and_pop();
-			if(send_object == nullptr)
-				continue;
-			// get the message to send
-			auto message = send_object->get_message();
-			auto message_is_request = message->is_request();
-
-			// convert message to buf
-			auto message_buf = converter.SerializedFromMessage(message);
-			std::vector<boost::uint8_t> encoded_buf;
-			// header size used in session is 4
-			encoded_buf.resize(4);
-			encode_header(encoded_buf, message_buf.size());
-			encoded_buf.insert(
-				encoded_buf.end(), std::make_move_iterator(message_buf.begin()), std::make_move_iterator(message_buf.end()));
-
-			if(send_object->is_session())
+			const auto &range = send_object.get_file_range();
+			FileChunk file_chunk;
+			file_chunk.offset = range.offset;
+			file_chunk.size = range.size;
+			file_chunk.data.resize(range.size);
+			if(read_file_range(range, file_chunk.data.data()))
 			{
-				const auto session = send_object->get_session();
+				message->set_file_chunk(std::move(file_chunk));
+				has_file_range = false;
+			}
+		}
+
+		// convert message to buf, the session prepends the length prefix
+		auto message_buf = converter.SerializedFromMessage(message, accepted_encodings);
+		const auto send_policy = get_send_policy(send_object.get_message_type());
+		const auto priority = message_priority(send_object.get_message_type());
 
-				if(send_object->has_on_write_handler())
+		if(send_object.is_session())
+		{
+			const auto session = send_object.get_session();
+
+			if(has_file_range)
+			{
+				const auto &range = send_object.get_file_range();
+				ProtobufMessageConverter::AppendFileChunkHeader(message_buf, range.offset, range.size);
+				const auto on_write = send_object.has_on_write_handler()
+																? post_write_handler(send_object.get_on_write_handler(), priority)
+																: [](bool) {};
+				session->write_file(std::move(message_buf), range, on_write, send_policy, priority);
+			}
+			else if(send_object.has_on_write_handler())
+			{
+				session->write_direct(std::move(message_buf),
+															post_write_handler(send_object.get_on_write_handler(), priority),
+															send_policy,
+															priority);
+			}
+			else
+			{
+				session->write(std::move(message_buf), send_policy, priority);
+				if(message_is_request)
 				{
-					session->write_direct(encoded_buf, send_object->get_on_write_handler());
+					session->read();
 				}
-				else
+			}
+		}
+		else
+		{
+			// TODO: this is too session/boost specific
+			// when using a test_socket or something like that this code
+			// should be more abstract so that the message_handler does not need
+			// to know what kind of object sends the data somewhere
+			auto peer = send_object.get_peer();
+			if(message_is_request)
+			{
+				if(send_over_udp(send_object.get_message_type(), message_buf, *peer, send_policy))
 				{
-					session->write(encoded_buf);
-					if(message_is_request)
-					{
-						session->read();
-					}
+					return;
 				}
 			}
-			else
+			auto write_handler =
+				connection_pool_.write_to(std::move(message_buf), peer->get_ip(), peer->get_port(), send_policy, priority);
+			if(message_is_request)
 			{
-				// TODO: this is too session/boost specific
-				// when using a test_socket or something like that this code
-				// should be more abstract so that the message_handler does not need
-				// to know what kind of object sends the data somewhere
-				auto peer = send_object->get_peer();
-				auto write_handler = std::make_shared<BoostSession>(io_context_, input_queue_);
-				write_handler->write_to(encoded_buf, peer->get_ip(), peer->get_port());
-				send_object->set_connection(write_handler);
-				if(message_is_request)
+				write_handler->read();
+			}
+		}
+	}
+
+	/*
+	 * Write handlers usually send the next message of their request. They
+	 * run on the dispatch_pool_, so they neither block an io thread nor
+	 * recurse into send() when a session completes the write right away.
+	 * Bulk transfers wait for slow peers on threads of their own.
+	 */
+	std::function<void(bool)> post_write_handler(std::function<void(bool)> handler, MessagePriority priority)
+	{
+		auto &pool = priority == MessagePriority::BULK ? bulk_write_pool_ : dispatch_pool_;
+		return [&pool, handler = std::move(handler)](bool failed) {
+			boost::asio::post(pool, [handler, failed] { handler(failed); });
+		};
+	}
+
+	/*
+	 * Sessions remember what their peer accepts. Requests to a Peer go over
+	 * the pooled session connected to its listening address, which learns
+	 * it from the responses, so peers sharing an ip are told apart.
+	 */
+	void remember_accept_encoding(const RequestObject &request)
+	{
+		if(request.is_session())
+		{
+			request.get_session()->set_accept_encoding(request.get_accept_encoding());
+		}
+	}
+
+	uint32_t get_accepted_encodings(const RequestObject &request) const
+	{
+		if(request.is_session())
+		{
+			return request.get_accept_encoding();
+		}
+
+		const auto peer = request.get_peer();
+		return connection_pool_.get_accept_encoding(peer->get_ip(), peer->get_port());
+	}
+
+	/*
+	 * Sends a request as datagram if its type is configured for udp and the
+	 * peer's address needs no lookup. A request left unanswered by udp gets
+	 * sent over tcp. Returns nullptr if the request has to go over tcp.
+	 */
+	SessionPtr send_over_udp(MessageType type, const DataBuffer &message_buf, const Peer &peer, SendPolicy send_policy)
+	{
+		if(get_message_transport(type) != MessageTransport::UDP || !udp_transport_->is_open() ||
+			 message_buf.size() > UdpTransport::MAX_PAYLOAD_SIZE)
+		{
+			return nullptr;
+		}
+
+		const auto endpoint = udp_transport_->resolve(peer.get_ip(), peer.get_port());
+		if(!endpoint.has_value())
+		{
+			return nullptr;
+		}
+
+		return udp_transport_->send_request(
+			message_buf,
+			endpoint.value(),
+			[this, ip = peer.get_ip(), port = peer.get_port(), send_policy, priority = message_priority(type)](
+				DataBuffer message) {
+				if(!run_)
+				{
+					return;
+				}
+				spdlog::debug("udp request to {} unanswered, retrying over tcp", ip);
+				connection_pool_.write_to(std::move(message), ip, port, send_policy, priority)->read();
+			});
+	}
+
+	/*
+	 * The receive queues of the network threads and the one of datagrams
+	 */
+	size_t get_receive_lane_count() const
+	{
+		return input_queues_.size() + 1;
+	}
+
+	void schedule_receive(size_t lane)
+	{
+		if(!run_ || receive_lanes_[lane].scheduled.exchange(true))
+		{
+			return;
+		}
+
+		boost::asio::post(dispatch_pool_, [this, lane] { drain_receive_lane(lane); });
+	}
+
+	/*
+	 * Decodes the messages of a receive queue ahead of dispatching them,
+	 * so maintenance messages get dispatched before the bulk ones received
+	 * earlier. Only one drain per lane runs at a time and messages of the
+	 * same priority are dispatched in the order they were received.
+	 * At most DRAIN_BATCH_SIZE messages are decoded ahead, the rest stay in
+	 * the receive queue and keep counting against its watermarks.
+	 */
+	void drain_receive_lane(size_t lane)
+	{
+		auto &receive_lane = receive_lanes_[lane];
+		for(size_t i = 0; i < DRAIN_BATCH_SIZE && run_; ++i)
+		{
+			while(receive_lane.decoded.size() < DRAIN_BATCH_SIZE)
+			{
+				auto element = receive_lane.queue->try_pop();
+				if(!element.has_value())
+				{
+					break;
+				}
+				auto data_object = decode_received(*element);
+				if(data_object == nullptr)
 				{
-					write_handler->read();
+					continue;
 				}
+				const auto priority = message_priority(data_object->get_message_type());
+				receive_lane.decoded.push(std::move(data_object), priority);
 			}
-			send_object->set_time_point();
+
+			auto data_object = receive_lane.decoded.pop();
+			if(!data_object.has_value())
+			{
+				break;
+			}
+			dispatch(std::move(data_object.value()));
+		}
+
+		if(!receive_lane.decoded.empty() && run_)
+		{
+			// stays scheduled, posted again so that the other lanes get their turn
+			boost::asio::post(dispatch_pool_, [this, lane] { drain_receive_lane(lane); });
+			return;
+		}
+
+		receive_lane.scheduled = false;
+		// pushes that found the drain still scheduled did not post one
+		if(!receive_lane.queue->empty())
+		{
+			schedule_receive(lane);
 		}
 	}
 
-	void encode_header(std::vector<boost::uint8_t> &buf, unsigned size) const
+	static std::vector<std::shared_ptr<ConcurrentQueue<MsgBufPair>>> make_receive_queues(size_t count)
 	{
-		// header size is 4
-		assert(buf.size() >= 4);
-		buf[0] = static_cast<boost::uint8_t>((size >> 24) & 0xFF);
-		buf[1] = static_cast<boost::uint8_t>((size >> 16) & 0xFF);
-		buf[2] = static_cast<boost::uint8_t>((size >> 8) & 0xFF);
-		buf[3] = static_cast<boost::uint8_t>(size & 0xFF);
+		std::vector<std::shared_ptr<ConcurrentQueue<MsgBufPair>>> queues;
+		for(size_t i = 0; i < std::max<size_t>(count, 1); ++i)
+		{
+			queues.push_back(std::make_shared<ConcurrentQueue<MsgBufPair>>(QUEUE_HIGH_WATERMARK, QUEUE_LOW_WATERMARK));
+		}
+		return queues;
 	}
 
 	/*
@@ -243,9 +520,10 @@ public:
 			return;
 		}
 
-		tcp::resolver resolver(io_context_);
+		auto &io_context = io_context_pool_.get_io_context();
+		tcp::resolver resolver(io_context);
 		auto endpoint = resolver.resolve("127.0.0.1", "8080");
-		tcp::socket socket(io_context_);
+		tcp::socket socket(io_context);
 		boost::asio::connect(socket, endpoint);
 
 		boost::asio::streambuf request;
@@ -256,9 +534,9 @@ public:
 		using boost::property_tree::write_json;
 
 		ptree root, info;
-		info.put("successor", succ.get_id());
-		info.put("predecessor", pre.get_id());
-		root.put_child(self.get_id(), info);
+		info.put("successor", succ.get_id().to_string());
+		info.put("predecessor", pre.get_id().to_string());
+		root.put_child(self.get_id().to_string(), info);
 
 		std::ostringstream buf;
 		write_json(buf, root, false);
@@ -282,15 +560,55 @@ public:
 	}
 
 private:
-	boost::asio::io_context io_context_;
+	static constexpr unsigned DEFAULT_THREAD_COUNT = 4;
+	// messages handled by one drain before it gets posted again, and decoded
+	// ahead of dispatching per lane
+	static constexpr size_t DRAIN_BATCH_SIZE = 64;
+	// messages dispatched per round from the decoded messages of a lane, by priority
+	static constexpr WeightedQueues<std::unique_ptr<RequestObject>>::Weights DISPATCH_WEIGHTS{16, 4, 1};
+	// messages queued between sessions and dispatcher before reading pauses
+	static constexpr size_t QUEUE_HIGH_WATERMARK = 1024;
+	static constexpr size_t QUEUE_LOW_WATERMARK = 256;
+
+	IoContextPool io_context_pool_;
 	std::shared_ptr<MessageHandler> msg_handler_;
-	std::shared_ptr<ConcurrentQueue<MsgBufPair>> input_queue_;
-	std::shared_ptr<ConcurrentQueue<RequestObject>> output_queue_;
+	/*
+	 * A receive queue and the messages decoded from it but not dispatched
+	 * yet. Only the scheduled drain of the lane touches decoded.
+	 */
+	struct ReceiveLane
+	{
+		std::shared_ptr<ConcurrentQueue<MsgBufPair>> queue;
+		std::atomic<bool> scheduled = false;
+		WeightedQueues<std::unique_ptr<RequestObject>> decoded{DISPATCH_WEIGHTS};
+	};
+
+	std::vector<std::shared_ptr<ConcurrentQueue<MsgBufPair>>> input_queues_;
+	std::shared_ptr<ConcurrentQueue<MsgBufPair>> datagram_queue_;
+	// the input queues followed by the datagram queue
+	std::unique_ptr<ReceiveLane[]> receive_lanes_;
+	SessionFactory session_factory_;
+	ConnectionPool connection_pool_;
+	std::shared_ptr<UdpTransport> udp_transport_;
+	// small maintenance requests of the stabilization rounds skip the tcp handshake
+	std::map<MessageType, MessageTransport> message_transports_{
+		{MessageType::CHECK_PREDECESSOR, MessageTransport::UDP},
+		{MessageType::NOTIFICATION, MessageTransport::UDP},
+		{MessageType::GET_PRED_AND_SUCC_LIST, MessageTransport::UDP}};
+	// file chunks wait for the peer, file lists get resent periodically anyway
+	std::map<MessageType, SendPolicy> send_policies_{{MessageType::GET_FILE, SendPolicy::BLOCK},
+																									 {MessageType::BROADCAST_FILELIST, SendPolicy::DROP}};
+
+	CompressionOptions compression_options_;
 
 	std::vector<std::thread> thread_pool_deprecated_;
-	std::vector<std::thread> asio_pool_;
 
-	bool run_ = true;
+	std::atomic<bool> run_ = true;
+	// a thread per receive lane and one for write completions.
+	// Destroyed before the members above, its drains use them.
+	boost::asio::thread_pool dispatch_pool_;
+	// write completions of bulk transfers
+	boost::asio::thread_pool bulk_write_pool_;
 };
 
 } // namespace peerpaste
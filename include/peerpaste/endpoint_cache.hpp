@@ -0,0 +1,104 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace peerpaste
+{
+
+using Endpoints = std::vector<boost::asio::ip::tcp::endpoint>;
+
+/*
+ * EndpointCache
+ * Stores resolved endpoints per address:port for a limited time so that
+ * sessions connecting to the same peer do not have to hit the resolver again
+ */
+class EndpointCache
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	EndpointCache(Clock::duration ttl = DEFAULT_TTL)
+		: ttl_(ttl)
+	{
+	}
+
+	/*
+	 * Returns the endpoint directly if address and port are numeric,
+	 * so they never need to be resolved or cached
+	 */
+	static std::optional<Endpoints> from_numeric(const std::string &address, const std::string &port)
+	{
+		boost::system::error_code ec;
+		const auto ip = boost::asio::ip::make_address(address, ec);
+		if(ec || port.empty() || port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos)
+		{
+			return {};
+		}
+
+		const auto port_number = std::stoul(port);
+		if(port_number > 65535)
+		{
+			return {};
+		}
+
+		return Endpoints{{ip, static_cast<unsigned short>(port_number)}};
+	}
+
+	std::optional<Endpoints> get(const std::string &address, const std::string &port)
+	{
+		std::scoped_lock lk{mutex_};
+		const auto search = entries_.find(address + ":" + port);
+		if(search == entries_.end())
+		{
+			return {};
+		}
+
+		if(Clock::now() > search->second.expires)
+		{
+			entries_.erase(search);
+			return {};
+		}
+
+		return search->second.endpoints;
+	}
+
+	void put(const std::string &address, const std::string &port, Endpoints endpoints)
+	{
+		std::scoped_lock lk{mutex_};
+		entries_.insert_or_assign(address + ":" + port, Entry{std::move(endpoints), Clock::now() + ttl_});
+	}
+
+	void erase(const std::string &address, const std::string &port)
+	{
+		std::scoped_lock lk{mutex_};
+		entries_.erase(address + ":" + port);
+	}
+
+	size_t size() const
+	{
+		std::scoped_lock lk{mutex_};
+		return entries_.size();
+	}
+
+	static constexpr Clock::duration DEFAULT_TTL = std::chrono::seconds{300};
+
+private:
+	struct Entry
+	{
+		Endpoints endpoints;
+		Clock::time_point expires;
+	};
+
+	const Clock::duration ttl_;
+	mutable std::mutex mutex_;
+	std::map<std::string, Entry> entries_;
+};
+
+} // namespace peerpaste
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "peerpaste/buffer_pool.hpp"
+
+namespace peerpaste
+{
+
+/*
+ * FrameDecoder
+ * Buffers bytes read from a stream in large chunks and cuts them into
+ * length prefixed frames, so one read can yield many messages.
+ * Frames bigger than the buffer are moved into a pooled buffer early and
+ * their remaining bytes are read directly into it.
+ */
+class FrameDecoder
+{
+public:
+	static constexpr size_t HEADER_SIZE = 4;
+	static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+	FrameDecoder(size_t capacity = DEFAULT_CAPACITY)
+		: buffer_(capacity)
+	{
+	}
+
+	/*
+	 * Returns the free space behind the buffered bytes. Consumed bytes at
+	 * the front are dropped first so the whole capacity can be used.
+	 */
+	std::pair<uint8_t *, size_t> prepare()
+	{
+		if(begin_ == end_)
+		{
+			begin_ = end_ = 0;
+		}
+		else if(begin_ > 0 && buffer_.size() - end_ < buffer_.size() / 2)
+		{
+			std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+			end_ -= begin_;
+			begin_ = 0;
+		}
+
+		return {buffer_.data() + end_, buffer_.size() - end_};
+	}
+
+	void commit(size_t bytes)
+	{
+		end_ += bytes;
+	}
+
+	/*
+	 * Returns the next complete frame without its header. If the next frame
+	 * cannot fit into the buffer, it becomes the partial frame instead.
+	 */
+	std::optional<PooledBuffer> next_frame(BufferPool &pool)
+	{
+		if(has_partial_frame() || buffered() < HEADER_SIZE)
+		{
+			return {};
+		}
+
+		const size_t frame_size = decode_header(buffer_.data() + begin_);
+		const size_t available = buffered() - HEADER_SIZE;
+		if(available >= frame_size)
+		{
+			return take(pool, frame_size, frame_size);
+		}
+
+		if(HEADER_SIZE + frame_size > buffer_.size())
+		{
+			partial_filled_ = available;
+			partial_ = take(pool, frame_size, available);
+		}
+
+		return {};
+	}
+
+	bool has_partial_frame() const
+	{
+		return partial_.has_value();
+	}
+
+	/*
+	 * The part of the partial frame that still has to be read
+	 */
+	std::pair<uint8_t *, size_t> partial_remaining()
+	{
+		return {partial_->data() + partial_filled_, partial_->size() - partial_filled_};
+	}
+
+	/*
+	 * Marks bytes written into partial_remaining() as received, for callers
+	 * that fill the partial frame piecewise
+	 */
+	void commit_partial(size_t bytes)
+	{
+		partial_filled_ += bytes;
+	}
+
+	PooledBuffer take_partial_frame()
+	{
+		auto frame = std::move(partial_.value());
+		partial_.reset();
+		partial_filled_ = 0;
+		return frame;
+	}
+
+	size_t buffered() const
+	{
+		return end_ - begin_;
+	}
+
+	static size_t decode_header(const uint8_t *buf)
+	{
+		size_t msg_size = 0;
+		for(size_t i = 0; i < HEADER_SIZE; ++i)
+		{
+			msg_size = msg_size * 256 + (static_cast<size_t>(buf[i]) & 0xFF);
+		}
+		return msg_size;
+	}
+
+private:
+	/*
+	 * Moves frame_size bytes of the next frame into a pooled buffer.
+	 * Only the first copy_size bytes are buffered already.
+	 */
+	PooledBuffer take(BufferPool &pool, size_t frame_size, size_t copy_size)
+	{
+		auto frame = pool.acquire(frame_size);
+		if(copy_size > 0)
+		{
+			std::memcpy(frame.data(), buffer_.data() + begin_ + HEADER_SIZE, copy_size);
+		}
+		begin_ += HEADER_SIZE + copy_size;
+		return frame;
+	}
+
+	std::vector<uint8_t> buffer_;
+	size_t begin_ = 0;
+	size_t end_ = 0;
+	std::optional<PooledBuffer> partial_;
+	size_t partial_filled_ = 0;
+};
+
+} // namespace peerpaste
@@ -4,6 +4,11 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <utility>
+
+#include "compression.hpp"
+#include "message_type.hpp"
+#include "transaction_id.hpp"
 
 class Header
 {
@@ -12,8 +17,7 @@ public:
 		: t_flag_(0)
 		, ttl_(0)
 		, message_length_(0)
-		, request_type_("")
-		, transaction_id_("")
+		, request_type_(MessageType::UNKNOWN)
 		, version_("")
 		, response_code_("")
 	{
@@ -22,8 +26,8 @@ public:
 	Header(bool t_flag,
 				 uint32_t ttl,
 				 uint64_t message_length,
-				 std::string request_type,
-				 std::string transaction_id,
+				 MessageType request_type,
+				 TransactionId transaction_id,
 				 std::string version,
 				 std::string response_code)
 		: t_flag_(t_flag)
@@ -31,18 +35,17 @@ public:
 		, message_length_(message_length)
 		, request_type_(request_type)
 		, transaction_id_(transaction_id)
-		, correlational_id_("")
-		, version_(version)
-		, response_code_(response_code)
+		, version_(std::move(version))
+		, response_code_(std::move(response_code))
 	{
 	}
 
 	Header(bool t_flag,
 				 uint32_t ttl,
 				 uint64_t message_length,
-				 std::string request_type,
-				 std::string transaction_id,
-				 std::string correlational_id,
+				 MessageType request_type,
+				 TransactionId transaction_id,
+				 TransactionId correlational_id,
 				 std::string version,
 				 std::string response_code)
 		: t_flag_(t_flag)
@@ -51,8 +54,8 @@ public:
 		, request_type_(request_type)
 		, transaction_id_(transaction_id)
 		, correlational_id_(correlational_id)
-		, version_(version)
-		, response_code_(response_code)
+		, version_(std::move(version))
+		, response_code_(std::move(response_code))
 	{
 	}
 
@@ -98,32 +101,40 @@ public:
 		return message_length_;
 	}
 
-	void set_request_type(const std::string &request_type)
+	void set_message_type(MessageType request_type)
 	{
 		request_type_ = request_type;
 	}
 
-	std::string get_request_type() const
+	MessageType get_message_type() const
 	{
 		return request_type_;
 	}
 
-	void set_transaction_id(const std::string &transaction_id)
+	/*
+	 * The name of the message type, for logging
+	 */
+	std::string_view get_request_type() const
+	{
+		return message_type_name(request_type_);
+	}
+
+	void set_transaction_id(TransactionId transaction_id)
 	{
 		transaction_id_ = transaction_id;
 	}
 
-	std::string get_transaction_id() const
+	TransactionId get_transaction_id() const
 	{
 		return transaction_id_;
 	}
 
-	void set_correlational_id(const std::string &correlational_id)
+	void set_correlational_id(TransactionId correlational_id)
 	{
 		correlational_id_ = correlational_id;
 	}
 
-	std::string get_correlational_id() const
+	TransactionId get_correlational_id() const
 	{
 		return correlational_id_;
 	}
@@ -133,7 +144,12 @@ public:
 		version_ = version;
 	}
 
-	std::string get_version() const
+	void set_version(std::string &&version)
+	{
+		version_ = std::move(version);
+	}
+
+	const std::string &get_version() const
 	{
 		return version_;
 	}
@@ -143,20 +159,38 @@ public:
 		response_code_ = response_code;
 	}
 
-	std::string get_response_code() const
+	void set_response_code(std::string &&response_code)
+	{
+		response_code_ = std::move(response_code);
+	}
+
+	const std::string &get_response_code() const
 	{
 		return response_code_;
 	}
 
+	/*
+	 * Payload encodings the sender of the message can decode
+	 */
+	void set_accept_encoding(uint32_t accept_encoding)
+	{
+		accept_encoding_ = accept_encoding;
+	}
+
+	uint32_t get_accept_encoding() const
+	{
+		return accept_encoding_;
+	}
+
 	const std::string stringify() const
 	{
 		std::stringstream str;
-		str << t_flag_ << ttl_ << message_length_ << request_type_ << transaction_id_ << correlational_id_ << version_
+		str << t_flag_ << ttl_ << message_length_ << get_request_type() << transaction_id_ << correlational_id_ << version_
 				<< response_code_;
 		return str.str();
 	}
 
-	Header generate_response_header()
+	Header generate_response_header() const
 	{
 		if(!is_request())
 		{
@@ -166,8 +200,8 @@ public:
 		Header response_header(false,
 													 get_ttl(),
 													 get_message_length(),
-													 get_request_type(),
-													 "",
+													 get_message_type(),
+													 TransactionId{},
 													 get_transaction_id(),
 													 get_version(),
 													 get_response_code());
@@ -183,11 +217,13 @@ private:
 	bool t_flag_;
 	uint32_t ttl_;
 	uint64_t message_length_;
-	std::string request_type_;
-	std::string transaction_id_;
-	std::string correlational_id_;
+	MessageType request_type_;
+	TransactionId transaction_id_;
+	TransactionId correlational_id_;
 	std::string version_;
 	std::string response_code_;
+	// messages created here advertise what this build decodes
+	uint32_t accept_encoding_ = peerpaste::SUPPORTED_ENCODINGS;
 };
 
 #endif /* HEADER_H */
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace peerpaste
+{
+
+enum class IoMode
+{
+	// one io_context driven by all threads
+	SHARED = 0,
+	// one io_context per thread, each with its own acceptor and sessions
+	PER_CORE,
+};
+
+/*
+ * IoContextPool
+ * Owns the io_contexts the sessions run on and the threads driving them
+ */
+class IoContextPool
+{
+public:
+	IoContextPool(unsigned thread_count = 0, IoMode mode = IoMode::SHARED);
+	~IoContextPool();
+
+	IoContextPool(const IoContextPool &) = delete;
+	IoContextPool &operator=(const IoContextPool &) = delete;
+
+	/*
+	 * Returns the io_contexts in round robin order
+	 */
+	boost::asio::io_context &get_io_context();
+	boost::asio::io_context &get_io_context(size_t index);
+
+	size_t size() const;
+	unsigned get_thread_count() const;
+	IoMode get_mode() const;
+
+	void run();
+	void stop();
+	void join();
+
+private:
+	using WorkGuard = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+
+	const IoMode mode_;
+	const unsigned thread_count_;
+	std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+	std::vector<WorkGuard> work_guards_;
+	std::vector<std::thread> threads_;
+	std::atomic<size_t> next_ = 0;
+};
+
+} // namespace peerpaste
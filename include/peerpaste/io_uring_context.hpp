@@ -0,0 +1,135 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace peerpaste
+{
+
+/*
+ * IoUringContext
+ * An io_uring instance driven by its own thread. Operations queued on the
+ * ring thread are handed to the kernel in batches, one io_uring_enter call
+ * submits everything queued since the last call and waits for completions.
+ * The kernel ABI is used directly, so liburing is not needed.
+ *
+ * Besides the ring it owns a group of receive buffers provided to the kernel
+ * for multishot receives.
+ */
+class IoUringContext
+{
+public:
+	using Prepare = std::function<void(io_uring_sqe &)>;
+	// called for every completion, multishot operations complete more than once
+	using Handler = std::function<void(const io_uring_cqe &)>;
+
+	static constexpr unsigned DEFAULT_ENTRIES = 1024;
+	// must be a power of two
+	static constexpr unsigned RECV_BUFFER_COUNT = 256;
+	static constexpr size_t RECV_BUFFER_SIZE = 16 * 1024;
+
+	/*
+	 * Returns nullptr if the kernel lacks a feature the sessions rely on
+	 */
+	static std::unique_ptr<IoUringContext> create(unsigned entries = DEFAULT_ENTRIES);
+
+	~IoUringContext();
+
+	IoUringContext(const IoUringContext &) = delete;
+	IoUringContext &operator=(const IoUringContext &) = delete;
+
+	void run();
+	void stop();
+	void join();
+
+	/*
+	 * Runs fn on the ring thread, can be called from any thread
+	 */
+	void post(std::function<void()> fn);
+
+	/*
+	 * Queues an operation, only to be called on the ring thread.
+	 * Returns an id that can be passed to cancel()
+	 */
+	uint64_t submit(const Prepare &prepare, Handler handler);
+	void cancel(uint64_t id);
+
+	uint16_t get_buffer_group() const;
+	const uint8_t *get_recv_buffer(uint16_t id) const;
+	// hands a receive buffer back to the kernel once its data was consumed
+	void recycle_recv_buffer(uint16_t id);
+
+	/*
+	 * Whether the kernel sends gathered buffers zero copy, added in 6.1
+	 */
+	bool supports_zero_copy_send() const;
+
+private:
+	IoUringContext() = default;
+
+	bool setup(unsigned entries);
+	bool probe();
+	bool setup_recv_buffers();
+	int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+	io_uring_sqe &next_sqe();
+	void publish_sqe();
+	void loop();
+	void arm_wakeup();
+	void run_posted();
+	void reap();
+	void dispatch(const io_uring_cqe &cqe);
+
+	static constexpr uint64_t IGNORED_ID = 0;
+	static constexpr uint64_t WAKEUP_ID = 1;
+	static constexpr uint64_t FIRST_OPERATION_ID = 2;
+	static constexpr uint16_t BUFFER_GROUP = 0;
+
+	int ring_fd_ = -1;
+	int event_fd_ = -1;
+
+	// ring memory shared with the kernel
+	void *sq_ring_ = nullptr;
+	size_t sq_ring_size_ = 0;
+	void *cq_ring_ = nullptr;
+	size_t cq_ring_size_ = 0;
+	io_uring_sqe *sqes_ = nullptr;
+	size_t sqes_size_ = 0;
+	unsigned *sq_head_ = nullptr;
+	unsigned *sq_tail_ = nullptr;
+	unsigned *sq_array_ = nullptr;
+	unsigned sq_mask_ = 0;
+	unsigned sq_entries_ = 0;
+	unsigned *cq_head_ = nullptr;
+	unsigned *cq_tail_ = nullptr;
+	io_uring_cqe *cqes_ = nullptr;
+	unsigned cq_mask_ = 0;
+	// only touched by the ring thread
+	unsigned sq_local_tail_ = 0;
+	unsigned to_submit_ = 0;
+
+	uint64_t next_id_ = FIRST_OPERATION_ID;
+	std::unordered_map<uint64_t, Handler> handlers_;
+
+	io_uring_buf_ring *buf_ring_ = nullptr;
+	size_t buf_ring_size_ = 0;
+	uint16_t buf_ring_tail_ = 0;
+	std::unique_ptr<uint8_t[]> recv_buffers_;
+	bool supports_zero_copy_send_ = false;
+
+	std::mutex posted_mutex_;
+	std::vector<std::function<void()>> posted_;
+	std::atomic<bool> wakeup_pending_ = false;
+	uint64_t wakeup_value_ = 0;
+	std::atomic<bool> running_ = false;
+	std::thread thread_;
+};
+
+} // namespace peerpaste
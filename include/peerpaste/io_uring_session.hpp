@@ -0,0 +1,171 @@
+#ifndef IO_URING_SESSION_HPP
+#define IO_URING_SESSION_HPP
+
+#include <boost/asio.hpp>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "peerpaste/endpoint_cache.hpp"
+#include "peerpaste/frame_decoder.hpp"
+#include "peerpaste/io_uring_context.hpp"
+#include "peerpaste/send_queue_limiter.hpp"
+#include "peerpaste/session.hpp"
+
+/*
+ * IoUringSession
+ * Session doing its socket io through an IoUringContext. All socket state
+ * lives on the ring thread, the public functions post there. Incoming data
+ * arrives through a multishot receive into the provided buffers of the ring.
+ * Outgoing frames are gathered into a single sendmsg, big batches are sent
+ * zero copy straight from the frame buffers.
+ */
+class IoUringSession : public Session, public std::enable_shared_from_this<IoUringSession>
+{
+public:
+	IoUringSession(peerpaste::IoUringContext &ring,
+								 boost::asio::io_context &io_context,
+								 std::shared_ptr<ReceiveQueue> msg_queue);
+	// takes over an accepted connection
+	IoUringSession(peerpaste::IoUringContext &ring,
+								 boost::asio::io_context &io_context,
+								 std::shared_ptr<ReceiveQueue> msg_queue,
+								 boost::asio::ip::tcp::socket socket);
+	~IoUringSession();
+
+	void write(DataBuffer message,
+						 SendPolicy policy = SendPolicy::CLOSE,
+						 MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_direct(DataBuffer message,
+										const std::function<void(bool)> &handler,
+										SendPolicy policy = SendPolicy::BLOCK,
+										MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_to(DataBuffer message,
+								const std::string &address,
+								const std::string &port,
+								SendPolicy policy = SendPolicy::CLOSE,
+								MessagePriority priority = MessagePriority::DEFAULT) override;
+	void read() override;
+	std::string get_client_ip() const override;
+	SendQueueMetrics get_send_queue_metrics() const override;
+	bool is_open() const override;
+	void set_send_limits(const SendLimits &limits);
+	void set_timeouts(const SessionTimeouts &timeouts);
+
+private:
+	using FrameHeader = std::array<uint8_t, peerpaste::FrameDecoder::HEADER_SIZE>;
+
+	struct OutgoingFrame
+	{
+		FrameHeader header;
+		DataBuffer payload;
+		std::function<void(bool)> on_write;
+		MessagePriority priority;
+	};
+
+	// what the kernel may still read after a zero copy send completed
+	struct ZeroCopyBuffers
+	{
+		std::vector<FrameHeader> headers;
+		std::vector<DataBuffer> payloads;
+	};
+
+	// a message sent with SendPolicy::BLOCK waiting for space in the send queue
+	struct BlockedFrame
+	{
+		DataBuffer payload;
+		std::function<void(bool)> on_write;
+		std::chrono::steady_clock::time_point deadline;
+	};
+
+	void stop();
+	void send_message(DataBuffer message,
+										SendPolicy policy,
+										MessagePriority priority,
+										std::function<void(bool)> on_write = nullptr);
+	void block_message(DataBuffer message, MessagePriority priority, std::function<void(bool)> on_write);
+	void resume_blocked_frames();
+	void expire_blocked_frames();
+	void fail_blocked_frames();
+	void do_connect(peerpaste::Endpoints endpoints, size_t index);
+	void handle_connect(const io_uring_cqe &cqe, peerpaste::Endpoints endpoints, size_t index);
+	void start_timeout_timer();
+	void arm_timeout_timer();
+	void handle_timeout_timer(const boost::system::error_code &ec);
+	void touch();
+	void queue_message(DataBuffer message, MessagePriority priority, std::function<void(bool)> on_write = nullptr);
+	bool has_queued_frames() const;
+	void take_queued_frames();
+	void start_packet_send();
+	void submit_gathered_send();
+	void handle_gathered_send(const io_uring_cqe &cqe);
+	void packet_send_done(bool failed);
+	void complete_frames(std::deque<OutgoingFrame> &frames,
+											 size_t count,
+											 bool failed,
+											 std::vector<DataBuffer> *kept_payloads = nullptr);
+	void fail_queued_frames();
+	void do_read();
+	void handle_recv(const io_uring_cqe &cqe);
+	void consume(const uint8_t *data, size_t size);
+	void pause_reading();
+	void encode_header(FrameHeader &buf, unsigned size) const;
+
+	peerpaste::IoUringContext &ring_;
+	boost::asio::io_context &io_context_;
+	boost::asio::io_context::strand timer_strand_;
+	boost::asio::ip::tcp::resolver resolver_;
+	// written on the ring thread, read by stop() from any thread
+	std::atomic<int> fd_ = -1;
+	// written on the ring thread once connected, read from any thread
+	mutable std::mutex remote_endpoint_mutex_;
+	std::optional<boost::asio::ip::tcp::endpoint> remote_endpoint_;
+	sockaddr_storage connect_address_;
+	std::atomic<bool> is_open_ = true;
+	std::atomic<bool> is_reading_ = false;
+
+	// only accessed on the ring thread
+	bool is_connected_;
+	bool read_on_connect_ = false;
+	bool is_recv_armed_ = false;
+	uint64_t recv_id_ = 0;
+	bool is_connecting_ = false;
+	uint64_t connect_id_ = 0;
+	peerpaste::FrameDecoder frame_decoder_;
+	// frames waiting to be sent by priority, and the ones taken for the next sends
+	std::array<std::deque<OutgoingFrame>, MESSAGE_PRIORITY_COUNT> queued_frames_;
+	std::deque<OutgoingFrame> send_packet_queue;
+	std::array<std::deque<BlockedFrame>, MESSAGE_PRIORITY_COUNT> blocked_frames_;
+	size_t frames_in_flight_ = 0;
+	// progress of the send in flight
+	std::vector<iovec> send_iovecs_;
+	size_t send_iovec_index_ = 0;
+	msghdr send_msg_;
+	// set while a zero copy send is in flight. The kernel may read the frames
+	// until it notified every submission, their handlers share the buffers.
+	std::shared_ptr<ZeroCopyBuffers> zero_copy_buffers_;
+
+	boost::asio::steady_timer timeout_timer_;
+	std::atomic<bool> is_timer_running_ = false;
+	std::atomic<std::chrono::steady_clock::time_point> last_activity_;
+	std::atomic<bool> is_frame_pending_ = false;
+	std::atomic<bool> is_read_paused_ = false;
+	SessionTimeouts timeouts_;
+
+	peerpaste::SendQueueLimiter send_queue_limiter_;
+
+	static constexpr std::chrono::milliseconds TIMEOUT_CHECK_INTERVAL{1000};
+	static constexpr size_t max_gathered_frames_ = 64;
+};
+
+#endif /* ifndef IO_URING_SESSION_HPP */
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "peerpaste/session.hpp"
+
+namespace peerpaste
+{
+
+/*
+ * LoopbackNetwork
+ * The nodes of one process reachable by loopback sessions, addressed by
+ * the address and port they would listen on
+ */
+class LoopbackNetwork
+{
+public:
+	/*
+	 * Messages sent to address and port get pushed into queue
+	 */
+	void attach(const std::string &address, const std::string &port, std::shared_ptr<ReceiveQueue> queue);
+	void detach(const std::string &address, const std::string &port);
+	std::shared_ptr<ReceiveQueue> find(const std::string &address, const std::string &port) const;
+	size_t size() const;
+
+private:
+	mutable std::mutex mutex_;
+	std::map<std::pair<std::string, std::string>, std::shared_ptr<ReceiveQueue>> nodes_;
+};
+
+/*
+ * LoopbackSession
+ * One end of an in-memory connection between two nodes of a
+ * LoopbackNetwork. Messages are copied into a receive buffer of the other
+ * node, no sockets are involved. The connecting end owns the accepting
+ * one, so the connection is gone once the connecting node drops it.
+ */
+class LoopbackSession : public Session, public std::enable_shared_from_this<LoopbackSession>
+{
+public:
+	/*
+	 * A session of the node at local_address, connected by write_to()
+	 */
+	LoopbackSession(std::shared_ptr<LoopbackNetwork> network,
+									std::shared_ptr<ReceiveQueue> msg_queue,
+									std::string local_address);
+
+	// without a send queue there is nothing to reorder, the priority is ignored
+	void write(DataBuffer message,
+						 SendPolicy policy = SendPolicy::CLOSE,
+						 MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_to(DataBuffer message,
+								const std::string &address,
+								const std::string &port,
+								SendPolicy policy = SendPolicy::CLOSE,
+								MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_direct(DataBuffer message,
+										const std::function<void(bool)> &handler,
+										SendPolicy policy = SendPolicy::BLOCK,
+										MessagePriority priority = MessagePriority::DEFAULT) override;
+	// messages are pushed by the sending end
+	void read() override;
+	std::string get_client_ip() const override;
+	SendQueueMetrics get_send_queue_metrics() const override;
+	bool is_open() const override;
+	void close();
+	// only block_timeout applies, the receive queue of the peer bounds the rest
+	void set_send_limits(const SendLimits &limits);
+
+private:
+	std::shared_ptr<LoopbackSession> get_peer() const;
+	bool deliver(DataBuffer message, SendPolicy policy);
+
+	std::shared_ptr<LoopbackNetwork> network_;
+	const std::string local_address_;
+	std::atomic<bool> is_open_ = true;
+	std::atomic<size_t> dropped_frames_ = 0;
+
+	mutable std::mutex mutex_;
+	SendLimits send_limits_;
+	std::string remote_address_;
+	std::shared_ptr<LoopbackSession> accepted_peer_;
+	std::weak_ptr<LoopbackSession> connecting_peer_;
+};
+
+} // namespace peerpaste
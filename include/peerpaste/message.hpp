@@ -78,21 +78,20 @@ public:
 	}
 
 	/*
-	 * generates a Message object. it should not be modified anymore,
-	 * otherwise transaction_id would be invalid and must be regenerated
+	 * generates a request Message object with a fresh transaction_id
 	 */
-	static Message create_request(std::string request_type)
+	static Message create_request(MessageType request_type)
 	{
 		Message msg;
-		msg.set_header(Header(true, 0, 0, request_type, "", "", ""));
+		msg.set_header(Header(true, 0, 0, request_type, TransactionId{}, "", ""));
 		msg.generate_transaction_id();
 		return msg;
 	}
 
-	static Message create_request(std::string request_type, std::vector<Peer> peers)
+	static Message create_request(MessageType request_type, std::vector<Peer> peers)
 	{
 		Message msg;
-		msg.set_header(Header(true, 0, 0, request_type, "", "", ""));
+		msg.set_header(Header(true, 0, 0, request_type, TransactionId{}, "", ""));
 		msg.set_peers(std::move(peers));
 		msg.generate_transaction_id();
 		return msg;
@@ -101,8 +100,7 @@ public:
 	void print() const
 	{
 		/* return; */
-		if(get_request_type() == "get_predecessor" || get_request_type() == "notify" ||
-			 get_request_type() == "check_predecessor")
+		if(get_message_type() == MessageType::NOTIFICATION || get_message_type() == MessageType::CHECK_PREDECESSOR)
 		{
 			return;
 		}
@@ -127,12 +125,17 @@ public:
 		header_ = header;
 	}
 
-	Header get_header() const
+	void set_header(Header &&header)
+	{
+		header_ = std::move(header);
+	}
+
+	const Header &get_header() const
 	{
 		return header_;
 	}
 
-	std::vector<Peer> get_peers() const
+	const std::vector<Peer> &get_peers() const
 	{
 		return peers_;
 	}
@@ -142,16 +145,26 @@ public:
 		peers_ = peers;
 	}
 
+	void set_peers(std::vector<Peer> &&peers)
+	{
+		peers_ = std::move(peers);
+	}
+
 	void add_peer(const Peer &peer)
 	{
 		peers_.push_back(peer);
 	}
 
+	void add_peer(Peer &&peer)
+	{
+		peers_.push_back(std::move(peer));
+	}
+
 	std::string stringify() const
 	{
 		std::stringstream str;
 		str << header_.stringify();
-		for(const auto peer : peers_)
+		for(const auto &peer : peers_)
 		{
 			str << peer.stringify();
 		}
@@ -168,9 +181,9 @@ public:
 			std::cout << "Cant generate_response, is allready one"
 								<< " Type: " << header_.get_request_type() << '\n';
 		}
-		Message response;
-		response.set_header(header_.generate_response_header());
-		return std::make_shared<Message>(response);
+		auto response = std::make_shared<Message>();
+		response->set_header(header_.generate_response_header());
+		return response;
 	}
 
 	bool is_request() const
@@ -178,44 +191,36 @@ public:
 		return header_.is_request();
 	}
 
-	std::string generate_transaction_id()
+	TransactionId generate_transaction_id()
 	{
-		static std::atomic<unsigned int> Counter = 0;
-
-
-		if(Counter == std::numeric_limits<unsigned int>::max())
-		{
-			Counter = 0;
-		}
-
-		const auto now = std::chrono::system_clock::now();
-		const auto now_time_t = std::chrono::system_clock::to_time_t(now);
-		const auto salt = std::to_string(now_time_t) + std::to_string(++Counter);
-
-		const auto transaction_id = util::generate_sha256(stringify() + salt);
-
+		const auto transaction_id = TransactionId::generate();
 		header_.set_transaction_id(transaction_id);
 		return transaction_id;
 	}
 
-	std::string get_transaction_id() const
+	TransactionId get_transaction_id() const
 	{
-		return get_header().get_transaction_id();
+		return header_.get_transaction_id();
 	}
 
-	void set_correlational_id(const std::string &id)
+	void set_correlational_id(TransactionId id)
 	{
-		get_header().set_correlational_id(id);
+		header_.set_correlational_id(id);
 	}
 
-	std::string get_correlational_id() const
+	TransactionId get_correlational_id() const
 	{
-		return get_header().get_correlational_id();
+		return header_.get_correlational_id();
 	}
 
-	std::string get_request_type() const
+	MessageType get_message_type() const
 	{
-		return get_header().get_request_type();
+		return header_.get_message_type();
+	}
+
+	std::string_view get_request_type() const
+	{
+		return header_.get_request_type();
 	}
 
 	void set_data(const std::string &data)
@@ -223,7 +228,12 @@ public:
 		data_ = data;
 	}
 
-	std::string get_data()
+	void set_data(std::string &&data)
+	{
+		data_ = std::move(data);
+	}
+
+	const std::string &get_data() const
 	{
 		return data_;
 	}
@@ -243,7 +253,12 @@ public:
 		files_ = files;
 	}
 
-	auto get_files() const
+	void set_filelist(std::vector<peerpaste::FileInfo> &&files)
+	{
+		files_ = std::move(files);
+	}
+
+	const std::vector<peerpaste::FileInfo> &get_files() const
 	{
 		return files_;
 	}
@@ -253,11 +268,21 @@ public:
 		file_chunk_ = file_chunk;
 	}
 
+	void set_file_chunk(peerpaste::FileChunk&& file_chunk)
+	{
+		file_chunk_ = std::move(file_chunk);
+	}
+
 	auto& get_file_chunk()
 	{
 		return file_chunk_;
 	}
 
+	const auto& get_file_chunk() const
+	{
+		return file_chunk_;
+	}
+
 private:
 	Header header_;
 	std::vector<Peer> peers_;
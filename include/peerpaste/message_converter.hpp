@@ -1,12 +1,19 @@
 #ifndef MESSAGE_BUILDER_HPP
 #define MESSAGE_BUILDER_HPP
 
+#include <array>
 #include <boost/asio.hpp>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+
+#include "compression.hpp"
 #include "message.hpp"
 #include "proto/messages.pb.h"
 /* #include <google/protobuf/util/delimited_message_util.h> */
@@ -22,117 +29,183 @@ public:
 	{
 	}
 
-	virtual std::unique_ptr<Message> MessageFromSerialized(const DataBuffer &buf) const = 0;
-	virtual const DataBuffer SerializedFromMessage(const MessagePtr message) const = 0;
+	virtual std::unique_ptr<Message> MessageFromSerialized(const uint8_t *data, size_t size) const = 0;
+	virtual const DataBuffer SerializedFromMessage(const MessagePtr &message) const = 0;
+
+	std::unique_ptr<Message> MessageFromSerialized(const DataBuffer &buf) const
+	{
+		return MessageFromSerialized(buf.data(), buf.size());
+	}
 };
 
 class ProtobufMessageConverter : public MessageConverter
 {
 public:
-	// TODO: error handling! how to proceed on error?
-	std::unique_ptr<Message> MessageFromSerialized(const DataBuffer &buf) const override
+	using MessageConverter::MessageFromSerialized;
+
+	// compressed payloads claiming to be bigger than this are dropped
+	static constexpr size_t MAX_DECOMPRESSED_SIZE = 64 * 1024 * 1024;
+	// Sent in the version of every message, messages of other versions are
+	// dropped. Older nodes sent an empty version, hex string ids and the type
+	// as a string, they cannot share a ring with nodes of this version.
+	static constexpr std::string_view WIRE_VERSION = "2";
+
+	explicit ProtobufMessageConverter(peerpaste::CompressionOptions compression_options = {})
+		: compression_options_(compression_options)
+	{
+	}
+
+	/*
+	 * Returns nullptr for messages that do not parse or were sent in
+	 * another wire version
+	 */
+	std::unique_ptr<Message> MessageFromSerialized(const uint8_t *data, size_t size) const override
 	{
-		// create a Protobuf Message
-		auto protobuf_message = std::make_unique<Request>();
+		// file data is copied out of the buffer directly instead of through protobuf
+		auto trailing_file_chunk = TakeTrailingFileChunk(data, size);
+
+		// create a Protobuf Message, everything it allocates is freed with the arena
+		MessageArena arena;
+		auto *protobuf_message = arena.create<Request>();
 		// fill Message with data by parsing from DataBuffer
-		protobuf_message->ParseFromArray(&buf[0], buf.size()); // TODO: could fail
-		// Get protobuf_header and create Header from it
-		auto protobuf_header = protobuf_message->commonheader();
-		auto protobuf_data = protobuf_message->data();
+		if(!protobuf_message->ParseFromArray(data, size))
+		{
+			spdlog::error("ProtobufMessageConverter could not parse a message, dropping it");
+			return nullptr;
+		}
+		if(protobuf_message->commonheader().version() != WIRE_VERSION)
+		{
+			spdlog::warn("ProtobufMessageConverter dropped a message of wire version \"{}\"",
+									 protobuf_message->commonheader().version());
+			return nullptr;
+		}
+		// Get protobuf_header and create Header from it, strings are moved out
+		// of the protobuf message instead of copied
+		auto &protobuf_header = *protobuf_message->mutable_commonheader();
+		const auto message_type = message_type_from_wire(protobuf_header.message_type());
 		Header header(protobuf_header.t_flag(),
 									protobuf_header.ttl(),
 									protobuf_header.message_length(),
-									protobuf_header.request_type(),
-									protobuf_header.transaction_id(),
-									protobuf_header.correlational_id(),
-									protobuf_header.version(),
-									protobuf_header.response_code());
+									message_type,
+									TransactionId{protobuf_header.transaction_id_high(), protobuf_header.transaction_id_low()},
+									TransactionId{protobuf_header.correlational_id_high(), protobuf_header.correlational_id_low()},
+									std::move(*protobuf_header.mutable_version()),
+									std::move(*protobuf_header.mutable_response_code()));
+
+		header.set_accept_encoding(protobuf_header.accept_encoding());
 
 		// Create MessagePtr and set the header
 		auto message = std::make_unique<Message>();
-		message->set_header(header);
+		message->set_header(std::move(header));
 
 		// Iterate over every protobuf_peer, create Peer object from it
 		// and add it to our message
 		const int protobuf_peer_size = protobuf_message->peerinfo_size();
 		for(int i = 0; i < protobuf_peer_size; i++)
 		{
-			auto protobuf_peer = protobuf_message->peerinfo(i);
-			Peer peer(protobuf_peer.peer_id(), protobuf_peer.peer_ip(), protobuf_peer.peer_port());
-			message->add_peer(peer);
+			auto &protobuf_peer = *protobuf_message->mutable_peerinfo(i);
+			message->add_peer(Peer(NodeId::from_bytes(protobuf_peer.node_id()),
+														 std::move(*protobuf_peer.mutable_peer_ip()),
+														 std::move(*protobuf_peer.mutable_peer_port())));
 		}
 
-		const int protobuf_files_size = protobuf_message->files_size();
-		for(int i = 0; i < protobuf_files_size; i++)
-		{
-			auto protobuf_file = protobuf_message->files(i);
-			std::string sha256sum{};
-			size_t size = 0;
-			size_t offset = 0;
-
-			if(protobuf_file.has_file_size())
-			{
-				size = protobuf_file.file_size();
-			}
+		AddFiles(*message, *protobuf_message->mutable_files());
 
-			if(protobuf_file.has_sha256sum())
+		if(protobuf_message->has_compressed_files())
+		{
+			auto *file_list = arena.create<FileList>();
+			if(DecodeFileList(protobuf_message->compressed_files(), *file_list))
 			{
-				sha256sum = protobuf_file.sha256sum();
+				AddFiles(*message, *file_list->mutable_files());
 			}
-
-			if(protobuf_file.has_offset())
+			else
 			{
-				offset = protobuf_file.offset();
+				spdlog::error("ProtobufMessageConverter could not decode the compressed file list");
 			}
-
-			message->add_file(peerpaste::FileInfo{protobuf_file.file_name(), sha256sum, size, offset});
 		}
 
-		if(protobuf_message->has_file_chunk())
+		if(trailing_file_chunk.has_value())
 		{
-			auto protobuf_file_chunk = protobuf_message->file_chunk();
+			message->set_file_chunk(std::move(trailing_file_chunk.value()));
+		}
+		else if(protobuf_message->has_file_chunk())
+		{
+			const auto &protobuf_file_chunk = protobuf_message->file_chunk();
 			peerpaste::FileChunk file_chunk;
 			file_chunk.offset = protobuf_file_chunk.offset();
 			file_chunk.size = protobuf_file_chunk.chunk_size();
-			file_chunk.data = std::vector<char>(protobuf_file_chunk.data().data(),
-																					protobuf_file_chunk.data().data() + file_chunk.size);
 
-			message->set_file_chunk(std::move(file_chunk));
+			if(DecodeFileChunkData(protobuf_file_chunk, file_chunk))
+			{
+				message->set_file_chunk(std::move(file_chunk));
+			}
+			else
+			{
+				spdlog::error("ProtobufMessageConverter could not decode the file chunk");
+			}
 		}
 
 		if(protobuf_message->has_data())
 		{
-			message->set_data(protobuf_message->data());
+			message->set_data(std::move(*protobuf_message->mutable_data()));
 		}
 
 		return message;
 	}
 
-	const DataBuffer SerializedFromMessage(const MessagePtr message) const override
+	const DataBuffer SerializedFromMessage(const MessagePtr &message) const override
+	{
+		return SerializedFromMessage(message, peerpaste::Encoding::IDENTITY);
+	}
+
+	/*
+	 * Compresses file chunks and lists with encodings the receiver accepts
+	 */
+	const DataBuffer SerializedFromMessage(const MessagePtr &message, uint32_t accepted_encodings) const
 	{
-		auto protobuf_message = std::make_unique<Request>();
+		MessageArena arena;
+		auto *protobuf_message = arena.create<Request>();
 		auto protobuf_header = protobuf_message->mutable_commonheader();
-		auto peerpaste_header = message->get_header();
-		auto peerpaste_peers = message->get_peers();
+		const auto &peerpaste_header = message->get_header();
+		const auto &peerpaste_peers = message->get_peers();
 
 		protobuf_header->set_t_flag(peerpaste_header.get_t_flag());
 		protobuf_header->set_ttl(peerpaste_header.get_ttl());
 		protobuf_header->set_message_length(peerpaste_header.get_message_length());
-		protobuf_header->set_request_type(peerpaste_header.get_request_type());
-		protobuf_header->set_transaction_id(peerpaste_header.get_transaction_id());
-		protobuf_header->set_correlational_id(peerpaste_header.get_correlational_id());
-		protobuf_header->set_version(peerpaste_header.get_version());
+		protobuf_header->set_message_type(static_cast<uint32_t>(peerpaste_header.get_message_type()));
+		const auto transaction_id = peerpaste_header.get_transaction_id();
+		if(transaction_id.is_valid())
+		{
+			protobuf_header->set_transaction_id_high(transaction_id.high);
+			protobuf_header->set_transaction_id_low(transaction_id.low);
+		}
+		const auto correlational_id = peerpaste_header.get_correlational_id();
+		if(correlational_id.is_valid())
+		{
+			protobuf_header->set_correlational_id_high(correlational_id.high);
+			protobuf_header->set_correlational_id_low(correlational_id.low);
+		}
+		protobuf_header->set_version(WIRE_VERSION.data(), WIRE_VERSION.size());
 		protobuf_header->set_response_code(peerpaste_header.get_response_code());
+		if(peerpaste_header.get_accept_encoding() != peerpaste::Encoding::IDENTITY)
+		{
+			protobuf_header->set_accept_encoding(peerpaste_header.get_accept_encoding());
+		}
 
-		for(const auto peer : peerpaste_peers)
+		const bool may_compress = (accepted_encodings & peerpaste::Encoding::DEFLATE) != 0;
+
+		for(const auto &peer : peerpaste_peers)
 		{
 			auto protobuf_peer = protobuf_message->add_peerinfo();
-			protobuf_peer->set_peer_id(peer.get_id());
+			if(peer.get_id().is_valid())
+			{
+				protobuf_peer->set_node_id(peer.get_id().to_bytes());
+			}
 			protobuf_peer->set_peer_ip(peer.get_ip());
 			protobuf_peer->set_peer_port(peer.get_port());
 		}
 
-		for(const auto file_info : message->get_files())
+		for(const auto &file_info : message->get_files())
 		{
 			auto protobuf_file_info = protobuf_message->add_files();
 			protobuf_file_info->set_file_name(file_info.file_name);
@@ -141,15 +214,48 @@ public:
 			protobuf_file_info->set_offset(file_info.offset);
 		}
 
+		if(may_compress && compression_options_.list_level > 0 && protobuf_message->files_size() > 0)
+		{
+			// on the same arena, so swapping the files moves pointers instead of copying
+			auto *file_list = arena.create<FileList>();
+			file_list->mutable_files()->Swap(protobuf_message->mutable_files());
+			const auto serialized = file_list->SerializeAsString();
+			std::string compressed;
+			if(serialized.size() >= compression_options_.threshold &&
+				 peerpaste::compress(serialized.data(), serialized.size(), compression_options_.list_level, compressed))
+			{
+				auto compressed_files = protobuf_message->mutable_compressed_files();
+				compressed_files->set_encoding(peerpaste::Encoding::DEFLATE);
+				compressed_files->set_size(serialized.size());
+				compressed_files->set_data(std::move(compressed));
+			}
+			else
+			{
+				file_list->mutable_files()->Swap(protobuf_message->mutable_files());
+			}
+		}
+
 		if(message->get_file_chunk().has_value())
 		{
+			const auto &file_chunk = message->get_file_chunk().value();
 			auto protobuf_file_chunk = protobuf_message->mutable_file_chunk();
-			protobuf_file_chunk->set_offset(message->get_file_chunk().value().offset);
-			protobuf_file_chunk->set_chunk_size(message->get_file_chunk().value().size);
-			protobuf_file_chunk->set_data(message->get_file_chunk().value().data.data(), message->get_file_chunk().value().size);
+			protobuf_file_chunk->set_offset(file_chunk.offset);
+			protobuf_file_chunk->set_chunk_size(file_chunk.size);
+
+			std::string compressed;
+			if(CompressesFileChunk(accepted_encodings, file_chunk.size) &&
+				 peerpaste::compress(file_chunk.data.data(), file_chunk.size, compression_options_.chunk_level, compressed))
+			{
+				protobuf_file_chunk->set_encoding(peerpaste::Encoding::DEFLATE);
+				protobuf_file_chunk->set_data(std::move(compressed));
+			}
+			else
+			{
+				protobuf_file_chunk->set_data(file_chunk.data.data(), file_chunk.size);
+			}
 		}
 
-		if(message->get_data() != "")
+		if(!message->get_data().empty())
 		{
 			protobuf_message->set_data(message->get_data());
 		}
@@ -161,8 +267,213 @@ public:
 		return buf;
 	}
 
+	/*
+	 * Appends the encoding of a file chunk without its data, so that
+	 * buf followed by the size bytes of data is a complete message.
+	 * The message in buf must not contain a file chunk itself.
+	 */
+	static void AppendFileChunkHeader(DataBuffer &buf, uint64_t offset, uint64_t size)
+	{
+		using google::protobuf::io::CodedOutputStream;
+
+		const auto chunk_size = 1 + CodedOutputStream::VarintSize64(offset) + 1 + CodedOutputStream::VarintSize64(size) + 1 +
+														CodedOutputStream::VarintSize64(size) + size;
+
+		const auto begin = buf.size();
+		buf.resize(begin + 1 + CodedOutputStream::VarintSize64(chunk_size) + chunk_size - size);
+		auto *target = buf.data() + begin;
+		target = CodedOutputStream::WriteTagToArray(make_tag(Request::kFileChunkFieldNumber, LENGTH_DELIMITED), target);
+		target = CodedOutputStream::WriteVarint64ToArray(chunk_size, target);
+		target = CodedOutputStream::WriteTagToArray(make_tag(FileChunk::kOffsetFieldNumber, VARINT), target);
+		target = CodedOutputStream::WriteVarint64ToArray(offset, target);
+		target = CodedOutputStream::WriteTagToArray(make_tag(FileChunk::kChunkSizeFieldNumber, VARINT), target);
+		target = CodedOutputStream::WriteVarint64ToArray(size, target);
+		target = CodedOutputStream::WriteTagToArray(make_tag(FileChunk::kDataFieldNumber, LENGTH_DELIMITED), target);
+		CodedOutputStream::WriteVarint64ToArray(size, target);
+	}
+
+	/*
+	 * Whether a file chunk of the given size gets compressed for a receiver
+	 * accepting accepted_encodings
+	 */
+	bool CompressesFileChunk(uint32_t accepted_encodings, size_t size) const
+	{
+		return (accepted_encodings & peerpaste::Encoding::DEFLATE) != 0 && compression_options_.chunk_level > 0 &&
+					 size >= compression_options_.threshold;
+	}
+
 private:
-	/* data */
+	static constexpr uint32_t VARINT = 0;
+
+	/*
+	 * Holds the generated messages of one conversion. The first block lives on
+	 * the stack, so converting a typical message does not allocate for protobuf
+	 * at all and everything is released in one step when the conversion returns.
+	 */
+	class MessageArena
+	{
+	public:
+		static constexpr size_t INITIAL_BLOCK_SIZE = 4096;
+
+		MessageArena()
+			: arena_(make_options(initial_block_))
+		{
+		}
+
+		template <typename T>
+		T *create()
+		{
+			return google::protobuf::Arena::CreateMessage<T>(&arena_);
+		}
+
+	private:
+		static google::protobuf::ArenaOptions make_options(std::array<char, INITIAL_BLOCK_SIZE> &initial_block)
+		{
+			google::protobuf::ArenaOptions options;
+			options.initial_block = initial_block.data();
+			options.initial_block_size = initial_block.size();
+			return options;
+		}
+
+		alignas(8) std::array<char, INITIAL_BLOCK_SIZE> initial_block_;
+		google::protobuf::Arena arena_;
+	};
+
+	static bool DecodeFileList(const CompressedFiles &compressed_files, FileList &file_list)
+	{
+		if(compressed_files.encoding() != peerpaste::Encoding::DEFLATE || compressed_files.size() > MAX_DECOMPRESSED_SIZE)
+		{
+			return false;
+		}
+
+		std::string serialized(compressed_files.size(), '\0');
+		return peerpaste::decompress(
+						 compressed_files.data().data(), compressed_files.data().size(), serialized.data(), serialized.size()) &&
+					 file_list.ParseFromString(serialized);
+	}
+
+	static bool DecodeFileChunkData(const FileChunk &protobuf_file_chunk, peerpaste::FileChunk &file_chunk)
+	{
+		const auto &data = protobuf_file_chunk.data();
+		switch(protobuf_file_chunk.encoding())
+		{
+			case peerpaste::Encoding::IDENTITY:
+				if(data.size() != file_chunk.size)
+				{
+					return false;
+				}
+				file_chunk.data.assign(data.begin(), data.end());
+				return true;
+			case peerpaste::Encoding::DEFLATE:
+				if(file_chunk.size > MAX_DECOMPRESSED_SIZE)
+				{
+					return false;
+				}
+				file_chunk.data.resize(file_chunk.size);
+				return peerpaste::decompress(data.data(), data.size(), file_chunk.data.data(), file_chunk.data.size());
+			default:
+				return false;
+		}
+	}
+
+	static void AddFiles(Message &message, google::protobuf::RepeatedPtrField<FileInfo> &protobuf_files)
+	{
+		for(auto &protobuf_file : protobuf_files)
+		{
+			std::string sha256sum{};
+			size_t size = 0;
+			size_t offset = 0;
+
+			if(protobuf_file.has_file_size())
+			{
+				size = protobuf_file.file_size();
+			}
+
+			if(protobuf_file.has_sha256sum())
+			{
+				sha256sum = std::move(*protobuf_file.mutable_sha256sum());
+			}
+
+			if(protobuf_file.has_offset())
+			{
+				offset = protobuf_file.offset();
+			}
+
+			message.add_file(
+				peerpaste::FileInfo{std::move(*protobuf_file.mutable_file_name()), std::move(sha256sum), size, offset});
+		}
+	}
+	static constexpr uint32_t LENGTH_DELIMITED = 2;
+
+	static constexpr uint32_t make_tag(uint32_t field_number, uint32_t wire_type)
+	{
+		return (field_number << 3) | wire_type;
+	}
+
+	/*
+	 * Decodes a file chunk in the layout of AppendFileChunkHeader() if it is
+	 * the last field of the message and shortens size to the fields before it
+	 */
+	static std::optional<peerpaste::FileChunk> TakeTrailingFileChunk(const uint8_t *data, size_t &size)
+	{
+		google::protobuf::io::CodedInputStream input(data, static_cast<int>(size));
+		while(true)
+		{
+			const auto field_begin = static_cast<size_t>(input.CurrentPosition());
+			const auto tag = input.ReadTag();
+			if(tag == 0)
+			{
+				return {};
+			}
+
+			const auto wire_type = tag & 7;
+			uint64_t value = 0;
+			uint32_t length = 0;
+			if(wire_type == VARINT)
+			{
+				if(!input.ReadVarint64(&value))
+				{
+					return {};
+				}
+				continue;
+			}
+			if(wire_type != LENGTH_DELIMITED || !input.ReadVarint32(&length))
+			{
+				return {};
+			}
+			if(tag != make_tag(Request::kFileChunkFieldNumber, LENGTH_DELIMITED))
+			{
+				if(!input.Skip(static_cast<int>(length)))
+				{
+					return {};
+				}
+				continue;
+			}
+
+			peerpaste::FileChunk chunk;
+			uint64_t offset = 0;
+			uint64_t chunk_size = 0;
+			uint32_t data_size = 0;
+			if(static_cast<size_t>(input.CurrentPosition()) + length != size ||
+				 input.ReadTag() != make_tag(FileChunk::kOffsetFieldNumber, VARINT) || !input.ReadVarint64(&offset) ||
+				 input.ReadTag() != make_tag(FileChunk::kChunkSizeFieldNumber, VARINT) || !input.ReadVarint64(&chunk_size) ||
+				 input.ReadTag() != make_tag(FileChunk::kDataFieldNumber, LENGTH_DELIMITED) ||
+				 !input.ReadVarint32(&data_size) || static_cast<size_t>(input.CurrentPosition()) + data_size != size ||
+				 chunk_size != data_size)
+			{
+				return {};
+			}
+
+			const auto *chunk_data = reinterpret_cast<const char *>(data) + input.CurrentPosition();
+			chunk.offset = offset;
+			chunk.size = data_size;
+			chunk.data.assign(chunk_data, chunk_data + data_size);
+			size = field_begin;
+			return chunk;
+		}
+	}
+
+	peerpaste::CompressionOptions compression_options_;
 };
 
 #endif /* MESSAGE_BUILDER_HPP */
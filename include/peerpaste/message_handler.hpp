@@ -3,6 +3,7 @@
 #include <functional>
 #include <future>
 
+#include "peerpaste/concurrent_queue.hpp"
 #include "peerpaste/concurrent_request_handler.hpp"
 #include "peerpaste/concurrent_routing_table.hpp"
 #include "peerpaste/message.hpp"
@@ -27,28 +28,38 @@ public:
 	typedef std::unique_ptr<RequestObject> RequestObjectUPtr;
 	typedef std::shared_ptr<RequestObject> RequestObjectSPtr;
 	typedef std::shared_ptr<Peer> PeerPtr;
-
-	MessageHandler(const std::string& ip, short port)
-		: thread_pool_(0)
-		, routing_table_()
+	// serializes and writes the request on the calling thread
+	typedef std::function<void(const RequestObject &)> SendFunction;
+
+	/*
+	 * thread_count of 0 runs the messages on a worker per core, nodes
+	 * sharing a process pass small counts
+	 */
+	MessageHandler(const std::string &ip,
+								 short port,
+								 unsigned thread_count = 0,
+								 unsigned bulk_thread_count = BULK_THREAD_COUNT)
+		: routing_table_()
 		, static_storage_(nullptr)
 		, stabilize_flag_(false)
 		, check_predecessor_flag_(false)
 		, message_factory_{nullptr}
+		, thread_pool_(thread_count)
+		, bulk_thread_pool_(bulk_thread_count)
 	{
 		// TODO: setup self more accurate
 		auto self_ip = ip;
 		auto self_port = std::to_string(port);
-		auto self_id = util::generate_sha256(self_ip, self_port);
+		auto self_id = NodeId::from_hex(util::generate_sha256(self_ip, self_port));
 		routing_table_.set_self(Peer(self_id, self_ip, self_port));
 
-		static_storage_ = std::make_unique<StaticStorage>(self_id);
+		static_storage_ = std::make_unique<StaticStorage>(self_id.to_string());
 		message_factory_ = std::make_unique<peerpaste::message::MessageFactory>(&routing_table_, static_storage_.get());
 	}
 
-	void init(std::shared_ptr<peerpaste::ConcurrentQueue<RequestObject>> queue__)
+	void init(SendFunction send)
 	{
-		send_queue_ = queue__;
+		send_ = std::move(send);
 		Peer self;
 		if(routing_table_.try_get_self(self))
 		{
@@ -62,13 +73,13 @@ public:
 
 	virtual void HandleNotification(const RequestObject &request_object) override
 	{
-		send_queue_->push(request_object);
+		send_(request_object);
 	}
 
 	virtual void HandleNotification(const RequestObject &request_object, HandlerObject<HandlerFunction> handler) override
 	{
 		active_handlers_.insert(handler);
-		send_queue_->push(request_object);
+		send_(request_object);
 	}
 
 	virtual void HandleNotification() override
@@ -90,6 +101,12 @@ public:
 		{
 			t.join();
 		}
+		run_thread_.clear();
+
+		// a running message may hold the last reference to this handler, so
+		// the workers are joined while the owner still keeps it alive
+		thread_pool_.stop();
+		bulk_thread_pool_.stop();
 	}
 
 	void run_chord_internal()
@@ -132,9 +149,8 @@ public:
 		std::shared_ptr<MessageType> Message = message_factory_->create_request<MessageType>(std::forward<ArgsT>(Args)...);
 
 		Message->Attach(weak_from_this());
-		//thread_pool_.submit(Message);
-		(*Message.get())();
-		active_messages_.push_back(std::move(Message));
+		active_messages_.push_back(Message);
+		submit(std::move(Message));
 	}
 
 	void join(std::string address, std::string port)
@@ -171,9 +187,8 @@ public:
 		}
 
 		message_object->Attach(weak_from_this());
-		(*message_object.get())();
-		//thread_pool_.submit(message_object);
-		active_messages_.push_back(std::move(message_object));
+		active_messages_.push_back(message_object);
+		submit(std::move(message_object));
 	}
 
 	void handle_response(RequestObjectUPtr transport_object)
@@ -216,11 +231,25 @@ public:
 		return std::make_tuple(pre, self, succ);
 	}
 
-	ThreadPool thread_pool_;
-
 private:
+	/*
+	 * File transfers run on workers of their own, so while they wait for
+	 * slow peers the maintenance of the ring still finds a free worker
+	 */
+	void submit(std::shared_ptr<MessagingBase> message)
+	{
+		if(message_priority(message->GetType()) == MessagePriority::BULK)
+		{
+			bulk_thread_pool_.submit(std::move(message));
+			return;
+		}
+		thread_pool_.submit(std::move(message));
+	}
+
+	static constexpr unsigned BULK_THREAD_COUNT = 2;
+
 	peerpaste::ConcurrentRoutingTable<Peer> routing_table_;
-	std::shared_ptr<peerpaste::ConcurrentQueue<RequestObject>> send_queue_;
+	SendFunction send_;
 	std::unique_ptr<StaticStorage> static_storage_;
 
 	mutable std::mutex mutex_;
@@ -233,4 +262,7 @@ private:
 	std::unique_ptr<peerpaste::message::MessageFactory> message_factory_;
 	peerpaste::ConcurrentDeque<std::shared_ptr<MessagingBase>> active_messages_;
 	peerpaste::ConcurrentSet<HandlerObject<HandlerFunction>, std::less<>> active_handlers_;
+	// run the messages, destroyed first because they use the members above
+	ThreadPool thread_pool_;
+	ThreadPool bulk_thread_pool_;
 };
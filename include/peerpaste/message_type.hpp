@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * The values are sent on the wire, new types have to be appended
+ */
+enum class MessageType
+{
+	UNKNOWN = 0,
+	NOTIFICATION,
+	CHECK_PREDECESSOR,
+	QUERY,
+	FIND_SUCCESSOR,
+	JOIN,
+	GET_SUCCESSOR_LIST,
+	GET_SELF_AND_SUCC_LIST,
+	GET_PRED_AND_SUCC_LIST,
+	STABILIZE,
+	BROADCAST_FILELIST,
+	GET_FILE,
+};
+
+constexpr size_t MESSAGE_TYPE_COUNT = static_cast<size_t>(MessageType::GET_FILE) + 1;
+
+/*
+ * The names of the message types, indexed by MessageType
+ */
+constexpr std::array<std::string_view, MESSAGE_TYPE_COUNT> MESSAGE_TYPE_NAMES{
+	"unknown",
+	"notify",
+	"check_predecessor",
+	"query",
+	"find_successor",
+	"join",
+	"get_successor_list",
+	"get_self_and_successor_list",
+	"get_predecessor_and_succ_list",
+	"stabilize",
+	"broadcast_filelist",
+	"get_file",
+};
+
+constexpr std::string_view message_type_name(MessageType type)
+{
+	const auto index = static_cast<size_t>(type);
+	return index < MESSAGE_TYPE_NAMES.size() ? MESSAGE_TYPE_NAMES[index] : MESSAGE_TYPE_NAMES.front();
+}
+
+/*
+ * Maps the type of a message header as sent on the wire to its MessageType
+ */
+constexpr MessageType message_type_from_wire(uint32_t type)
+{
+	return type < MESSAGE_TYPE_COUNT ? static_cast<MessageType>(type) : MessageType::UNKNOWN;
+}
+
+/*
+ * Classes of messages that get queued, dispatched and sent separately, so
+ * bulk transfers never delay the maintenance of the ring
+ */
+enum class MessagePriority
+{
+	// stabilization rounds, late answers make nodes drop their neighbors
+	MAINTENANCE = 0,
+	DEFAULT,
+	// file chunks and file lists
+	BULK,
+};
+
+constexpr size_t MESSAGE_PRIORITY_COUNT = static_cast<size_t>(MessagePriority::BULK) + 1;
+
+constexpr MessagePriority message_priority(MessageType type)
+{
+	switch(type)
+	{
+		case MessageType::NOTIFICATION:
+		case MessageType::CHECK_PREDECESSOR:
+		case MessageType::GET_SUCCESSOR_LIST:
+		case MessageType::GET_SELF_AND_SUCC_LIST:
+		case MessageType::GET_PRED_AND_SUCC_LIST:
+		case MessageType::STABILIZE:
+			return MessagePriority::MAINTENANCE;
+		case MessageType::BROADCAST_FILELIST:
+		case MessageType::GET_FILE:
+			return MessagePriority::BULK;
+		default:
+			return MessagePriority::DEFAULT;
+	}
+}
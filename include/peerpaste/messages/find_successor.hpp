@@ -11,8 +11,8 @@ namespace peerpaste::message
 class FindSuccessor : public MessagingBase, public Awaitable<std::optional<Peer>>
 {
 public:
-	FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const std::string &id);
-	FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const Peer &target, const std::string &id);
+	FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const NodeId &id);
+	FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const Peer &target, const NodeId &id);
 	FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, RequestObject request);
 	explicit FindSuccessor(FindSuccessor &&other);
 
@@ -28,10 +28,10 @@ private:
 	void handle_response(RequestObject request_object) override;
 	void handle_failed() override;
 
-	std::unique_ptr<Peer> find_successor(const std::string &id) const;
-	std::unique_ptr<Peer> closest_preceding_node(const std::string &id) const;
+	std::unique_ptr<Peer> find_successor(const NodeId &id) const;
+	std::unique_ptr<Peer> closest_preceding_node(const NodeId &id) const;
 
-	std::string id_;
+	NodeId id_;
 	std::optional<Peer> target_;
 	ConcurrentRoutingTable<Peer> *routing_table_;
 };
@@ -1,8 +1,7 @@
 #pragma once
 
+#include <memory>
 #include <optional>
-#include <fstream>
-#include <array>
 
 #include "peerpaste/messaging_base.hpp"
 #include "peerpaste/storage.hpp"
@@ -28,16 +27,18 @@ private:
 	void handle_response(RequestObject request_object) override;
 	void handle_failed() override;
 
-	void write_buffer(size_t offset = 0);
+	void write_buffer(size_t offset, size_t size);
 
 
 	StaticStorage *storage_;
 	std::optional<Peer> target_;
 	std::optional<peerpaste::FileInfo> file_info_;
-	std::ifstream m_source_file;
+	// the session sends chunks straight from this descriptor
+	std::shared_ptr<const int> m_source_file;
+	size_t m_source_offset = 0;
+	size_t m_source_size = 0;
 	std::optional<OfstreamWrapper> m_output_file;
-	static constexpr size_t m_buffer_size = peerpaste::FileChunk::DEFAULT_BUF_SIZE;
-	std::array<char, m_buffer_size> m_buf;
+	static constexpr size_t m_chunk_size = 1024 * 1024;
 	size_t m_file_size = 0;
 };
 
@@ -63,7 +63,7 @@ public:
 	bool is_timed_out();
 
 protected:
-	virtual void create_handler_object(const std::string &correlation_id, HandlerFunction handler_function, bool is_persistent = false);
+	virtual void create_handler_object(TransactionId correlation_id, HandlerFunction handler_function, bool is_persistent = false);
 
 	virtual void create_request() = 0;
 	virtual void handle_request() = 0;
@@ -71,15 +71,27 @@ protected:
 
 	virtual void handle_failed() = 0;
 
+	/*
+	 * Dependencies are added by handler threads while the consumer thread
+	 * checks them for timeouts, so changes and walks go through these
+	 */
+	void add_dependency(std::shared_ptr<MessagingBase> dependency, bool is_essential);
+	void prepend_dependency(std::shared_ptr<MessagingBase> dependency, bool is_essential);
+	void clear_dependencies();
+	std::vector<std::pair<std::shared_ptr<MessagingBase>, bool>> get_dependencies() const;
+
 	// Only root object needs promise. leafobjects do not.
 	MessageType type_;
 	std::unique_ptr<HandlerObject<HandlerFunction>> handler_object_ = nullptr;
 	std::optional<RequestObject> request_;
 	std::vector<std::pair<std::shared_ptr<MessagingBase>, bool>> dependencies_;
-	std::chrono::time_point<std::chrono::system_clock> time_point_;
+	// pushed back by handler threads, read by the consumer thread
+	std::atomic<std::chrono::time_point<std::chrono::system_clock>> time_point_;
 	std::atomic<bool> is_done_ = false;
 	std::atomic<MESSAGE_STATE> state_ = MESSAGE_STATE::VALID;
 	std::atomic<bool> is_request_handler_ = false;
 	mutable std::mutex mutex_;
+	// only guards dependencies_ and is never held while calling into a dependency
+	mutable std::mutex dependencies_mutex_;
 	static constexpr std::chrono::milliseconds DURATION{10000};
 };
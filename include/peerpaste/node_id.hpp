@@ -0,0 +1,182 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <compare>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+
+/*
+ * The 256 bit position of a peer on the ring, the SHA-256 digest of its
+ * address. A zero id stands for no id, like the empty string did before ids
+ * were binary.
+ */
+struct NodeId
+{
+	static constexpr size_t WORD_COUNT = 4;
+	static constexpr size_t BYTE_COUNT = WORD_COUNT * sizeof(uint64_t);
+
+	// most significant word first, so the defaulted comparison orders by value
+	std::array<uint64_t, WORD_COUNT> words{};
+
+	/*
+	 * Parses 64 hex digits of either case, anything else gives no id
+	 */
+	static constexpr NodeId from_hex(std::string_view hex)
+	{
+		NodeId id;
+		if(hex.size() != BYTE_COUNT * 2)
+		{
+			return id;
+		}
+
+		for(size_t i = 0; i < hex.size(); ++i)
+		{
+			const auto digit = hex_value(hex[i]);
+			if(digit < 0)
+			{
+				return NodeId{};
+			}
+			auto &word = id.words[i / 16];
+			word = (word << 4) | static_cast<uint64_t>(digit);
+		}
+		return id;
+	}
+
+	/*
+	 * Reads the 32 big endian bytes sent on the wire, anything else gives no id
+	 */
+	static NodeId from_bytes(std::string_view bytes)
+	{
+		NodeId id;
+		if(bytes.size() != BYTE_COUNT)
+		{
+			return id;
+		}
+
+		for(size_t i = 0; i < bytes.size(); ++i)
+		{
+			auto &word = id.words[i / sizeof(uint64_t)];
+			word = (word << 8) | static_cast<uint8_t>(bytes[i]);
+		}
+		return id;
+	}
+
+	/*
+	 * The 32 big endian bytes sent on the wire
+	 */
+	std::string to_bytes() const
+	{
+		std::string bytes(BYTE_COUNT, '\0');
+		for(size_t i = 0; i < bytes.size(); ++i)
+		{
+			const auto shift = 8 * (sizeof(uint64_t) - 1 - i % sizeof(uint64_t));
+			bytes[i] = static_cast<char>(words[i / sizeof(uint64_t)] >> shift);
+		}
+		return bytes;
+	}
+
+	/*
+	 * 64 upper case hex digits as util::generate_sha256() returns them, or an
+	 * empty string for no id
+	 */
+	std::string to_string() const
+	{
+		if(!is_valid())
+		{
+			return "";
+		}
+
+		constexpr std::string_view DIGITS = "0123456789ABCDEF";
+		std::string hex(BYTE_COUNT * 2, '0');
+		for(size_t i = 0; i < hex.size(); ++i)
+		{
+			const auto shift = 4 * (15 - i % 16);
+			hex[i] = DIGITS[(words[i / 16] >> shift) & 0xF];
+		}
+		return hex;
+	}
+
+	constexpr bool is_valid() const
+	{
+		return (words[0] | words[1] | words[2] | words[3]) != 0;
+	}
+
+	constexpr auto operator<=>(const NodeId &) const = default;
+
+private:
+	static constexpr int hex_value(char c)
+	{
+		if(c >= '0' && c <= '9')
+		{
+			return c - '0';
+		}
+		if(c >= 'a' && c <= 'f')
+		{
+			return c - 'a' + 10;
+		}
+		if(c >= 'A' && c <= 'F')
+		{
+			return c - 'A' + 10;
+		}
+		return -1;
+	}
+};
+
+inline std::ostream &operator<<(std::ostream &os, const NodeId &id)
+{
+	return os << id.to_string();
+}
+
+namespace util
+{
+
+/*
+ * Compares without branching on the words, so scans over many ids vectorize
+ */
+constexpr bool less(const NodeId &first, const NodeId &second)
+{
+	bool result = false;
+	bool equal = true;
+	for(size_t i = 0; i < NodeId::WORD_COUNT; ++i)
+	{
+		result |= equal & (first.words[i] < second.words[i]);
+		equal &= first.words[i] == second.words[i];
+	}
+	return result;
+}
+
+/*
+ * Whether id lies strictly between from and to going clockwise on the ring
+ */
+constexpr bool between(const NodeId &from, const NodeId &id, const NodeId &to)
+{
+	const bool after_from = less(from, id);
+	const bool before_to = less(id, to);
+	const bool wraps = !less(from, to);
+	return (after_from & before_to) | (wraps & (after_from | before_to));
+}
+
+/*
+ * Checks a whole batch of at most 64 ids at once, bit i is set if ids[i] lies
+ * between from and to
+ */
+inline uint64_t between_mask(const NodeId &from, std::span<const NodeId> ids, const NodeId &to)
+{
+	assert(ids.size() <= 64);
+	const bool wraps = !less(from, to);
+	uint64_t mask = 0;
+	for(size_t i = 0; i < ids.size(); ++i)
+	{
+		const bool after_from = less(from, ids[i]);
+		const bool before_to = less(ids[i], to);
+		const bool is_between = (after_from & before_to) | (wraps & (after_from | before_to));
+		mask |= static_cast<uint64_t>(is_between) << i;
+	}
+	return mask;
+}
+
+} // namespace util
@@ -5,7 +5,9 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <utility>
 
+#include "node_id.hpp"
 #include "proto/messages.pb.h"
 
 /**
@@ -15,24 +17,23 @@ class Peer
 {
 public:
 	Peer()
-		: id_("")
-		, ip_("")
+		: ip_("")
 		, port_("")
 	{
 	}
-	Peer(std::string id, std::string ip, std::string port)
+	Peer(NodeId id, std::string ip, std::string port)
 		: id_(id)
-		, ip_(ip)
-		, port_(port)
+		, ip_(std::move(ip))
+		, port_(std::move(port))
 	{
 	}
 
-	bool operator==(const Peer &peer)
+	bool operator==(const Peer &peer) const
 	{
 		return get_id() == peer.get_id() && get_ip() == peer.get_ip() && get_port() == peer.get_port();
 	}
 
-	bool operator!=(const Peer &peer)
+	bool operator!=(const Peer &peer) const
 	{
 		return get_id() != peer.get_id() || get_ip() != peer.get_ip() || get_port() != peer.get_port();
 	}
@@ -44,12 +45,12 @@ public:
 		std::cout << "Port: " << get_port() << std::endl;
 	}
 
-	void set_id(const std::string &id)
+	void set_id(const NodeId &id)
 	{
 		id_ = id;
 	}
 
-	std::string get_id() const
+	const NodeId &get_id() const
 	{
 		return id_;
 	}
@@ -59,7 +60,12 @@ public:
 		ip_ = ip;
 	}
 
-	std::string get_ip() const
+	void set_ip(std::string &&ip)
+	{
+		ip_ = std::move(ip);
+	}
+
+	const std::string &get_ip() const
 	{
 		return ip_;
 	}
@@ -69,7 +75,12 @@ public:
 		port_ = port;
 	}
 
-	std::string get_port() const
+	void set_port(std::string &&port)
+	{
+		port_ = std::move(port);
+	}
+
+	const std::string &get_port() const
 	{
 		return port_;
 	}
@@ -81,13 +92,13 @@ public:
 		return str.str();
 	}
 
-	bool is_valid()
+	bool is_valid() const
 	{
-		return (id_ != "") && (ip_ != "") && (port_ != "");
+		return id_.is_valid() && (ip_ != "") && (port_ != "");
 	}
 
 private:
-	std::string id_;
+	NodeId id_;
 	std::string ip_;
 	std::string port_;
 };
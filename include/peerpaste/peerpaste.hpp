@@ -3,8 +3,10 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <utility>
 
 #include "peerpaste/cryptowrapper.hpp"
+#include "peerpaste/loopback_session.hpp"
 #include "peerpaste/server.hpp"
 
 namespace peerpaste
@@ -18,13 +20,53 @@ public:
 		stop();
 	}
 
-	void init(const std::string& ip, unsigned port, size_t thread_count)
+	void init(const std::string &ip,
+						unsigned port,
+						size_t thread_count,
+						IoMode io_mode = IoMode::SHARED,
+						Transport transport = Transport::ASIO)
 	{
 		handler_ = std::make_shared<MessageHandler>(ip, port);
-		dispatcher_ = std::make_unique<peerpaste::MessageDispatcher>(handler_);
-		server_ = std::make_unique<Server>(thread_count, port, dispatcher_->get_context());
-		server_->set_queue(dispatcher_->get_receive_queue());
-		handler_->init(dispatcher_->get_send_queue());
+		dispatcher_ = std::make_unique<peerpaste::MessageDispatcher>(handler_, thread_count, io_mode, transport);
+		server_ =
+			std::make_unique<Server>(port, dispatcher_->get_io_context_pool(), dispatcher_->get_session_factory());
+		// maintenance messages share the port number with the tcp server
+		dispatcher_->get_udp_transport()->open(port);
+		handler_->init(dispatcher_->get_send_function());
+	}
+
+	/*
+	 * Runs the node without any sockets. It reaches the other nodes attached
+	 * to network within this process, and they reach it under ip and port.
+	 * thread_count sizes the message workers as well as the network threads,
+	 * so rings of many nodes do not start a worker per core for each node.
+	 */
+	void init(const std::string &ip, unsigned port, std::shared_ptr<LoopbackNetwork> network, size_t thread_count = 1)
+	{
+		handler_ = std::make_shared<MessageHandler>(ip, port, thread_count, thread_count);
+		dispatcher_ =
+			std::make_unique<peerpaste::MessageDispatcher>(handler_, thread_count, IoMode::SHARED, Transport::LOOPBACK);
+		dispatcher_->get_session_factory().set_loopback_network(network, ip);
+		network->attach(ip, std::to_string(port), dispatcher_->get_receive_queue());
+		loopback_network_ = std::move(network);
+		loopback_address_ = {ip, std::to_string(port)};
+		handler_->init(dispatcher_->get_send_function());
+	}
+
+	/*
+	 * Has to be called between init() and run()
+	 */
+	void set_compression_options(const CompressionOptions &options)
+	{
+		dispatcher_->set_compression_options(options);
+	}
+
+	/*
+	 * Has to be called between init() and run()
+	 */
+	void set_message_transport(MessageType type, MessageTransport transport)
+	{
+		dispatcher_->set_message_transport(type, transport);
 	}
 
 	void run()
@@ -39,7 +81,10 @@ public:
 		//      accepted when server is not listening. that is bad because even for
 		//      simple put/get a port forwarding for hosts behind nat would be
 		//      needed. this must change
-		server_->run();
+		if(server_ != nullptr)
+		{
+			server_->run();
+		}
 		dispatcher_->run();
 	}
 
@@ -50,6 +95,12 @@ public:
 			server_->stop();
 		}
 
+		if(loopback_network_ != nullptr)
+		{
+			loopback_network_->detach(loopback_address_.first, loopback_address_.second);
+			loopback_network_.reset();
+		}
+
 		if(handler_ != nullptr)
 		{
 			handler_->stop();
@@ -96,6 +147,8 @@ private:
 	std::unique_ptr<Server> server_ = nullptr;
 	std::unique_ptr<peerpaste::MessageDispatcher> dispatcher_ = nullptr;
 	std::shared_ptr<MessageHandler> handler_ = nullptr;
+	std::shared_ptr<LoopbackNetwork> loopback_network_ = nullptr;
+	std::pair<std::string, std::string> loopback_address_;
 };
 
 } // namespace peerpaste
@@ -10,6 +10,7 @@
 #include <functional>
 
 #include "boost_session.hpp"
+#include "message_type.hpp"
 
 class RequestObject;
 class MessagingBase;
@@ -22,37 +23,21 @@ using HandlerFunctionDeprecated = std::function<void(RequestObjectUPtr)>;
 using HandlerFunction = std::function<void(RequestObject)>;
 using DataPromise = std::shared_ptr<std::promise<std::string>>;
 
-enum class MessageType
-{
-	UNKNOWN = 0,
-	NOTIFICATION,
-	CHECK_PREDECESSOR,
-	QUERY,
-	FIND_SUCCESSOR,
-	JOIN,
-	GET_SUCCESSOR_LIST,
-	GET_SELF_AND_SUCC_LIST,
-	GET_PRED_AND_SUCC_LIST,
-	STABILIZE,
-	BROADCAST_FILELIST,
-	GET_FILE,
-};
-
 template<typename Handler>
 struct HandlerObject
 {
-	HandlerObject(std::string correlation_id, const Handler &handler, std::weak_ptr<MessagingBase> parent)
-		: correlation_id_(std::move(correlation_id))
+	HandlerObject(TransactionId correlation_id, const Handler &handler, std::weak_ptr<MessagingBase> parent)
+		: correlation_id_(correlation_id)
 		, handler_(handler)
 		, parent_(parent)
 	{
 	}
 
-	HandlerObject(std::string correlation_id,
+	HandlerObject(TransactionId correlation_id,
 								const Handler &handler,
 								std::weak_ptr<MessagingBase> parent,
 								bool is_persistent)
-		: correlation_id_(std::move(correlation_id))
+		: correlation_id_(correlation_id)
 		, handler_(handler)
 		, parent_(parent)
 		, is_persistent_(is_persistent)
@@ -67,7 +52,7 @@ struct HandlerObject
 	{
 	}
 
-	bool operator==(const std::string &other_id) const
+	bool operator==(const TransactionId &other_id) const
 	{
 		return correlation_id_ == other_id;
 	}
@@ -103,20 +88,20 @@ struct HandlerObject
 	}
 
 
-	std::string correlation_id_;
+	TransactionId correlation_id_;
 	Handler handler_;
 	std::weak_ptr<MessagingBase> parent_;
 	bool is_persistent_ = false;
 };
 
 template<typename Handler>
-bool operator<(const HandlerObject<Handler> &first, const std::string &second)
+bool operator<(const HandlerObject<Handler> &first, const TransactionId &second)
 {
 	return first.correlation_id_ < second;
 }
 
 template<typename Handler>
-bool operator<(const std::string &first, const HandlerObject<Handler> &second)
+bool operator<(const TransactionId &first, const HandlerObject<Handler> &second)
 {
 	return first < second.correlation_id_;
 }
@@ -194,22 +179,22 @@ public:
 
 	void set_message(MessagePtr message)
 	{
-		message_ = message;
+		message_ = std::move(message);
 	}
 
-	const MessagePtr get_message() const
+	const MessagePtr &get_message() const
 	{
 		return message_;
 	}
 
 	void set_connection(PeerPtr peer)
 	{
-		connection_ = peer;
+		connection_ = std::move(peer);
 	}
 
 	void set_connection(SessionPtr session)
 	{
-		connection_ = session;
+		connection_ = std::move(session);
 	}
 
 	bool is_session() const
@@ -217,32 +202,41 @@ public:
 		return std::holds_alternative<SessionPtr>(connection_);
 	}
 
-	const SessionPtr get_session() const
+	const SessionPtr &get_session() const
 	{
 		return std::get<SessionPtr>(connection_);
 	}
 
-	const PeerPtr get_peer() const
+	const PeerPtr &get_peer() const
 	{
 		return std::get<PeerPtr>(connection_);
 	}
 
-	const std::string get_correlational_id() const noexcept
+	TransactionId get_correlational_id() const noexcept
 	{
 		return message_->get_correlational_id();
 	}
 
-	const std::string get_request_type() const noexcept
+	std::string_view get_request_type() const noexcept
 	{
 		return message_->get_request_type();
 	}
 
+	/*
+	 * type_ is not set on every RequestObject, so the type is taken
+	 * from the message header
+	 */
+	MessageType get_message_type() const
+	{
+		return message_->get_message_type();
+	}
+
 	bool is_request() const
 	{
 		return message_->is_request();
 	}
 
-	const std::string get_client_ip() const
+	std::string get_client_ip() const
 	{
 		if(is_session())
 		{
@@ -284,11 +278,49 @@ public:
 		on_write_handler_ = handler;
 	}
 
-	auto get_on_write_handler() const
+	void set_on_write_handler(std::function<void(bool)>&& handler)
+	{
+		on_write_handler_ = std::move(handler);
+	}
+
+	const std::function<void(bool)> &get_on_write_handler() const
 	{
 		return on_write_handler_.value();
 	}
 
+	/*
+	 * Encodings the remote end decodes. Responses are created as copies of
+	 * their request, so they keep the value of the requesting peer.
+	 */
+	void set_accept_encoding(uint32_t accept_encoding)
+	{
+		accept_encoding_ = accept_encoding;
+	}
+
+	uint32_t get_accept_encoding() const
+	{
+		return accept_encoding_;
+	}
+
+	/*
+	 * The range is sent as data of the message's file chunk, straight from
+	 * the file. The message itself must not carry a file chunk then.
+	 */
+	void set_file_range(FileRange range)
+	{
+		file_range_ = std::move(range);
+	}
+
+	bool has_file_range() const
+	{
+		return file_range_.has_value();
+	}
+
+	const FileRange &get_file_range() const
+	{
+		return file_range_.value();
+	}
+
 	MessageType type_;
 
 private:
@@ -310,4 +342,6 @@ private:
 	std::variant<PeerPtr, SessionPtr> connection_;
 	std::chrono::steady_clock::time_point start_;
 	std::optional<std::function<void(bool)>> on_write_handler_;
+	std::optional<FileRange> file_range_;
+	uint32_t accept_encoding_ = 0;
 };
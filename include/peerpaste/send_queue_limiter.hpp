@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+
+#include "peerpaste/message_type.hpp"
+#include "peerpaste/session.hpp"
+
+namespace peerpaste
+{
+
+/*
+ * SendQueueLimiter
+ * Send queue accounting shared by the session implementations. Writers
+ * reserve space before queueing a message and the session releases it
+ * once the message left the socket. Writers never wait, messages that
+ * have to wait for space are parked by the session instead. The limits
+ * apply to every priority class on its own, so a queue full of file
+ * chunks neither blocks nor closes the session for a maintenance message.
+ */
+class SendQueueLimiter
+{
+public:
+	enum class Reservation
+	{
+		ACCEPTED = 0,
+		DROPPED,
+		// the peer cannot keep up, the session has to be closed
+		CLOSE,
+		// the message has to wait for the queue to drain, see reserve_blocked
+		WOULD_BLOCK,
+	};
+
+	void set_limits(const SendLimits &limits)
+	{
+		std::scoped_lock lk{mutex_};
+		limits_ = limits;
+	}
+
+	SendLimits get_limits() const
+	{
+		std::scoped_lock lk{mutex_};
+		return limits_;
+	}
+
+	SendQueueMetrics get_metrics() const
+	{
+		std::scoped_lock lk{mutex_};
+		return metrics_;
+	}
+
+	/*
+	 * Never waits, messages sent with SendPolicy::BLOCK that do not fit are
+	 * parked by the session and retried once it released queued messages
+	 */
+	Reservation reserve(size_t bytes, SendPolicy policy, MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		std::scoped_lock lk{mutex_};
+		auto &queued = queued_[static_cast<size_t>(priority)];
+
+		// blocked messages keep their order, later ones wait behind them
+		if(fits(queued, bytes) && !(policy == SendPolicy::BLOCK && queued.blocked > 0))
+		{
+			account(queued, bytes);
+			return Reservation::ACCEPTED;
+		}
+
+		if(policy == SendPolicy::BLOCK)
+		{
+			++queued.blocked;
+			return Reservation::WOULD_BLOCK;
+		}
+
+		++metrics_.dropped_frames;
+		return policy == SendPolicy::DROP ? Reservation::DROPPED : Reservation::CLOSE;
+	}
+
+	/*
+	 * Retries a message reserve returned WOULD_BLOCK for. Blocked messages
+	 * of a priority have to be retried in the order they got blocked.
+	 */
+	bool reserve_blocked(size_t bytes, MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		std::scoped_lock lk{mutex_};
+		auto &queued = queued_[static_cast<size_t>(priority)];
+
+		if(!fits(queued, bytes))
+		{
+			return false;
+		}
+
+		--queued.blocked;
+		account(queued, bytes);
+		return true;
+	}
+
+	/*
+	 * Gives up on a blocked message, because it waited too long or the
+	 * session got closed
+	 */
+	void cancel_blocked(MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		std::scoped_lock lk{mutex_};
+		--queued_[static_cast<size_t>(priority)].blocked;
+		++metrics_.dropped_frames;
+	}
+
+	void release(size_t frames, size_t bytes, MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		std::scoped_lock lk{mutex_};
+		auto &queued = queued_[static_cast<size_t>(priority)];
+		queued.frames -= frames;
+		queued.bytes -= bytes;
+		metrics_.queued_frames -= frames;
+		metrics_.queued_bytes -= bytes;
+	}
+
+private:
+	struct Queued
+	{
+		size_t frames = 0;
+		size_t bytes = 0;
+		// messages waiting for the queue to drain, not counted in frames and bytes
+		size_t blocked = 0;
+	};
+
+	// a single message bigger than the byte limit is still accepted on an empty queue
+	bool fits(const Queued &queued, size_t bytes) const
+	{
+		return queued.frames == 0 || (queued.frames < limits_.max_frames && queued.bytes + bytes <= limits_.max_bytes);
+	}
+
+	void account(Queued &queued, size_t bytes)
+	{
+		++queued.frames;
+		queued.bytes += bytes;
+		++metrics_.queued_frames;
+		metrics_.queued_bytes += bytes;
+		metrics_.peak_frames = std::max(metrics_.peak_frames, metrics_.queued_frames);
+		metrics_.peak_bytes = std::max(metrics_.peak_bytes, metrics_.queued_bytes);
+	}
+
+	mutable std::mutex mutex_;
+	SendLimits limits_;
+	// the metrics are summed up over these
+	std::array<Queued, MESSAGE_PRIORITY_COUNT> queued_;
+	SendQueueMetrics metrics_;
+};
+
+} // namespace peerpaste
@@ -11,90 +11,103 @@
 #include "peerpaste/concurrent_queue.hpp"
 #include "peerpaste/consumer.hpp"
 #include "peerpaste/cryptowrapper.hpp"
+#include "peerpaste/io_context_pool.hpp"
+#include "peerpaste/session_factory.hpp"
 
 using boost::asio::ip::tcp;
 
 class Server
 {
 public:
-	Server(int thread_count, int port, boost::asio::io_context &io_context)
-		: io_context_(io_context)
-		, thread_count_(thread_count)
-		, acceptor_(io_context_)
+	Server(int port, peerpaste::IoContextPool &io_context_pool, peerpaste::SessionFactory &session_factory)
+		: io_context_pool_(io_context_pool)
+		, session_factory_(session_factory)
 		, port_(port)
 	{
+		// in per core mode every io_context gets its own acceptor on the same port,
+		// the kernel then balances incoming connections between them
+		const auto acceptor_count = io_context_pool_.get_mode() == peerpaste::IoMode::PER_CORE ? io_context_pool_.size() : 1;
+		for(size_t i = 0; i < acceptor_count; ++i)
+		{
+			acceptors_.push_back(std::make_unique<tcp::acceptor>(io_context_pool_.get_io_context(i)));
+		}
 	}
 
 	void run()
 	{
-		start_listening(port_);
-		accept_connections();
-	}
-
-	void set_queue(std::shared_ptr<peerpaste::ConcurrentQueue<peerpaste::MsgBufPair>> queue__)
-	{
-		queue_ = queue__;
+		for(size_t i = 0; i < acceptors_.size(); ++i)
+		{
+			start_listening(*acceptors_[i], port_);
+			accept_connections(i);
+		}
 	}
 
 	void stop()
 	{
-		acceptor_.close();
+		for(auto &acceptor : acceptors_)
+		{
+			boost::system::error_code ec;
+			acceptor->close(ec);
+		}
 		spdlog::debug("[Server] closed acceptor");
 	}
 
 private:
+	using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
 	/**
 	 * Starts listening on the given port
 	 */
-	void start_listening(uint16_t port)
+	void start_listening(tcp::acceptor &acceptor, uint16_t port)
 	{
 		/* BOOST_LOG_FUNCTION(); */
 		spdlog::debug("Setting up endpoint");
 		tcp::endpoint endpoint(tcp::v4(), port);
 		spdlog::info("Setting port to {}", port);
-		acceptor_.open(endpoint.protocol());
-		acceptor_.set_option(tcp::acceptor::reuse_address(true));
-		acceptor_.bind(endpoint);
-		acceptor_.listen();
+		acceptor.open(endpoint.protocol());
+		acceptor.set_option(tcp::acceptor::reuse_address(true));
+		if(acceptors_.size() > 1)
+		{
+			acceptor.set_option(reuse_port(true));
+		}
+		acceptor.bind(endpoint);
+		acceptor.listen();
 		spdlog::info("started listening");
 	}
 
 	/**
-	 * Creates first handler which will accept incomming connections
+	 * Accepts the next incomming connection.
+	 * Sessions run on the io_context of the acceptor that accepted them.
 	 */
-	void accept_connections()
+	void accept_connections(size_t index)
 	{
-		auto handler = std::make_shared<BoostSession>(io_context_, queue_);
-
-		acceptor_.async_accept(handler->get_socket(), [this, handler](auto ec) { handle_new_connection(handler, ec); });
+		acceptors_[index]->async_accept(io_context_pool_.get_io_context(index),
+																		[this, index](auto ec, tcp::socket socket) {
+																			handle_new_connection(index, std::move(socket), ec);
+																		});
 	}
 
-	void handle_new_connection(SessionPtr handler, const boost::system::error_code &ec)
+	void handle_new_connection(size_t index, tcp::socket socket, const boost::system::error_code &ec)
 	{
 		if(ec)
 		{
 			spdlog::error("handle_accept with error: {}", ec.message());
 			return;
 		}
-		if(!acceptor_.is_open())
+		if(!acceptors_[index]->is_open())
 		{
 			return;
 		}
 
-		handler->read();
-
-		auto new_handler = std::make_shared<BoostSession>(io_context_, queue_);
+		session_factory_.adopt(std::move(socket), index)->read();
 
-		acceptor_.async_accept(new_handler->get_socket(),
-													 [this, new_handler](auto ec) { handle_new_connection(new_handler, ec); });
+		accept_connections(index);
 	}
 
-	boost::asio::io_context &io_context_;
-	int thread_count_;
-	std::vector<std::thread> thread_pool_;
-	boost::asio::ip::tcp::acceptor acceptor_;
+	peerpaste::IoContextPool &io_context_pool_;
+	peerpaste::SessionFactory &session_factory_;
+	std::vector<std::unique_ptr<tcp::acceptor>> acceptors_;
 
-	std::shared_ptr<peerpaste::ConcurrentQueue<peerpaste::MsgBufPair>> queue_;
 	const int port_;
 };
 
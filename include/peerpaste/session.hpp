@@ -1,16 +1,104 @@
 #ifndef SESSION_HPP
 #define SESSION_HPP
 
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
 
+#include "peerpaste/buffer_pool.hpp"
+#include "peerpaste/compression.hpp"
+#include "peerpaste/concurrent_queue.hpp"
+#include "peerpaste/message_type.hpp"
+
 // Forward declaration
+class Message;
 class Session;
 
 using DataBuffer = std::vector<uint8_t>;
 using MessagePtr = std::shared_ptr<Message>;
 using SessionPtr = std::shared_ptr<Session>;
+using ReceivedMessage = std::pair<peerpaste::PooledBuffer, SessionPtr>;
+using ReceiveQueue = peerpaste::ConcurrentQueue<ReceivedMessage>;
+
+/*
+ * What a session does with a message that does not fit into its send queue
+ */
+enum class SendPolicy
+{
+	// discard the message
+	DROP = 0,
+	// wait until the queue drained, close the session if that takes too long
+	BLOCK,
+	// close the session, the peer cannot keep up
+	CLOSE,
+};
+
+struct SendLimits
+{
+	size_t max_bytes = 4 * 1024 * 1024;
+	size_t max_frames = 1024;
+	std::chrono::milliseconds block_timeout{10000};
+};
+
+/*
+ * Sessions without any traffic for the idle timeout get closed, as do
+ * sessions that started receiving a frame but did not finish it in time
+ */
+struct SessionTimeouts
+{
+	std::chrono::milliseconds idle{120000};
+	std::chrono::milliseconds read{10000};
+};
+
+struct SendQueueMetrics
+{
+	size_t queued_bytes = 0;
+	size_t queued_frames = 0;
+	size_t peak_bytes = 0;
+	size_t peak_frames = 0;
+	size_t dropped_frames = 0;
+};
+
+/*
+ * A byte range of an open file, appended to a message without reading the
+ * file into a buffer first
+ */
+struct FileRange
+{
+	// closed once the last range referring to it is gone
+	std::shared_ptr<const int> fd;
+	uint64_t offset = 0;
+	size_t size = 0;
+};
+
+/*
+ * Reads the whole range into out
+ */
+inline bool read_file_range(const FileRange &range, void *out)
+{
+	size_t done = 0;
+	while(done < range.size)
+	{
+		const auto bytes = ::pread(*range.fd, static_cast<char *>(out) + done, range.size - done, range.offset + done);
+		if(bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes <= 0)
+		{
+			return false;
+		}
+		done += bytes;
+	}
+	return true;
+}
 
 class Session
 {
@@ -18,14 +106,65 @@ public:
 	virtual ~Session()
 	{
 	}
-	virtual void write(const DataBuffer &encoded_message) = 0;
-	virtual void write_to(const DataBuffer &encoded_message, const std::string &address, const std::string &port) = 0;
-	virtual void write_direct(const DataBuffer &encoded_message, const std::function<void(bool)>& handler) = 0;
+	/*
+	 * The session prepends the length prefix itself,
+	 * so messages are passed in without any framing.
+	 * Sessions with a send queue send messages of a higher priority first.
+	 */
+	virtual void write(DataBuffer message,
+										 SendPolicy policy = SendPolicy::CLOSE,
+										 MessagePriority priority = MessagePriority::DEFAULT) = 0;
+	virtual void write_to(DataBuffer message,
+												const std::string &address,
+												const std::string &port,
+												SendPolicy policy = SendPolicy::CLOSE,
+												MessagePriority priority = MessagePriority::DEFAULT) = 0;
+	virtual void write_direct(DataBuffer message,
+														const std::function<void(bool)> &handler,
+														SendPolicy policy = SendPolicy::BLOCK,
+														MessagePriority priority = MessagePriority::DEFAULT) = 0;
+	/*
+	 * Sends message followed by the bytes of range as a single frame.
+	 * Sessions that cannot send from the file directly read the range into
+	 * the message instead.
+	 */
+	virtual void write_file(DataBuffer message,
+													FileRange range,
+													const std::function<void(bool)> &handler,
+													SendPolicy policy = SendPolicy::BLOCK,
+													MessagePriority priority = MessagePriority::DEFAULT)
+	{
+		const auto message_size = message.size();
+		message.resize(message_size + range.size);
+		if(!read_file_range(range, message.data() + message_size))
+		{
+			handler(true);
+			return;
+		}
+		write_direct(std::move(message), handler, policy, priority);
+	}
 	virtual void read() = 0;
 	virtual std::string get_client_ip() const = 0;
+	virtual SendQueueMetrics get_send_queue_metrics() const = 0;
+	virtual bool is_open() const = 0;
+
+	/*
+	 * Encodings the peer on the other end of the session can decode, as
+	 * advertised by the last message received on it
+	 */
+	void set_accept_encoding(uint32_t accept_encoding)
+	{
+		accept_encoding_ = accept_encoding;
+	}
+
+	uint32_t get_accept_encoding() const
+	{
+		return accept_encoding_;
+	}
 
 protected:
-	std::shared_ptr<peerpaste::ConcurrentQueue<std::pair<DataBuffer, SessionPtr>>> msg_queue_;
+	std::shared_ptr<ReceiveQueue> msg_queue_;
+	std::atomic<uint32_t> accept_encoding_ = peerpaste::Encoding::IDENTITY;
 };
 
 #endif /* ifndef SESSION_HPP */
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "peerpaste/io_context_pool.hpp"
+#include "peerpaste/session.hpp"
+
+namespace peerpaste
+{
+
+class IoUringContext;
+class LoopbackNetwork;
+
+enum class Transport
+{
+	// sockets driven by the io_contexts of the IoContextPool
+	ASIO = 0,
+	// sockets driven by io_uring instances, linux only
+	IO_URING,
+	// in-memory sessions to the nodes of a LoopbackNetwork in this process
+	LOOPBACK,
+};
+
+/*
+ * SessionFactory
+ * Creates the sessions of the transport chosen at startup. An io_uring
+ * transport falls back to asio if the kernel does not support it.
+ * Sessions get the receive queues round robin, every session pushes all of
+ * its messages into the same queue.
+ */
+class SessionFactory
+{
+public:
+	SessionFactory(IoContextPool &io_context_pool,
+								 std::shared_ptr<ReceiveQueue> queue,
+								 Transport transport = Transport::ASIO);
+	SessionFactory(IoContextPool &io_context_pool,
+								 std::vector<std::shared_ptr<ReceiveQueue>> queues,
+								 Transport transport = Transport::ASIO);
+	~SessionFactory();
+
+	SessionFactory(const SessionFactory &) = delete;
+	SessionFactory &operator=(const SessionFactory &) = delete;
+
+	/*
+	 * Returns a session that connects on its first write_to()
+	 */
+	SessionPtr create();
+
+	/*
+	 * Returns a session for a connection accepted on the io_context with
+	 * the given index of the IoContextPool
+	 */
+	SessionPtr adopt(boost::asio::ip::tcp::socket socket, size_t index);
+
+	Transport get_transport() const;
+
+	/*
+	 * Sessions of the loopback transport reach the nodes of network and
+	 * present local_address to them. Has to be called before create().
+	 */
+	void set_loopback_network(std::shared_ptr<LoopbackNetwork> network, std::string local_address);
+
+	void run();
+	void stop();
+
+private:
+	const std::shared_ptr<ReceiveQueue> &next_queue();
+
+	IoContextPool &io_context_pool_;
+	std::vector<std::shared_ptr<ReceiveQueue>> queues_;
+	std::atomic<size_t> next_queue_ = 0;
+	Transport transport_;
+	// shared_ptr, so the type can stay incomplete where io_uring is not available
+	std::vector<std::shared_ptr<IoUringContext>> io_uring_contexts_;
+	std::atomic<size_t> next_ = 0;
+	std::shared_ptr<LoopbackNetwork> loopback_network_;
+	std::string loopback_address_;
+};
+
+} // namespace peerpaste
@@ -7,6 +7,7 @@
 #include <filesystem>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 
 #include "sqlite_modern_cpp.h"
@@ -104,7 +105,8 @@ public:
 	bool add_file(const std::string& filename);
 	std::optional<OfstreamWrapper> create_file(peerpaste::FileInfo& file_info);
 	bool finalize_file(const peerpaste::FileInfo& file_info);
-	std::optional<std::ifstream> read_file(const peerpaste::FileInfo& file_info);
+	// read only descriptor, closed when the last copy is gone
+	std::shared_ptr<const int> open_file(const peerpaste::FileInfo& file_info);
 
 	void put(const std::string &data, const std::string &id);
 	void remove(const std::string &id);
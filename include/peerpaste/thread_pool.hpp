@@ -1,37 +1,81 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
-#include "peerpaste/concurrent_queue.hpp"
-
+/*
+ * ThreadPool
+ * Every worker has its own deque of tasks. Tasks submitted by a worker go
+ * to the back of its own deque and it takes its tasks from there, tasks
+ * from other threads are spread round robin. A worker without tasks steals
+ * from the front of the other deques and parks once all of them are empty.
+ * Tasks still queued on stop or destruction are run before the workers
+ * stop. The pool must not be stopped or destroyed by one of its own tasks,
+ * owners whose last reference may be dropped by a task stop it beforehand.
+ */
 class ThreadPool
 {
 public:
 	ThreadPool(unsigned thread_count = 0);
 	~ThreadPool();
 
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
 	template<typename FunctionType>
 	void submit(std::shared_ptr<FunctionType> function)
 	{
-		work_queue_.push_new(std::bind(&FunctionType::operator(), function));
+		push_task([function = std::move(function)] { (*function)(); });
 	}
 
 	template<typename FunctionType>
 	void submit(FunctionType &&function)
 	{
 		using BareFunctionType = std::remove_cv_t<std::remove_reference_t<FunctionType>>;
-		work_queue_.push_new(std::bind(&BareFunctionType::operator(),
-																	 std::make_shared<BareFunctionType>(std::forward<FunctionType>(function))));
+		push_task(std::bind(&BareFunctionType::operator(),
+												std::make_shared<BareFunctionType>(std::forward<FunctionType>(function))));
 	}
 
+	/*
+	 * Runs the queued tasks and joins the workers. Tasks submitted by other
+	 * threads afterwards are dropped.
+	 */
+	void stop();
+
+	size_t size() const;
+
 private:
-	void worker_thread();
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	struct State
+	{
+		std::vector<std::unique_ptr<WorkQueue>> queues;
+		std::atomic<size_t> next_queue = 0;
+		// tasks in all deques, workers only park while it is zero
+		std::atomic<size_t> queued = 0;
+		std::atomic<size_t> parked = 0;
+
+		std::mutex park_mutex;
+		std::condition_variable park_condition;
+		// only set under park_mutex
+		std::atomic<bool> done = false;
+	};
+
+	void push_task(std::function<void()> task);
+	static bool pop_task(State &state, size_t index, std::function<void()> &task);
+	static void worker_thread(State &state, size_t index);
 
-	std::atomic<bool> done_;
+	State state_;
 	std::vector<std::thread> threads_;
-	peerpaste::ConcurrentQueue<std::function<void()>> work_queue_;
 };
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cinttypes>
+#include <compare>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <random>
+#include <string>
+
+/*
+ * Matches responses with the requests they answer. A zero id stands for no id,
+ * like the empty string did before ids were binary.
+ */
+struct TransactionId
+{
+	uint64_t high = 0;
+	uint64_t low = 0;
+
+	/*
+	 * A random prefix drawn once per thread followed by a counter, so minting
+	 * an id neither hashes nor touches memory shared with other threads
+	 */
+	static TransactionId generate()
+	{
+		thread_local const uint64_t prefix = draw_prefix();
+		thread_local uint64_t counter = 0;
+		return {prefix, ++counter};
+	}
+
+	constexpr bool is_valid() const
+	{
+		return high != 0 || low != 0;
+	}
+
+	/*
+	 * 32 hex digits, or an empty string for no id
+	 */
+	std::string to_string() const
+	{
+		if(!is_valid())
+		{
+			return "";
+		}
+
+		char buffer[33];
+		std::snprintf(buffer, sizeof(buffer), "%016" PRIx64 "%016" PRIx64, high, low);
+		return buffer;
+	}
+
+	constexpr auto operator<=>(const TransactionId &) const = default;
+
+private:
+	static uint64_t draw_prefix()
+	{
+		std::mt19937_64 engine{std::random_device{}()};
+		uint64_t prefix = 0;
+		while(prefix == 0)
+		{
+			prefix = engine();
+		}
+		return prefix;
+	}
+};
+
+inline std::ostream &operator<<(std::ostream &os, const TransactionId &id)
+{
+	return os << id.to_string();
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "peerpaste/session.hpp"
+
+namespace peerpaste
+{
+
+enum class MessageTransport
+{
+	// length prefixed frames over pooled tcp sessions
+	TCP = 0,
+	// one datagram per message, for small request/response pairs
+	UDP,
+};
+
+struct RetransmitPolicy
+{
+	// doubles with every retransmit
+	std::chrono::milliseconds initial_timeout{250};
+	unsigned max_attempts = 4;
+};
+
+/*
+ * UdpTransport
+ * Sends requests as single datagrams and retransmits them until the response
+ * arrived. Every datagram starts with its kind and a sequence number, which
+ * the response repeats. Requests seen before are not handed to the
+ * dispatcher again, instead the response already sent gets repeated.
+ */
+class UdpTransport : public std::enable_shared_from_this<UdpTransport>
+{
+public:
+	using udp = boost::asio::ip::udp;
+	using FailureHandler = std::function<void(DataBuffer)>;
+
+	// messages bigger than this go over tcp
+	static constexpr size_t MAX_PAYLOAD_SIZE = 60 * 1024;
+
+	UdpTransport(boost::asio::io_context &io_context, std::shared_ptr<ReceiveQueue> msg_queue);
+
+	/*
+	 * Binds to the port and starts receiving. Returns false if the port
+	 * is not available, the transport stays closed then.
+	 */
+	bool open(unsigned short port);
+	void close();
+	bool is_open() const;
+	unsigned short get_port() const;
+	void set_retransmit_policy(const RetransmitPolicy &policy);
+
+	/*
+	 * Returns the endpoint of a numeric or already resolved address.
+	 * Unknown names are left to tcp, which resolves and caches them.
+	 */
+	std::optional<udp::endpoint> resolve(const std::string &address, const std::string &port) const;
+
+	/*
+	 * Sends a request and retransmits it until its response arrived.
+	 * on_failed gets the message back if the last attempt timed out.
+	 * Returns the session representing the peer.
+	 */
+	SessionPtr send_request(DataBuffer message, const udp::endpoint &endpoint, FailureHandler on_failed = nullptr);
+
+	void send_response(const udp::endpoint &endpoint, uint32_t sequence, DataBuffer message);
+
+	size_t get_pending_requests() const;
+
+private:
+	enum class Kind : uint8_t
+	{
+		REQUEST = 1,
+		RESPONSE = 2,
+	};
+
+	struct PendingRequest
+	{
+		udp::endpoint endpoint;
+		std::shared_ptr<DataBuffer> datagram;
+		std::unique_ptr<boost::asio::steady_timer> timer;
+		std::chrono::milliseconds timeout;
+		unsigned attempts = 0;
+		FailureHandler on_failed;
+	};
+
+	struct ReceivedRequest
+	{
+		std::chrono::steady_clock::time_point received;
+		// empty until the dispatcher answered
+		std::shared_ptr<DataBuffer> response;
+	};
+
+	static constexpr size_t HEADER_SIZE = 5;
+	static constexpr size_t MAX_DATAGRAM_SIZE = 64 * 1024;
+	// how long requests are remembered to filter retransmits
+	static constexpr std::chrono::seconds RECEIVED_REQUEST_TTL{30};
+
+	static std::shared_ptr<DataBuffer> make_datagram(Kind kind, uint32_t sequence, const DataBuffer &payload);
+	void receive();
+	void handle_receive(const boost::system::error_code &ec, size_t bytes);
+	void handle_request(uint32_t sequence, const uint8_t *payload, size_t size);
+	void handle_response(uint32_t sequence, const uint8_t *payload, size_t size);
+	void push(const uint8_t *payload, size_t size, std::optional<uint32_t> reply_to);
+	void transmit(std::shared_ptr<DataBuffer> datagram, const udp::endpoint &endpoint);
+	void arm_retransmit(uint32_t sequence);
+	void handle_retransmit(uint32_t sequence, const boost::system::error_code &ec);
+	void prune_received_requests();
+
+	boost::asio::io_context &io_context_;
+	boost::asio::io_context::strand strand_;
+	udp::socket socket_;
+	std::shared_ptr<ReceiveQueue> msg_queue_;
+	std::atomic<bool> is_open_ = false;
+	std::atomic<uint32_t> next_sequence_;
+	std::atomic<size_t> pending_count_ = 0;
+
+	// only accessed on the strand_
+	RetransmitPolicy retransmit_policy_;
+	std::map<uint32_t, PendingRequest> pending_requests_;
+	std::map<std::pair<udp::endpoint, uint32_t>, ReceivedRequest> received_requests_;
+	std::chrono::steady_clock::time_point last_prune_;
+	DataBuffer receive_buffer_;
+	udp::endpoint sender_;
+};
+
+/*
+ * UdpSession
+ * The peer of a datagram exchange. Writing to the session of a received
+ * request sends its response.
+ */
+class UdpSession : public Session
+{
+public:
+	UdpSession(std::shared_ptr<UdpTransport> transport,
+						 boost::asio::ip::udp::endpoint endpoint,
+						 std::optional<uint32_t> reply_to = std::nullopt);
+
+	void write(DataBuffer message,
+						 SendPolicy policy = SendPolicy::CLOSE,
+						 MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_to(DataBuffer message,
+								const std::string &address,
+								const std::string &port,
+								SendPolicy policy = SendPolicy::CLOSE,
+								MessagePriority priority = MessagePriority::DEFAULT) override;
+	void write_direct(DataBuffer message,
+										const std::function<void(bool)> &handler,
+										SendPolicy policy = SendPolicy::BLOCK,
+										MessagePriority priority = MessagePriority::DEFAULT) override;
+	// datagrams are received by the transport
+	void read() override;
+	std::string get_client_ip() const override;
+	SendQueueMetrics get_send_queue_metrics() const override;
+	bool is_open() const override;
+
+private:
+	std::shared_ptr<UdpTransport> transport_;
+	boost::asio::ip::udp::endpoint endpoint_;
+	std::optional<uint32_t> reply_to_;
+};
+
+} // namespace peerpaste
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <optional>
+
+#include "peerpaste/message_type.hpp"
+
+namespace peerpaste
+{
+
+/*
+ * WeightedQueues
+ * A FIFO queue per MessagePriority, served by weighted round robin: in
+ * every round a class gets as many pops as its weight, higher priorities
+ * first. Classes without elements give their turns away, so no class
+ * starves and none waits for an idle one. Not thread safe.
+ */
+template<typename T>
+class WeightedQueues
+{
+public:
+	using Weights = std::array<size_t, MESSAGE_PRIORITY_COUNT>;
+
+	/*
+	 * Every weight has to be at least 1
+	 */
+	explicit WeightedQueues(const Weights &weights)
+		: weights_(weights)
+		, credits_(weights)
+	{
+	}
+
+	void push(T element, MessagePriority priority)
+	{
+		queues_[static_cast<size_t>(priority)].push_back(std::move(element));
+		++size_;
+	}
+
+	std::optional<T> pop()
+	{
+		if(size_ == 0)
+		{
+			return {};
+		}
+
+		while(true)
+		{
+			for(size_t i = 0; i < queues_.size(); ++i)
+			{
+				if(!queues_[i].empty() && credits_[i] > 0)
+				{
+					--credits_[i];
+					--size_;
+					auto element = std::move(queues_[i].front());
+					queues_[i].pop_front();
+					return element;
+				}
+			}
+
+			// the classes holding elements used up their turns
+			credits_ = weights_;
+		}
+	}
+
+	size_t size() const
+	{
+		return size_;
+	}
+
+	bool empty() const
+	{
+		return size_ == 0;
+	}
+
+private:
+	std::array<std::deque<T>, MESSAGE_PRIORITY_COUNT> queues_;
+	const Weights weights_;
+	Weights credits_;
+	size_t size_ = 0;
+};
+
+} // namespace peerpaste
@@ -4,26 +4,52 @@
 
 #include <boost/asio.hpp>
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include <algorithm>
 #include <iostream>
 #include <memory>
 
 using boost::asio::ip::tcp;
 
-BoostSession::BoostSession(
-	boost::asio::io_context &io_context,
-	std::shared_ptr<peerpaste::ConcurrentQueue<std::pair<std::vector<uint8_t>, SessionPtr>>> msg_queue)
+BoostSession::BoostSession(boost::asio::io_context &io_context, std::shared_ptr<ReceiveQueue> msg_queue)
 	: service_(io_context)
-	, write_strand_(io_context)
-	, read_strand_(io_context)
+	, strand_(io_context)
 	, socket_(io_context)
+	, resolver_(io_context)
+	, timeout_timer_(io_context)
+	, last_activity_(std::chrono::steady_clock::now())
 {
 	msg_queue_ = std::move(msg_queue);
 }
 
+BoostSession::BoostSession(boost::asio::io_context &io_context,
+													 std::shared_ptr<ReceiveQueue> msg_queue,
+													 tcp::socket socket)
+	: BoostSession(io_context, std::move(msg_queue))
+{
+	socket_ = std::move(socket);
+	store_remote_endpoint();
+}
+
 BoostSession::~BoostSession()
 {
 }
 
+peerpaste::EndpointCache &BoostSession::get_endpoint_cache()
+{
+	static peerpaste::EndpointCache cache;
+	return cache;
+}
+
+const std::shared_ptr<peerpaste::BufferPool> &BoostSession::get_buffer_pool()
+{
+	static const auto pool = std::make_shared<peerpaste::BufferPool>();
+	return pool;
+}
+
 boost::asio::ip::tcp::socket &BoostSession::get_socket()
 {
 	return socket_;
@@ -31,186 +57,686 @@ boost::asio::ip::tcp::socket &BoostSession::get_socket()
 
 void BoostSession::stop()
 {
-	socket_.close();
+	if(!is_open_.exchange(false))
+	{
+		return;
+	}
+
+	// every operation on the socket runs on the strand_, closing it there
+	// aborts the pending operations instead of racing with them
+	boost::asio::post(strand_, [me = shared_from_this()]() {
+		boost::system::error_code ec;
+		me->socket_.close(ec);
+		// a write in progress is aborted and fails the queued frames once it completes
+		if(me->send_packet_queue.empty())
+		{
+			me->fail_queued_frames();
+		}
+		me->fail_blocked_frames();
+	});
 }
 
-void BoostSession::write(const std::vector<uint8_t> &encoded_message)
+bool BoostSession::is_open() const
 {
-	service_.post(
-		write_strand_.wrap([me = shared_from_this(), encoded_message]() { me->queue_message(encoded_message); }));
+	return is_open_;
 }
 
-void BoostSession::write_direct(const DataBuffer& encoded_message, const std::function<void(bool)>& handler)
+SendQueueMetrics BoostSession::get_send_queue_metrics() const
 {
-	//TODO: overthink handling of encoded message and its lifetime
-	service_.post(
-		write_strand_.wrap([me = shared_from_this(), encoded_message, handler]()
+	return send_queue_limiter_.get_metrics();
+}
+
+void BoostSession::set_timeouts(const SessionTimeouts &timeouts)
+{
+	service_.post(strand_.wrap([me = shared_from_this(), timeouts]() { me->timeouts_ = timeouts; }));
+}
+
+void BoostSession::touch()
+{
+	last_activity_ = std::chrono::steady_clock::now();
+}
+
+void BoostSession::start_timeout_timer()
+{
+	if(is_timer_running_.exchange(true))
 	{
-		auto vec = std::make_shared<DataBuffer>();
-		vec->insert(vec->end(),
-							 std::make_move_iterator(encoded_message.begin()),
-							 std::make_move_iterator(encoded_message.end()));
+		return;
+	}
+
+	touch();
+	service_.post(strand_.wrap([me = shared_from_this()]() { me->arm_timeout_timer(); }));
+}
+
+void BoostSession::arm_timeout_timer()
+{
+	const auto block_timeout = send_queue_limiter_.get_limits().block_timeout;
+	const auto interval = std::min({TIMEOUT_CHECK_INTERVAL, timeouts_.idle / 2, timeouts_.read / 2, block_timeout / 2});
+	timeout_timer_.expires_after(interval);
+	timeout_timer_.async_wait(strand_.wrap(
+		[me = shared_from_this()](const boost::system::error_code &ec) { me->handle_timeout_timer(ec); }));
+}
 
-		async_write(me->socket_,
-							boost::asio::buffer(*vec.get()),
-							[vec, me, handler](boost::system::error_code const& ec,
-												std::size_t)
+void BoostSession::handle_timeout_timer(const boost::system::error_code &ec)
+{
+	// the timer keeps the session alive, so it stops once the session got closed
+	if(ec || !is_open_)
+	{
+		return;
+	}
+
+	if(has_expired_blocked_frames())
+	{
+		spdlog::warn("BoostSession send queue did not drain in time, closing slow session");
+		stop();
+		return;
+	}
+
+	const auto inactive = std::chrono::steady_clock::now() - last_activity_.load();
+
+	// a paused session holds its partial frame until the dispatcher caught up
+	if(is_frame_pending_ && !is_read_paused_ && inactive > timeouts_.read)
+	{
+		spdlog::debug("BoostSession read timed out, closing session");
+		stop();
+		return;
+	}
+
+	if(!is_read_paused_ && inactive > timeouts_.idle)
+	{
+		spdlog::debug("BoostSession is idle, closing session");
+		stop();
+		return;
+	}
+
+	arm_timeout_timer();
+}
+
+void BoostSession::set_send_limits(const SendLimits &limits)
+{
+	send_queue_limiter_.set_limits(limits);
+}
+
+void BoostSession::send_message(DataBuffer message,
+																SendPolicy policy,
+																MessagePriority priority,
+																std::function<void(bool)> on_write,
+																std::optional<FileRange> file)
+{
+	switch(send_queue_limiter_.reserve(message.size(), policy, priority))
+	{
+		case peerpaste::SendQueueLimiter::Reservation::ACCEPTED:
+			service_.post(strand_.wrap(
+				[me = shared_from_this(), message = std::move(message), priority, on_write, file = std::move(file)]() mutable {
+					me->queue_message(std::move(message), priority, std::move(on_write), std::move(file));
+				}));
+			return;
+		case peerpaste::SendQueueLimiter::Reservation::WOULD_BLOCK:
+			// the message waits on the strand, so the calling thread is not held up by a slow peer
+			start_timeout_timer();
+			service_.post(strand_.wrap(
+				[me = shared_from_this(), message = std::move(message), priority, on_write, file = std::move(file)]() mutable {
+					me->block_message(std::move(message), priority, std::move(on_write), std::move(file));
+				}));
+			return;
+		case peerpaste::SendQueueLimiter::Reservation::DROPPED:
+			spdlog::debug("BoostSession send queue full, dropped message");
+			break;
+		case peerpaste::SendQueueLimiter::Reservation::CLOSE:
+			spdlog::warn("BoostSession send queue full, closing slow session");
+			stop();
+			break;
+	}
+
+	if(on_write)
+	{
+		on_write(true);
+	}
+}
+
+void BoostSession::block_message(DataBuffer message,
+																 MessagePriority priority,
+																 std::function<void(bool)> on_write,
+																 std::optional<FileRange> file)
+{
+	if(!is_open_)
+	{
+		send_queue_limiter_.cancel_blocked(priority);
+		if(on_write)
 		{
-			if(ec)
+			on_write(true);
+		}
+		return;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + send_queue_limiter_.get_limits().block_timeout;
+	blocked_frames_[static_cast<size_t>(priority)].push_back(
+		BlockedFrame{std::move(message), std::move(on_write), std::move(file), deadline});
+
+	// the queue might have drained since the reservation failed
+	resume_blocked_frames();
+}
+
+void BoostSession::resume_blocked_frames()
+{
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
+	{
+		auto &blocked = blocked_frames_[priority];
+		while(!blocked.empty()
+					&& send_queue_limiter_.reserve_blocked(blocked.front().payload.size(), static_cast<MessagePriority>(priority)))
+		{
+			auto frame = std::move(blocked.front());
+			blocked.pop_front();
+			queue_message(std::move(frame.payload),
+										static_cast<MessagePriority>(priority),
+										std::move(frame.on_write),
+										std::move(frame.file));
+		}
+	}
+}
+
+bool BoostSession::has_expired_blocked_frames() const
+{
+	// every frame waits for the same timeout, so the oldest one expires first
+	const auto now = std::chrono::steady_clock::now();
+	return std::any_of(blocked_frames_.begin(), blocked_frames_.end(), [now](const auto &blocked) {
+		return !blocked.empty() && blocked.front().deadline <= now;
+	});
+}
+
+void BoostSession::fail_blocked_frames()
+{
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
+	{
+		auto blocked = std::move(blocked_frames_[priority]);
+		blocked_frames_[priority].clear();
+		for(auto &frame : blocked)
+		{
+			send_queue_limiter_.cancel_blocked(static_cast<MessagePriority>(priority));
+			if(frame.on_write)
 			{
-				spdlog::error("BoostSession::write_direct failed, reason: {}", ec.message());
+				frame.on_write(true);
 			}
+		}
+	}
+}
 
-			handler(static_cast<bool>(ec));
-		});
-	}));
+void BoostSession::release_send_queue(size_t frames, size_t bytes, MessagePriority priority)
+{
+	send_queue_limiter_.release(frames, bytes, priority);
+}
+
+void BoostSession::write(DataBuffer message, SendPolicy policy, MessagePriority priority)
+{
+	send_message(std::move(message), policy, priority);
+}
 
+void BoostSession::write_direct(DataBuffer message,
+																const std::function<void(bool)> &handler,
+																SendPolicy policy,
+																MessagePriority priority)
+{
+	send_message(std::move(message), policy, priority, handler);
 }
 
-void BoostSession::write_to(const std::vector<uint8_t> &encoded_message,
+void BoostSession::write_to(DataBuffer message,
 														const std::string &address,
-														const std::string &port)
+														const std::string &port,
+														SendPolicy policy,
+														MessagePriority priority)
 {
-	tcp::resolver resolver(service_);
-	auto endpoint = resolver.resolve(address, port);
+	// Messages written before the connection is established stay queued
+	// until handle_connect starts sending them. write_to is called on a new
+	// session, so nothing else uses the socket while the connect is started.
+	is_connected_ = false;
+	start_timeout_timer();
+	write(std::move(message), policy, priority);
 
-	boost::asio::async_connect(
-		socket_,
-		endpoint,
-		[this, me = shared_from_this(), endpoint, encoded_message](boost::system::error_code ec, tcp::endpoint) {
-			if(!ec)
-			{
-				me->write(encoded_message);
-			}
-			else
+	if(auto endpoints = peerpaste::EndpointCache::from_numeric(address, port))
+	{
+		do_connect(std::move(endpoints.value()));
+		return;
+	}
+
+	if(auto endpoints = get_endpoint_cache().get(address, port))
+	{
+		do_connect(std::move(endpoints.value()));
+		return;
+	}
+
+	resolver_.async_resolve(
+		address,
+		port,
+		strand_.wrap([me = shared_from_this(), address, port](boost::system::error_code ec,
+																												 tcp::resolver::results_type results) {
+			if(ec)
 			{
-				std::cout << "error: " << ec << std::endl;
+				spdlog::error("BoostSession::write_to could not resolve {}, reason: {}", address, ec.message());
+				me->stop();
+				return;
 			}
-		});
+
+			peerpaste::Endpoints endpoints(results.begin(), results.end());
+			get_endpoint_cache().put(address, port, endpoints);
+			me->do_connect(std::move(endpoints));
+		}));
+}
+
+void BoostSession::write_file(DataBuffer message,
+															FileRange range,
+															const std::function<void(bool)> &handler,
+															SendPolicy policy,
+															MessagePriority priority)
+{
+#ifdef __linux__
+	// only the message is buffered, the range is sent from the page cache
+	send_message(std::move(message), policy, priority, handler, std::move(range));
+#else
+	Session::write_file(std::move(message), std::move(range), handler, policy, priority);
+#endif
+}
+
+void BoostSession::do_connect(peerpaste::Endpoints endpoints)
+{
+	// async_connect only keeps a reference to the endpoints, so they are
+	// stored in the session until the connect handler ran
+	endpoints_ = std::move(endpoints);
+
+	boost::asio::async_connect(
+		socket_,
+		endpoints_,
+		strand_.wrap([me = shared_from_this()](boost::system::error_code ec, tcp::endpoint) {
+			me->handle_connect(ec);
+		}));
+}
+
+void BoostSession::handle_connect(const boost::system::error_code &ec)
+{
+	if(ec)
+	{
+		spdlog::error("BoostSession::write_to could not connect, reason: {}", ec.message());
+		stop();
+		return;
+	}
+
+	is_connected_ = true;
+	store_remote_endpoint();
+
+	if(read_on_connect_)
+	{
+		do_read();
+	}
+
+	if(has_queued_frames())
+	{
+		start_packet_send();
+	}
 }
 
 void BoostSession::read()
 {
-	do_read_header();
+	// Sessions keep reading until they get closed, so only the first call
+	// starts the read loop
+	if(is_reading_.exchange(true))
+	{
+		return;
+	}
+
+	start_timeout_timer();
+
+	// the socket is not open before a pending connect finished
+	service_.post(strand_.wrap([me = shared_from_this()]() {
+		if(me->is_connected_)
+		{
+			me->store_remote_endpoint();
+			me->do_read();
+		}
+		else
+		{
+			me->read_on_connect_ = true;
+		}
+	}));
+}
+
+void BoostSession::store_remote_endpoint()
+{
+	boost::system::error_code ec;
+	const auto endpoint = socket_.remote_endpoint(ec);
+	if(ec)
+	{
+		return;
+	}
+
+	std::lock_guard lock(remote_endpoint_mutex_);
+	remote_endpoint_ = endpoint;
 }
 
 std::string BoostSession::get_client_ip() const
 {
-	return socket_.remote_endpoint().address().to_string();
+	// empty before the connection got established
+	std::lock_guard lock(remote_endpoint_mutex_);
+	return remote_endpoint_.has_value() ? remote_endpoint_->address().to_string() : std::string{};
 }
 
 unsigned BoostSession::get_client_port() const
 {
-	return socket_.remote_endpoint().port();
+	std::lock_guard lock(remote_endpoint_mutex_);
+	return remote_endpoint_.has_value() ? remote_endpoint_->port() : 0;
 }
 
-void BoostSession::queue_message(const std::vector<uint8_t> &message)
+void BoostSession::queue_message(DataBuffer message,
+																 MessagePriority priority,
+																 std::function<void(bool)> on_write,
+																 std::optional<FileRange> file)
 {
+	// frames taken for sending are only gone once their write completed
 	bool write_in_progress = !send_packet_queue.empty();
-	send_packet_queue.push_back(std::move(message));
 
-	if(!write_in_progress)
+	const auto frame_size = message.size() + (file.has_value() ? file->size : 0);
+	OutgoingFrame frame{{}, std::move(message), std::move(on_write), std::move(file), priority};
+	encode_header(frame.header, frame_size);
+	queued_frames_[static_cast<size_t>(priority)].push_back(std::move(frame));
+
+	if(!is_open_)
+	{
+		// a write still in progress fails the frame once it completes
+		if(!write_in_progress)
+		{
+			fail_queued_frames();
+		}
+		return;
+	}
+
+	if(!write_in_progress && is_connected_)
 	{
 		start_packet_send();
 	}
 }
 
+bool BoostSession::has_queued_frames() const
+{
+	return std::any_of(queued_frames_.begin(), queued_frames_.end(), [](const auto &frames) { return !frames.empty(); });
+}
+
+void BoostSession::take_queued_frames()
+{
+	// Frames of a higher priority overtake every frame that is not taken for
+	// sending yet, so a maintenance message waits for one write at most
+	for(auto &frames : queued_frames_)
+	{
+		while(!frames.empty() && send_packet_queue.size() < max_gathered_frames_)
+		{
+			// a file range ends the write, later frames are taken for the next one
+			if(!send_packet_queue.empty() && send_packet_queue.back().file.has_value())
+			{
+				return;
+			}
+			send_packet_queue.push_back(std::move(frames.front()));
+			frames.pop_front();
+		}
+	}
+}
+
 void BoostSession::start_packet_send()
 {
+	take_queued_frames();
+
+	// Gather every taken frame into one write. The deque keeps references to
+	// its elements valid on push_back, so frames taken meanwhile are safe.
+	// A frame with a file range ends the batch, its range follows the write.
+	const auto gathered_frames = std::min(send_packet_queue.size(), max_gathered_frames_);
+
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.reserve(gathered_frames * 2);
+	for(frames_in_flight_ = 0; frames_in_flight_ < gathered_frames;)
+	{
+		const auto &frame = send_packet_queue[frames_in_flight_++];
+		buffers.push_back(boost::asio::buffer(frame.header));
+		buffers.push_back(boost::asio::buffer(frame.payload));
+		if(frame.file.has_value())
+		{
+			break;
+		}
+	}
+
 	async_write(socket_,
-							boost::asio::buffer(send_packet_queue.front()),
-							write_strand_.wrap([me = shared_from_this()](boost::system::error_code const &ec, std::size_t) {
-								me->packet_send_done(ec);
+							buffers,
+							strand_.wrap([me = shared_from_this()](boost::system::error_code const &ec, std::size_t) {
+								me->handle_packet_send(ec);
 							}));
 }
 
+void BoostSession::handle_packet_send(boost::system::error_code const &error)
+{
+	if(!error && send_packet_queue[frames_in_flight_ - 1].file.has_value())
+	{
+		file_bytes_sent_ = 0;
+		send_file_range();
+		return;
+	}
+
+	packet_send_done(error);
+}
+
+void BoostSession::send_file_range()
+{
+#ifdef __linux__
+	const auto &range = send_packet_queue[frames_in_flight_ - 1].file.value();
+
+	// sendfile on a blocking socket would stall the io_context thread
+	boost::system::error_code ec;
+	if(!socket_.native_non_blocking())
+	{
+		socket_.native_non_blocking(true, ec);
+	}
+
+	while(!ec && file_bytes_sent_ < range.size)
+	{
+		off_t offset = range.offset + file_bytes_sent_;
+		const auto sent = ::sendfile(socket_.native_handle(), *range.fd, &offset, range.size - file_bytes_sent_);
+		if(sent > 0)
+		{
+			file_bytes_sent_ += sent;
+		}
+		else if(sent == 0)
+		{
+			// the file got shorter than the range
+			ec = boost::asio::error::eof;
+		}
+		else if(errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			socket_.async_wait(tcp::socket::wait_write,
+												 strand_.wrap([me = shared_from_this()](const boost::system::error_code &ec) {
+													 if(ec)
+													 {
+														 me->packet_send_done(ec);
+														 return;
+													 }
+													 me->send_file_range();
+												 }));
+			return;
+		}
+		else if(errno != EINTR)
+		{
+			ec.assign(errno, boost::system::system_category());
+		}
+	}
+
+	packet_send_done(ec);
+#else
+	packet_send_done(boost::asio::error::operation_not_supported);
+#endif
+}
+
 void BoostSession::packet_send_done(boost::system::error_code const &error)
 {
-	if(!error)
+	if(error)
 	{
-		/* auto vec = send_packet_queue.front(); */
-		send_packet_queue.pop_front();
+		spdlog::debug("BoostSession::packet_send_done failed, reason: {}", error.message());
+	}
+	else
+	{
+		touch();
+	}
 
-		// TODO: move out of if statement so it gets called everytime?
-		if(!send_packet_queue.empty())
+	complete_frames(send_packet_queue, frames_in_flight_, static_cast<bool>(error));
+	frames_in_flight_ = 0;
+
+	if(!error)
+	{
+		if(!send_packet_queue.empty() || has_queued_frames())
 		{
 			start_packet_send();
 		}
+		// blocked frames are queued behind the ones taken for this write
+		resume_blocked_frames();
+		return;
 	}
-	else if(error != boost::asio::error::operation_aborted)
+
+	// nothing is written anymore, so the frames still waiting fail as well
+	fail_queued_frames();
+	if(error != boost::asio::error::operation_aborted)
 	{
 		stop();
 	}
 }
 
-void BoostSession::handle_read_message(const boost::system::error_code &ec)
+void BoostSession::complete_frames(std::deque<OutgoingFrame> &frames, size_t count, bool failed)
 {
-	if(!ec)
+	std::array<size_t, MESSAGE_PRIORITY_COUNT> done_frames{};
+	std::array<size_t, MESSAGE_PRIORITY_COUNT> done_bytes{};
+	for(; count > 0; --count)
 	{
-		auto begin = readbuf_.begin() + header_size_;
-		auto end = readbuf_.end();
-		std::vector<uint8_t> message_buf(begin, end);
-		msg_queue_->push(std::make_pair(std::move(message_buf), shared_from_this()));
+		const auto priority = static_cast<size_t>(frames.front().priority);
+		++done_frames[priority];
+		done_bytes[priority] += frames.front().payload.size();
+		auto on_write = std::move(frames.front().on_write);
+		frames.pop_front();
+
+		if(on_write)
+		{
+			on_write(failed);
+		}
 	}
-	else
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
 	{
-		std::cout << "error in handle read message: " << ec << std::endl;
-		do_read_header();
+		if(done_frames[priority] > 0)
+		{
+			release_send_queue(done_frames[priority], done_bytes[priority], static_cast<MessagePriority>(priority));
+		}
 	}
 }
 
-void BoostSession::do_read_message(unsigned msg_len)
+void BoostSession::fail_queued_frames()
 {
-	readbuf_.resize(header_size_ + msg_len);
-	boost::asio::mutable_buffers_1 buf = boost::asio::buffer(&readbuf_[header_size_], msg_len);
-	boost::asio::async_read(socket_, buf, [me = shared_from_this()](boost::system::error_code const &error, std::size_t) {
-		me->handle_read_message(error);
-	});
+	// taken out first, on_write handlers may queue new messages
+	auto frames = std::move(send_packet_queue);
+	send_packet_queue.clear();
+	for(auto &queued : queued_frames_)
+	{
+		std::move(queued.begin(), queued.end(), std::back_inserter(frames));
+		queued.clear();
+	}
+
+	complete_frames(frames, frames.size(), true);
 }
 
-void BoostSession::handle_read_header(const boost::system::error_code &error)
+void BoostSession::do_read()
 {
-	if(!error)
+	// reads run on the strand_ as well, so stop() cannot close the socket under them
+	const auto [data, size] = frame_decoder_.prepare();
+	socket_.async_read_some(boost::asio::buffer(data, size),
+													strand_.wrap([me = shared_from_this()](boost::system::error_code const &ec, std::size_t bytes) {
+														me->handle_read(ec, bytes);
+													}));
+}
+
+void BoostSession::handle_read(const boost::system::error_code &ec, std::size_t bytes)
+{
+	if(ec)
+	{
+		handle_read_failed(ec);
+		return;
+	}
+
+	touch();
+	frame_decoder_.commit(bytes);
+	handle_frames();
+}
+
+void BoostSession::handle_frames()
+{
+	while(!msg_queue_->is_full())
 	{
-		unsigned msg_len = decode_header(readbuf_);
+		auto frame = frame_decoder_.next_frame(*get_buffer_pool());
+		if(!frame.has_value())
+		{
+			break;
+		}
 
-		do_read_message(msg_len);
+		msg_queue_->push(std::make_pair(std::move(frame.value()), shared_from_this()));
+	}
+
+	// Stop reading while the dispatcher is behind, so that tcp flow control
+	// slows down the sender. Buffered frames get handled when reading resumes.
+	is_frame_pending_ = frame_decoder_.buffered() > 0 || frame_decoder_.has_partial_frame();
+
+	if(msg_queue_->is_full())
+	{
+		is_read_paused_ = true;
+		msg_queue_->on_drained([me = shared_from_this()]() {
+			me->service_.post(me->strand_.wrap([me]() {
+				me->is_read_paused_ = false;
+				me->touch();
+				me->handle_frames();
+			}));
+		});
 		return;
 	}
-	else if(error != boost::asio::error::operation_aborted)
+
+	if(frame_decoder_.has_partial_frame())
 	{
-		stop();
+		do_read_partial_frame();
+		return;
 	}
 
-	return;
+	do_read();
 }
 
-// TODO: this function has to post to the read_strand_
-void BoostSession::do_read_header()
+void BoostSession::do_read_partial_frame()
 {
-	readbuf_.resize(header_size_);
+	// frames bigger than the decoder buffer are read directly into their own buffer
+	const auto [data, size] = frame_decoder_.partial_remaining();
+	boost::asio::async_read(socket_,
+													boost::asio::buffer(data, size),
+													strand_.wrap([me = shared_from_this()](boost::system::error_code const &ec, std::size_t) {
+														me->handle_read_partial_frame(ec);
+													}));
+}
 
-	boost::asio::async_read(
-		socket_,
-		boost::asio::buffer(readbuf_),
-		[me = shared_from_this()](boost::system::error_code const &error, std::size_t) { me->handle_read_header(error); });
+void BoostSession::handle_read_partial_frame(const boost::system::error_code &ec)
+{
+	if(ec)
+	{
+		handle_read_failed(ec);
+		return;
+	}
+
+	touch();
+	msg_queue_->push(std::make_pair(frame_decoder_.take_partial_frame(), shared_from_this()));
+	handle_frames();
 }
 
-unsigned BoostSession::decode_header(const DataBuffer &buf) const
+void BoostSession::handle_read_failed(const boost::system::error_code &ec)
 {
-	if(buf.size() < header_size_)
-		return 0;
-	unsigned msg_size = 0;
-	for(unsigned i = 0; i < header_size_; ++i)
+	if(ec != boost::asio::error::operation_aborted)
 	{
-		msg_size = msg_size * 256 + (static_cast<unsigned>(buf[i]) & 0xFF);
+		spdlog::debug("BoostSession read failed, reason: {}", ec.message());
+		stop();
 	}
-	return msg_size;
 }
 
-void BoostSession::encode_header(DataBuffer &buf, unsigned size) const
+void BoostSession::encode_header(FrameHeader &buf, unsigned size) const
 {
-	assert(buf.size() >= header_size_);
 	buf[0] = static_cast<boost::uint8_t>((size >> 24) & 0xFF);
 	buf[1] = static_cast<boost::uint8_t>((size >> 16) & 0xFF);
 	buf[2] = static_cast<boost::uint8_t>((size >> 8) & 0xFF);
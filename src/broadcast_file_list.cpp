@@ -42,7 +42,9 @@ void BroadcastFilelist::HandleNotification(const RequestObject &request_object,
 void BroadcastFilelist::HandleNotification()
 {
 	time_point_ = std::chrono::system_clock::now() + DURATION;
-	if(flag_ && std::all_of(dependencies_.begin(), dependencies_.end(), [](auto dep) { return dep.first->is_done(); }))
+	const auto dependencies = get_dependencies();
+	const auto dependency_done = [](const auto &dependency) { return dependency.first->is_done(); };
+	if(flag_ && std::all_of(dependencies.begin(), dependencies.end(), dependency_done))
 	{
 		state_ = MESSAGE_STATE::DONE;
 		RequestDestruction();
@@ -69,12 +71,10 @@ void BroadcastFilelist::create_request()
 		return;
 	}
 
-	const auto message = std::make_shared<Message>(Message::create_request("broadcast_filelist", {self}));
+	const auto message = std::make_shared<Message>(Message::create_request(MessageType::BROADCAST_FILELIST, {self}));
 
 	message->set_filelist(storage_->get_files());
 
-	const auto transaction_id = message->get_transaction_id();
-
 	// const auto handler = std::bind(&BroadcastFilelist::handle_response, this, std::placeholders::_1);
 
 	RequestObject request{type_};
@@ -99,7 +99,7 @@ void BroadcastFilelist::handle_request()
 
 	const auto message = request_.value().get_message();
 
-	const auto file_list = message->get_files();
+	const auto &file_list = message->get_files();
 
 	Peer self;
 	if(not routing_table_->try_get_self(self))
@@ -132,7 +132,7 @@ void BroadcastFilelist::handle_request()
 			auto get_file_message = std::make_shared<GetFile>(storage_, peers.front(), file);
 			get_file_message->Attach(weak_from_this());
 
-			dependencies_.emplace_back(std::make_pair(get_file_message, false));
+			add_dependency(get_file_message, false);
 			(*get_file_message.get())();
 		}
 	}
@@ -143,7 +143,7 @@ void BroadcastFilelist::handle_request()
 	{
 		state_ = MESSAGE_STATE::FAILED;
 
-		if(dependencies_.empty())
+		if(get_dependencies().empty())
 		{
 			RequestDestruction();
 		}
@@ -151,7 +151,7 @@ void BroadcastFilelist::handle_request()
 		return;
 	}
 
-	const auto new_message = std::make_shared<Message>(Message::create_request("broadcast_filelist", peers));
+	const auto new_message = std::make_shared<Message>(Message::create_request(MessageType::BROADCAST_FILELIST, peers));
 
 	new_message->set_filelist(file_list);
 
@@ -165,7 +165,7 @@ void BroadcastFilelist::handle_request()
 	Notify(request);
 	state_ = MESSAGE_STATE::DONE;
 
-	if(dependencies_.empty())
+	if(get_dependencies().empty())
 	{
 		RequestDestruction();
 	}
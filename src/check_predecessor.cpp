@@ -44,7 +44,7 @@ void CheckPredecessor::create_request()
 		return;
 	}
 
-	auto notify_message = std::make_shared<Message>(Message::create_request("check_predecessor"));
+	auto notify_message = std::make_shared<Message>(Message::create_request(MessageType::CHECK_PREDECESSOR));
 	auto transaction_id = notify_message->get_transaction_id();
 
 	auto handler = std::bind(&CheckPredecessor::handle_response, this, std::placeholders::_1);
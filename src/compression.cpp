@@ -0,0 +1,36 @@
+#include "peerpaste/compression.hpp"
+
+#include <zlib.h>
+
+namespace peerpaste
+{
+
+bool compress(const char *data, size_t size, int level, std::string &out)
+{
+	if(size == 0)
+	{
+		return false;
+	}
+
+	out.resize(compressBound(size));
+	uLongf out_size = out.size();
+	if(compress2(reinterpret_cast<Bytef *>(out.data()), &out_size, reinterpret_cast<const Bytef *>(data), size, level) !=
+			 Z_OK ||
+		 out_size >= size)
+	{
+		return false;
+	}
+
+	out.resize(out_size);
+	return true;
+}
+
+bool decompress(const char *data, size_t size, char *out, size_t out_size)
+{
+	uLongf decoded_size = out_size;
+	return uncompress(reinterpret_cast<Bytef *>(out), &decoded_size, reinterpret_cast<const Bytef *>(data), size) ==
+					 Z_OK &&
+				 decoded_size == out_size;
+}
+
+} // namespace peerpaste
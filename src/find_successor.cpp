@@ -3,14 +3,14 @@
 namespace peerpaste::message
 {
 
-FindSuccessor::FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const std::string &id)
+FindSuccessor::FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const NodeId &id)
 	: MessagingBase(MessageType::FIND_SUCCESSOR)
 	, id_(id)
 	, routing_table_(routing_table)
 {
 }
 
-FindSuccessor::FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const Peer &target, const std::string &id)
+FindSuccessor::FindSuccessor(ConcurrentRoutingTable<Peer> *routing_table, const Peer &target, const NodeId &id)
 	: MessagingBase(MessageType::FIND_SUCCESSOR)
 	, id_(id)
 	, target_(target)
@@ -57,7 +57,8 @@ void FindSuccessor::create_request()
 		}
 	}
 
-	auto find_succ_request = std::make_shared<Message>(Message::create_request("find_successor", {Peer(id_, "", "")}));
+	auto find_succ_request =
+		std::make_shared<Message>(Message::create_request(MessageType::FIND_SUCCESSOR, {Peer(id_, "", "")}));
 	auto transaction_id = find_succ_request->generate_transaction_id();
 
 	auto handler = std::bind(&FindSuccessor::handle_response, this, std::placeholders::_1);
@@ -133,7 +134,7 @@ void FindSuccessor::forward_request()
 
 	std::shared_ptr<Peer> successor_predecessor = closest_preceding_node(id);
 	auto new_request =
-		std::make_shared<Message>(Message::create_request("find_successor", {message->get_peers().front()}));
+		std::make_shared<Message>(Message::create_request(MessageType::FIND_SUCCESSOR, {message->get_peers().front()}));
 	auto transaction_id = new_request->generate_transaction_id();
 
 	// Request that requests successor from another peer
@@ -196,7 +197,7 @@ void FindSuccessor::handle_failed()
 	set_promise({});
 }
 
-std::unique_ptr<Peer> FindSuccessor::find_successor(const std::string &id) const
+std::unique_ptr<Peer> FindSuccessor::find_successor(const NodeId &id) const
 {
 	Peer self;
 	if(not routing_table_->try_get_self(self))
@@ -239,24 +240,15 @@ std::unique_ptr<Peer> FindSuccessor::find_successor(const std::string &id) const
 	}
 }
 
-std::unique_ptr<Peer> FindSuccessor::closest_preceding_node(const std::string &id) const
+std::unique_ptr<Peer> FindSuccessor::closest_preceding_node(const NodeId &id) const
 {
-	Peer self;
-	if(not routing_table_->try_get_self(self))
+	auto predecessor = std::make_unique<Peer>();
+	if(not routing_table_->try_get_closest_preceding(id, *predecessor))
 	{
 		spdlog::warn("Cant find closest_preceding_node, self was not set");
 		return nullptr;
 	}
-	auto peers = routing_table_->get_peers();
-	for(int i = peers.size() - 1; i >= 0; i--)
-	{
-		std::string peer_id = peers.at(i).get_id();
-		if(util::between(self.get_id(), peer_id, id))
-		{
-			return std::make_unique<Peer>(peers.at(i));
-		}
-	}
-	return std::make_unique<Peer>(self);
+	return predecessor;
 }
 
 } // namespace peerpaste::message
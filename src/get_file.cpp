@@ -1,5 +1,9 @@
 #include "peerpaste/messages/get_file.hpp"
 
+#include <sys/stat.h>
+
+#include <algorithm>
+
 namespace peerpaste::message
 {
 
@@ -45,7 +49,7 @@ void GetFile::create_request()
 	}
 
 	const auto message = std::make_shared<Message>();
-	message->set_header(Header(true, 0, 0, "get_file", "", "", ""));
+	message->set_header(Header(true, 0, 0, MessageType::GET_FILE, TransactionId{}, "", ""));
 
 	const auto transaction_id = message->generate_transaction_id();
 
@@ -90,7 +94,7 @@ void GetFile::handle_request()
 
 		auto message = request_.value().get_message();
 
-		const auto file_infos = message->get_files();
+		const auto &file_infos = message->get_files();
 		const auto file_info = file_infos.front();
 
 		if(!storage_->exists(file_info))
@@ -101,9 +105,9 @@ void GetFile::handle_request()
 			return;
 		}
 
-		auto source_file = storage_->read_file(file_info);
+		auto source_file = storage_->open_file(file_info);
 
-		if(!source_file.has_value())
+		if(source_file == nullptr)
 		{
 			spdlog::error("Cant read file");
 			state_ = MESSAGE_STATE::FAILED;
@@ -111,11 +115,19 @@ void GetFile::handle_request()
 			return;
 		}
 
-		m_source_file = std::move(source_file.value());
+		struct stat source_stat;
+		if(::fstat(*source_file, &source_stat) != 0)
+		{
+			spdlog::error("Cant read file size");
+			state_ = MESSAGE_STATE::FAILED;
+			RequestDestruction();
+			return;
+		}
 
-		m_source_file.seekg(0, m_source_file.end);
-		const auto file_size = m_source_file.tellg();
-		m_source_file.seekg(file_info.offset, m_source_file.beg);
+		m_source_file = std::move(source_file);
+		const size_t file_size = source_stat.st_size;
+		m_source_size = file_size;
+		m_source_offset = std::min(static_cast<size_t>(file_info.offset), file_size);
 
 		spdlog::info("Start sending file: {}", file_info.file_name);
 		spdlog::debug("FileSize: {}, Sha256sum: {}", file_size, file_infos.front().sha256sum);
@@ -134,7 +146,15 @@ void GetFile::handle_response(RequestObject request_object)
 		return;
 	}
 
-	const auto file_chunk = request_object.get_message()->get_file_chunk();
+	const auto &file_chunk = request_object.get_message()->get_file_chunk();
+
+	if(!file_chunk.has_value())
+	{
+		spdlog::error("GetFile::handle_response got no file chunk");
+		state_ = MESSAGE_STATE::FAILED;
+		RequestDestruction();
+		return;
+	}
 
 	if(!m_output_file.value())
 	{
@@ -175,15 +195,15 @@ void GetFile::handle_failed()
 	state_ = MESSAGE_STATE::FAILED;
 }
 
-void GetFile::write_buffer(size_t offset /* = 0 */)
+void GetFile::write_buffer(size_t offset, size_t size)
 {
 	time_point_ = std::chrono::system_clock::now() + DURATION;
 	auto response = request_->get_message()->generate_response();
-	response->set_file_chunk(peerpaste::FileChunk{m_buf.data(), static_cast<size_t>(m_source_file.gcount()), offset});
 	response->generate_transaction_id();
 
 	auto response_object = RequestObject(request_.value());
 	response_object.set_message(response);
+	response_object.set_file_range(FileRange{m_source_file, offset, size});
 	//response_object.set_on_write_handler(std::bind(&GetFile::write_file, this, std::placeholders::_1));
 
 	response_object.set_on_write_handler([weak = weak_from_this()](bool failed)
@@ -217,24 +237,22 @@ void GetFile::write_file(bool failed)
 	  state_ = MESSAGE_STATE::FAILED;
 		spdlog::debug("GetFile::write_file error occured");
 		RequestDestruction();
+		return;
 	}
 
-	if(m_source_file)
+	if(m_source_file != nullptr)
 	{
-		const size_t offset = m_source_file.tellg();
-		m_source_file.read(m_buf.data(), m_buf.size());
+		const size_t offset = m_source_offset;
+		const size_t size = std::min(m_chunk_size, m_source_size - offset);
+		m_source_offset += size;
 
-		if(m_source_file.fail() && !m_source_file.eof())
-		{
-			state_ = MESSAGE_STATE::FAILED;
-			spdlog::debug("GetFile::handle_request Failed reading file");
+		write_buffer(offset, size);
 
-			//TODO: send "abort filetransfer message"
-			RequestDestruction();
-			return;
+		// the last chunk ends the transfer, for an empty file it is empty
+		if(m_source_offset == m_source_size)
+		{
+			m_source_file.reset();
 		}
-
-		write_buffer(offset);
 	}
 }
 
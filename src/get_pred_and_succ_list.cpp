@@ -43,7 +43,7 @@ void GetPredAndSuccList::create_request()
 		return;
 	}
 
-	auto get_predecessor_msg = std::make_shared<Message>(Message::create_request("get_predecessor_and_succ_list"));
+	auto get_predecessor_msg = std::make_shared<Message>(Message::create_request(MessageType::GET_PRED_AND_SUCC_LIST));
 
 	auto transaction_id = get_predecessor_msg->get_transaction_id();
 
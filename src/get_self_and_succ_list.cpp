@@ -43,7 +43,8 @@ void GetSelfAndSuccList::create_request()
 		return;
 	}
 
-	auto get_successor_list_request = std::make_shared<Message>(Message::create_request("get_self_and_successor_list"));
+	auto get_successor_list_request =
+		std::make_shared<Message>(Message::create_request(MessageType::GET_SELF_AND_SUCC_LIST));
 
 	auto transaction_id = get_successor_list_request->get_transaction_id();
 
@@ -41,7 +41,8 @@ void GetSuccessorList::create_request()
 		return;
 	}
 
-	const auto get_successor_list_request = std::make_shared<Message>(Message::create_request("get_successor_list"));
+	const auto get_successor_list_request =
+		std::make_shared<Message>(Message::create_request(MessageType::GET_SUCCESSOR_LIST));
 
 	const auto transaction_id = get_successor_list_request->get_transaction_id();
 
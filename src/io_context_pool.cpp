@@ -0,0 +1,103 @@
+#include "peerpaste/io_context_pool.hpp"
+
+#include <spdlog/spdlog.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+
+namespace peerpaste
+{
+
+IoContextPool::IoContextPool(unsigned thread_count, IoMode mode)
+	: mode_(mode)
+	, thread_count_(thread_count ? thread_count : std::max(1u, std::thread::hardware_concurrency()))
+{
+	const unsigned context_count = mode_ == IoMode::PER_CORE ? thread_count_ : 1;
+	io_contexts_.reserve(context_count);
+	work_guards_.reserve(context_count);
+
+	for(unsigned i = 0; i < context_count; ++i)
+	{
+		// a context driven by a single thread does not need internal locking
+		io_contexts_.push_back(std::make_unique<boost::asio::io_context>(mode_ == IoMode::PER_CORE ? 1 : thread_count_));
+		work_guards_.push_back(boost::asio::make_work_guard(*io_contexts_.back()));
+	}
+}
+
+IoContextPool::~IoContextPool()
+{
+	stop();
+	join();
+}
+
+boost::asio::io_context &IoContextPool::get_io_context()
+{
+	return *io_contexts_[next_++ % io_contexts_.size()];
+}
+
+boost::asio::io_context &IoContextPool::get_io_context(size_t index)
+{
+	return *io_contexts_.at(index);
+}
+
+size_t IoContextPool::size() const
+{
+	return io_contexts_.size();
+}
+
+unsigned IoContextPool::get_thread_count() const
+{
+	return thread_count_;
+}
+
+IoMode IoContextPool::get_mode() const
+{
+	return mode_;
+}
+
+void IoContextPool::run()
+{
+	threads_.reserve(thread_count_);
+	for(unsigned i = 0; i < thread_count_; ++i)
+	{
+		auto &io_context = *io_contexts_[i % io_contexts_.size()];
+		threads_.emplace_back([&io_context] { io_context.run(); });
+
+#ifdef __linux__
+		if(mode_ == IoMode::PER_CORE)
+		{
+			cpu_set_t cpu_set;
+			CPU_ZERO(&cpu_set);
+			CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &cpu_set);
+			if(pthread_setaffinity_np(threads_.back().native_handle(), sizeof(cpu_set_t), &cpu_set) != 0)
+			{
+				spdlog::debug("IoContextPool could not pin thread {} to its core", i);
+			}
+		}
+#endif
+	}
+}
+
+void IoContextPool::stop()
+{
+	work_guards_.clear();
+	for(auto &io_context : io_contexts_)
+	{
+		io_context->stop();
+	}
+}
+
+void IoContextPool::join()
+{
+	for(auto &thread : threads_)
+	{
+		if(thread.joinable())
+		{
+			thread.join();
+		}
+	}
+	threads_.clear();
+}
+
+} // namespace peerpaste
@@ -0,0 +1,395 @@
+#include "peerpaste/io_uring_context.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace peerpaste
+{
+
+namespace
+{
+
+template<typename T>
+T load_acquire(T *ptr)
+{
+	return std::atomic_ref<T>(*ptr).load(std::memory_order_acquire);
+}
+
+template<typename T>
+void store_release(T *ptr, T value)
+{
+	std::atomic_ref<T>(*ptr).store(value, std::memory_order_release);
+}
+
+template<typename T>
+T *offset(void *base, unsigned off)
+{
+	return reinterpret_cast<T *>(static_cast<uint8_t *>(base) + off);
+}
+
+} // namespace
+
+std::unique_ptr<IoUringContext> IoUringContext::create(unsigned entries)
+{
+	std::unique_ptr<IoUringContext> context{new IoUringContext()};
+	if(!context->setup(entries) || !context->probe() || !context->setup_recv_buffers())
+	{
+		return nullptr;
+	}
+
+	return context;
+}
+
+IoUringContext::~IoUringContext()
+{
+	stop();
+	join();
+
+	// handlers keep their sessions alive, release them while the ring still exists
+	handlers_.clear();
+
+	if(ring_fd_ >= 0)
+	{
+		close(ring_fd_);
+	}
+	if(event_fd_ >= 0)
+	{
+		close(event_fd_);
+	}
+	if(sqes_ != nullptr)
+	{
+		munmap(sqes_, sqes_size_);
+	}
+	if(cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+	{
+		munmap(cq_ring_, cq_ring_size_);
+	}
+	if(sq_ring_ != nullptr)
+	{
+		munmap(sq_ring_, sq_ring_size_);
+	}
+	if(buf_ring_ != nullptr)
+	{
+		munmap(buf_ring_, buf_ring_size_);
+	}
+}
+
+bool IoUringContext::setup(unsigned entries)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+	if(ring_fd_ < 0)
+	{
+		spdlog::warn("IoUringContext could not set up io_uring: {}", std::strerror(errno));
+		return false;
+	}
+
+	if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP))
+	{
+		spdlog::warn("IoUringContext: kernel io_uring is too old");
+		return false;
+	}
+
+	sq_ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+													 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+	if(sq_ring_ == MAP_FAILED)
+	{
+		sq_ring_ = nullptr;
+		return false;
+	}
+	cq_ring_ = sq_ring_;
+	cq_ring_size_ = sq_ring_size_;
+
+	sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED)
+	{
+		return false;
+	}
+	sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+	sq_head_ = offset<unsigned>(sq_ring_, params.sq_off.head);
+	sq_tail_ = offset<unsigned>(sq_ring_, params.sq_off.tail);
+	sq_array_ = offset<unsigned>(sq_ring_, params.sq_off.array);
+	sq_mask_ = *offset<unsigned>(sq_ring_, params.sq_off.ring_mask);
+	sq_entries_ = params.sq_entries;
+	sq_local_tail_ = *sq_tail_;
+
+	cq_head_ = offset<unsigned>(cq_ring_, params.cq_off.head);
+	cq_tail_ = offset<unsigned>(cq_ring_, params.cq_off.tail);
+	cq_mask_ = *offset<unsigned>(cq_ring_, params.cq_off.ring_mask);
+	cqes_ = offset<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+
+	event_fd_ = eventfd(0, EFD_CLOEXEC);
+	return event_fd_ >= 0;
+}
+
+bool IoUringContext::probe()
+{
+	// multishot receives are not listed, they came with kernel 6.0 like zero copy sends
+	constexpr unsigned op_count = IORING_OP_SENDMSG_ZC + 1;
+	std::vector<uint8_t> buffer(sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op));
+	auto *probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+
+	if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE, probe, op_count) < 0 ||
+		 probe->last_op < IORING_OP_SEND_ZC || !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+	{
+		spdlog::warn("IoUringContext: kernel does not support zero copy sends and multishot receives");
+		return false;
+	}
+
+	supports_zero_copy_send_ =
+		probe->last_op >= IORING_OP_SENDMSG_ZC && (probe->ops[IORING_OP_SENDMSG_ZC].flags & IO_URING_OP_SUPPORTED);
+	return true;
+}
+
+bool IoUringContext::setup_recv_buffers()
+{
+	buf_ring_size_ = RECV_BUFFER_COUNT * sizeof(io_uring_buf);
+	void *ring = mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if(ring == MAP_FAILED)
+	{
+		return false;
+	}
+	buf_ring_ = static_cast<io_uring_buf_ring *>(ring);
+
+	io_uring_buf_reg reg;
+	std::memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+	reg.ring_entries = RECV_BUFFER_COUNT;
+	reg.bgid = BUFFER_GROUP;
+	if(syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		spdlog::warn("IoUringContext could not register receive buffers: {}", std::strerror(errno));
+		return false;
+	}
+
+	recv_buffers_ = std::make_unique<uint8_t[]>(RECV_BUFFER_COUNT * RECV_BUFFER_SIZE);
+	for(unsigned i = 0; i < RECV_BUFFER_COUNT; ++i)
+	{
+		recycle_recv_buffer(static_cast<uint16_t>(i));
+	}
+	return true;
+}
+
+void IoUringContext::run()
+{
+	running_ = true;
+	thread_ = std::thread([this] { loop(); });
+}
+
+void IoUringContext::stop()
+{
+	if(running_.exchange(false))
+	{
+		const uint64_t value = 1;
+		[[maybe_unused]] const auto written = write(event_fd_, &value, sizeof(value));
+	}
+}
+
+void IoUringContext::join()
+{
+	if(thread_.joinable())
+	{
+		thread_.join();
+	}
+}
+
+void IoUringContext::post(std::function<void()> fn)
+{
+	{
+		std::scoped_lock lk{posted_mutex_};
+		posted_.push_back(std::move(fn));
+	}
+
+	// one wakeup is enough for everything posted until the ring thread handled it
+	if(!wakeup_pending_.exchange(true))
+	{
+		const uint64_t value = 1;
+		[[maybe_unused]] const auto written = write(event_fd_, &value, sizeof(value));
+	}
+}
+
+uint64_t IoUringContext::submit(const Prepare &prepare, Handler handler)
+{
+	const uint64_t id = next_id_++;
+	auto &sqe = next_sqe();
+	prepare(sqe);
+	sqe.user_data = id;
+	publish_sqe();
+	handlers_.emplace(id, std::move(handler));
+	return id;
+}
+
+void IoUringContext::cancel(uint64_t id)
+{
+	auto &sqe = next_sqe();
+	sqe.opcode = IORING_OP_ASYNC_CANCEL;
+	sqe.fd = -1;
+	sqe.addr = id;
+	sqe.user_data = IGNORED_ID;
+	publish_sqe();
+}
+
+uint16_t IoUringContext::get_buffer_group() const
+{
+	return BUFFER_GROUP;
+}
+
+const uint8_t *IoUringContext::get_recv_buffer(uint16_t id) const
+{
+	return recv_buffers_.get() + static_cast<size_t>(id) * RECV_BUFFER_SIZE;
+}
+
+void IoUringContext::recycle_recv_buffer(uint16_t id)
+{
+	// The flexible array of io_uring_buf_ring does not translate to C++ with
+	// every compiler, so entries are addressed directly. The tail overlays
+	// the reserved field of the first entry.
+	auto *bufs = reinterpret_cast<io_uring_buf *>(buf_ring_);
+	auto &buf = bufs[buf_ring_tail_ & (RECV_BUFFER_COUNT - 1)];
+	buf.addr = reinterpret_cast<uint64_t>(get_recv_buffer(id));
+	buf.len = RECV_BUFFER_SIZE;
+	buf.bid = id;
+	++buf_ring_tail_;
+	store_release(&bufs[0].resv, buf_ring_tail_);
+}
+
+bool IoUringContext::supports_zero_copy_send() const
+{
+	return supports_zero_copy_send_;
+}
+
+int IoUringContext::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	const auto ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0));
+	if(ret > 0)
+	{
+		to_submit_ -= std::min(to_submit_, static_cast<unsigned>(ret));
+	}
+	return ret;
+}
+
+io_uring_sqe &IoUringContext::next_sqe()
+{
+	// the submission queue is full, hand the queued entries to the kernel first
+	while(sq_local_tail_ - load_acquire(sq_head_) >= sq_entries_)
+	{
+		if(enter(to_submit_, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			spdlog::error("IoUringContext could not submit: {}", std::strerror(errno));
+		}
+		reap();
+	}
+
+	const unsigned index = sq_local_tail_ & sq_mask_;
+	auto &sqe = sqes_[index];
+	std::memset(&sqe, 0, sizeof(sqe));
+	sq_array_[index] = index;
+	return sqe;
+}
+
+void IoUringContext::publish_sqe()
+{
+	++sq_local_tail_;
+	++to_submit_;
+	store_release(sq_tail_, sq_local_tail_);
+}
+
+void IoUringContext::loop()
+{
+	arm_wakeup();
+
+	while(running_)
+	{
+		run_posted();
+
+		// submits the whole batch and waits for at least one completion
+		if(enter(to_submit_, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			spdlog::error("IoUringContext io_uring_enter failed: {}", std::strerror(errno));
+			break;
+		}
+
+		reap();
+	}
+}
+
+void IoUringContext::arm_wakeup()
+{
+	auto &sqe = next_sqe();
+	sqe.opcode = IORING_OP_READ;
+	sqe.fd = event_fd_;
+	sqe.addr = reinterpret_cast<uint64_t>(&wakeup_value_);
+	sqe.len = sizeof(wakeup_value_);
+	sqe.user_data = WAKEUP_ID;
+	publish_sqe();
+}
+
+void IoUringContext::run_posted()
+{
+	std::vector<std::function<void()>> posted;
+	{
+		std::scoped_lock lk{posted_mutex_};
+		posted.swap(posted_);
+	}
+
+	for(auto &fn : posted)
+	{
+		fn();
+	}
+}
+
+void IoUringContext::reap()
+{
+	unsigned head = *cq_head_;
+	while(head != load_acquire(cq_tail_))
+	{
+		const io_uring_cqe cqe = cqes_[head & cq_mask_];
+		++head;
+		store_release(cq_head_, head);
+		dispatch(cqe);
+	}
+}
+
+void IoUringContext::dispatch(const io_uring_cqe &cqe)
+{
+	if(cqe.user_data == IGNORED_ID)
+	{
+		return;
+	}
+
+	if(cqe.user_data == WAKEUP_ID)
+	{
+		wakeup_pending_ = false;
+		arm_wakeup();
+		return;
+	}
+
+	const auto search = handlers_.find(cqe.user_data);
+	if(search == handlers_.end())
+	{
+		return;
+	}
+
+	if(cqe.flags & IORING_CQE_F_MORE)
+	{
+		search->second(cqe);
+		return;
+	}
+
+	auto handler = std::move(search->second);
+	handlers_.erase(search);
+	handler(cqe);
+}
+
+} // namespace peerpaste
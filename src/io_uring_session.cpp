@@ -0,0 +1,772 @@
+#include "peerpaste/io_uring_session.hpp"
+#include "peerpaste/boost_session.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+using boost::asio::ip::tcp;
+
+namespace
+{
+
+// Below this size the kernel copies the data faster than it pins the pages
+// and sends the extra notification of a zero copy send
+constexpr size_t MIN_ZERO_COPY_SIZE = 64 * 1024;
+
+} // namespace
+
+IoUringSession::IoUringSession(peerpaste::IoUringContext &ring,
+															 boost::asio::io_context &io_context,
+															 std::shared_ptr<ReceiveQueue> msg_queue)
+	: ring_(ring)
+	, io_context_(io_context)
+	, timer_strand_(io_context)
+	, resolver_(io_context)
+	, is_connected_(false)
+	, timeout_timer_(io_context)
+	, last_activity_(std::chrono::steady_clock::now())
+{
+	msg_queue_ = std::move(msg_queue);
+}
+
+IoUringSession::IoUringSession(peerpaste::IoUringContext &ring,
+															 boost::asio::io_context &io_context,
+															 std::shared_ptr<ReceiveQueue> msg_queue,
+															 tcp::socket socket)
+	: IoUringSession(ring, io_context, std::move(msg_queue))
+{
+	boost::system::error_code ec;
+	const auto endpoint = socket.remote_endpoint(ec);
+	if(!ec)
+	{
+		remote_endpoint_ = endpoint;
+	}
+
+	// the ring waits for readiness itself, so the socket stays blocking
+	const int fd = socket.release(ec);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	fd_ = fd;
+	is_connected_ = true;
+}
+
+IoUringSession::~IoUringSession()
+{
+	const int fd = fd_;
+	if(fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+void IoUringSession::stop()
+{
+	if(!is_open_.exchange(false))
+	{
+		return;
+	}
+
+	// Shutting the socket down completes the operations pending on it,
+	// the descriptor is closed once the last of them released the session
+	const int fd = fd_;
+	if(fd >= 0)
+	{
+		shutdown(fd, SHUT_RDWR);
+	}
+	ring_.post([me = shared_from_this()]() {
+		// shutdown does not complete a connect still in progress
+		if(me->is_connecting_)
+		{
+			me->ring_.cancel(me->connect_id_);
+		}
+		// a send in progress fails with the socket and takes the queued frames with it
+		if(me->send_packet_queue.empty())
+		{
+			me->fail_queued_frames();
+		}
+		me->fail_blocked_frames();
+	});
+}
+
+bool IoUringSession::is_open() const
+{
+	return is_open_;
+}
+
+std::string IoUringSession::get_client_ip() const
+{
+	// empty before the connection got established
+	std::lock_guard lock(remote_endpoint_mutex_);
+	return remote_endpoint_.has_value() ? remote_endpoint_->address().to_string() : std::string{};
+}
+
+SendQueueMetrics IoUringSession::get_send_queue_metrics() const
+{
+	return send_queue_limiter_.get_metrics();
+}
+
+void IoUringSession::set_send_limits(const SendLimits &limits)
+{
+	send_queue_limiter_.set_limits(limits);
+}
+
+void IoUringSession::set_timeouts(const SessionTimeouts &timeouts)
+{
+	boost::asio::post(timer_strand_.wrap([me = shared_from_this(), timeouts]() { me->timeouts_ = timeouts; }));
+}
+
+void IoUringSession::touch()
+{
+	last_activity_ = std::chrono::steady_clock::now();
+}
+
+void IoUringSession::start_timeout_timer()
+{
+	if(is_timer_running_.exchange(true))
+	{
+		return;
+	}
+
+	touch();
+	boost::asio::post(timer_strand_.wrap([me = shared_from_this()]() { me->arm_timeout_timer(); }));
+}
+
+void IoUringSession::arm_timeout_timer()
+{
+	const auto block_timeout = send_queue_limiter_.get_limits().block_timeout;
+	const auto interval = std::min({TIMEOUT_CHECK_INTERVAL, timeouts_.idle / 2, timeouts_.read / 2, block_timeout / 2});
+	timeout_timer_.expires_after(interval);
+	timeout_timer_.async_wait(timer_strand_.wrap(
+		[me = shared_from_this()](const boost::system::error_code &ec) { me->handle_timeout_timer(ec); }));
+}
+
+void IoUringSession::handle_timeout_timer(const boost::system::error_code &ec)
+{
+	if(ec || !is_open_)
+	{
+		return;
+	}
+
+	const auto inactive = std::chrono::steady_clock::now() - last_activity_.load();
+
+	// a paused session holds its partial frame until the dispatcher caught up
+	if(is_frame_pending_ && !is_read_paused_ && inactive > timeouts_.read)
+	{
+		spdlog::debug("IoUringSession read timed out, closing session");
+		stop();
+		return;
+	}
+
+	if(!is_read_paused_ && inactive > timeouts_.idle)
+	{
+		spdlog::debug("IoUringSession is idle, closing session");
+		stop();
+		return;
+	}
+
+	// blocked frames live on the ring thread
+	ring_.post([me = shared_from_this()]() { me->expire_blocked_frames(); });
+	arm_timeout_timer();
+}
+
+void IoUringSession::send_message(DataBuffer message,
+																	SendPolicy policy,
+																	MessagePriority priority,
+																	std::function<void(bool)> on_write)
+{
+	switch(send_queue_limiter_.reserve(message.size(), policy, priority))
+	{
+		case peerpaste::SendQueueLimiter::Reservation::ACCEPTED:
+			ring_.post([me = shared_from_this(), message = std::move(message), priority, on_write]() mutable {
+				me->queue_message(std::move(message), priority, std::move(on_write));
+			});
+			return;
+		case peerpaste::SendQueueLimiter::Reservation::WOULD_BLOCK:
+			// the message waits on the ring thread, the calling thread goes on
+			start_timeout_timer();
+			ring_.post([me = shared_from_this(), message = std::move(message), priority, on_write]() mutable {
+				me->block_message(std::move(message), priority, std::move(on_write));
+			});
+			return;
+		case peerpaste::SendQueueLimiter::Reservation::DROPPED:
+			spdlog::debug("IoUringSession send queue full, dropped message");
+			break;
+		case peerpaste::SendQueueLimiter::Reservation::CLOSE:
+			spdlog::warn("IoUringSession send queue full, closing slow session");
+			stop();
+			break;
+	}
+
+	if(on_write)
+	{
+		on_write(true);
+	}
+}
+
+void IoUringSession::block_message(DataBuffer message, MessagePriority priority, std::function<void(bool)> on_write)
+{
+	if(!is_open_)
+	{
+		send_queue_limiter_.cancel_blocked(priority);
+		if(on_write)
+		{
+			on_write(true);
+		}
+		return;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + send_queue_limiter_.get_limits().block_timeout;
+	blocked_frames_[static_cast<size_t>(priority)].push_back(BlockedFrame{std::move(message), std::move(on_write), deadline});
+
+	// the queue might have drained since the reservation failed
+	resume_blocked_frames();
+}
+
+void IoUringSession::resume_blocked_frames()
+{
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
+	{
+		auto &blocked = blocked_frames_[priority];
+		while(!blocked.empty()
+					&& send_queue_limiter_.reserve_blocked(blocked.front().payload.size(), static_cast<MessagePriority>(priority)))
+		{
+			auto frame = std::move(blocked.front());
+			blocked.pop_front();
+			queue_message(std::move(frame.payload), static_cast<MessagePriority>(priority), std::move(frame.on_write));
+		}
+	}
+}
+
+void IoUringSession::expire_blocked_frames()
+{
+	// every frame waits for the same timeout, so the oldest one expires first
+	const auto now = std::chrono::steady_clock::now();
+	const auto expired = std::any_of(blocked_frames_.begin(), blocked_frames_.end(), [now](const auto &blocked) {
+		return !blocked.empty() && blocked.front().deadline <= now;
+	});
+
+	if(expired)
+	{
+		spdlog::warn("IoUringSession send queue did not drain in time, closing slow session");
+		stop();
+	}
+}
+
+void IoUringSession::fail_blocked_frames()
+{
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
+	{
+		auto blocked = std::move(blocked_frames_[priority]);
+		blocked_frames_[priority].clear();
+		for(auto &frame : blocked)
+		{
+			send_queue_limiter_.cancel_blocked(static_cast<MessagePriority>(priority));
+			if(frame.on_write)
+			{
+				frame.on_write(true);
+			}
+		}
+	}
+}
+
+void IoUringSession::write(DataBuffer message, SendPolicy policy, MessagePriority priority)
+{
+	send_message(std::move(message), policy, priority);
+}
+
+void IoUringSession::write_direct(DataBuffer message,
+																	const std::function<void(bool)> &handler,
+																	SendPolicy policy,
+																	MessagePriority priority)
+{
+	send_message(std::move(message), policy, priority, handler);
+}
+
+void IoUringSession::write_to(DataBuffer message,
+															const std::string &address,
+															const std::string &port,
+															SendPolicy policy,
+															MessagePriority priority)
+{
+	// messages stay queued until handle_connect starts sending them
+	start_timeout_timer();
+	write(std::move(message), policy, priority);
+
+	auto connect = [me = shared_from_this()](peerpaste::Endpoints endpoints) {
+		me->ring_.post([me, endpoints = std::move(endpoints)]() { me->do_connect(endpoints, 0); });
+	};
+
+	if(auto endpoints = peerpaste::EndpointCache::from_numeric(address, port))
+	{
+		connect(std::move(endpoints.value()));
+		return;
+	}
+
+	if(auto endpoints = BoostSession::get_endpoint_cache().get(address, port))
+	{
+		connect(std::move(endpoints.value()));
+		return;
+	}
+
+	resolver_.async_resolve(
+		address,
+		port,
+		[me = shared_from_this(), connect, address, port](boost::system::error_code ec, tcp::resolver::results_type results) {
+			if(ec)
+			{
+				spdlog::error("IoUringSession::write_to could not resolve {}, reason: {}", address, ec.message());
+				me->stop();
+				return;
+			}
+
+			peerpaste::Endpoints endpoints(results.begin(), results.end());
+			BoostSession::get_endpoint_cache().put(address, port, endpoints);
+			connect(std::move(endpoints));
+		});
+}
+
+void IoUringSession::do_connect(peerpaste::Endpoints endpoints, size_t index)
+{
+	if(!is_open_ || index >= endpoints.size())
+	{
+		stop();
+		return;
+	}
+
+	// a socket that failed to connect cannot be reused for the next endpoint
+	const auto &endpoint = endpoints[index];
+	const int fd = socket(endpoint.protocol().family(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+	const int old_fd = fd_.exchange(fd);
+	if(old_fd >= 0)
+	{
+		close(old_fd);
+	}
+	if(fd < 0)
+	{
+		spdlog::error("IoUringSession could not create socket: {}", std::strerror(errno));
+		stop();
+		return;
+	}
+
+	std::memcpy(&connect_address_, endpoint.data(), endpoint.size());
+	const auto address_size = endpoint.size();
+
+	is_connecting_ = true;
+	connect_id_ = ring_.submit(
+		[this, fd, address_size](io_uring_sqe &sqe) {
+			sqe.opcode = IORING_OP_CONNECT;
+			sqe.fd = fd;
+			sqe.addr = reinterpret_cast<uint64_t>(&connect_address_);
+			sqe.off = address_size;
+		},
+		[me = shared_from_this(), endpoints = std::move(endpoints), index](const io_uring_cqe &cqe) {
+			me->handle_connect(cqe, endpoints, index);
+		});
+}
+
+void IoUringSession::handle_connect(const io_uring_cqe &cqe, peerpaste::Endpoints endpoints, size_t index)
+{
+	is_connecting_ = false;
+	// stopped while connecting, the destructor closes the socket
+	if(!is_open_)
+	{
+		return;
+	}
+
+	if(cqe.res < 0)
+	{
+		if(index + 1 < endpoints.size())
+		{
+			do_connect(std::move(endpoints), index + 1);
+			return;
+		}
+
+		spdlog::error("IoUringSession::write_to could not connect, reason: {}", std::strerror(-cqe.res));
+		stop();
+		return;
+	}
+
+	is_connected_ = true;
+	{
+		std::lock_guard lock(remote_endpoint_mutex_);
+		remote_endpoint_ = endpoints[index];
+	}
+
+	if(read_on_connect_)
+	{
+		do_read();
+	}
+
+	if(has_queued_frames())
+	{
+		start_packet_send();
+	}
+}
+
+void IoUringSession::read()
+{
+	if(is_reading_.exchange(true))
+	{
+		return;
+	}
+
+	start_timeout_timer();
+
+	ring_.post([me = shared_from_this()]() {
+		if(me->is_connected_)
+		{
+			me->do_read();
+		}
+		else
+		{
+			me->read_on_connect_ = true;
+		}
+	});
+}
+
+void IoUringSession::queue_message(DataBuffer message, MessagePriority priority, std::function<void(bool)> on_write)
+{
+	bool write_in_progress = !send_packet_queue.empty();
+
+	OutgoingFrame frame{{}, std::move(message), std::move(on_write), priority};
+	encode_header(frame.header, frame.payload.size());
+	queued_frames_[static_cast<size_t>(priority)].push_back(std::move(frame));
+
+	if(!is_open_)
+	{
+		// a send still in progress fails the frame once it completes
+		if(!write_in_progress)
+		{
+			fail_queued_frames();
+		}
+		return;
+	}
+
+	if(!write_in_progress && is_connected_)
+	{
+		start_packet_send();
+	}
+}
+
+bool IoUringSession::has_queued_frames() const
+{
+	return std::any_of(queued_frames_.begin(), queued_frames_.end(), [](const auto &frames) { return !frames.empty(); });
+}
+
+void IoUringSession::take_queued_frames()
+{
+	// frames of a higher priority overtake the ones not taken for sending yet
+	for(auto &frames : queued_frames_)
+	{
+		while(!frames.empty() && send_packet_queue.size() < max_gathered_frames_)
+		{
+			send_packet_queue.push_back(std::move(frames.front()));
+			frames.pop_front();
+		}
+	}
+}
+
+void IoUringSession::start_packet_send()
+{
+	take_queued_frames();
+
+	frames_in_flight_ = std::min(send_packet_queue.size(), max_gathered_frames_);
+	size_t send_size = 0;
+	for(size_t i = 0; i < frames_in_flight_; ++i)
+	{
+		send_size += send_packet_queue[i].header.size() + send_packet_queue[i].payload.size();
+	}
+
+	// the headers of a zero copy send are kept with its payloads
+	if(send_size >= MIN_ZERO_COPY_SIZE && ring_.supports_zero_copy_send())
+	{
+		zero_copy_buffers_ = std::make_shared<ZeroCopyBuffers>();
+		zero_copy_buffers_->headers.reserve(frames_in_flight_);
+	}
+
+	send_iovecs_.clear();
+	for(size_t i = 0; i < frames_in_flight_; ++i)
+	{
+		auto &frame = send_packet_queue[i];
+		auto *header = &frame.header;
+		if(zero_copy_buffers_)
+		{
+			header = &zero_copy_buffers_->headers.emplace_back(frame.header);
+		}
+		send_iovecs_.push_back({header->data(), header->size()});
+		if(!frame.payload.empty())
+		{
+			send_iovecs_.push_back({frame.payload.data(), frame.payload.size()});
+		}
+	}
+	send_iovec_index_ = 0;
+	submit_gathered_send();
+}
+
+void IoUringSession::submit_gathered_send()
+{
+	const int fd = fd_;
+	std::memset(&send_msg_, 0, sizeof(send_msg_));
+	send_msg_.msg_iov = send_iovecs_.data() + send_iovec_index_;
+	send_msg_.msg_iovlen = send_iovecs_.size() - send_iovec_index_;
+	const auto opcode = zero_copy_buffers_ ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+
+	ring_.submit(
+		[this, fd, opcode](io_uring_sqe &sqe) {
+			sqe.opcode = opcode;
+			sqe.fd = fd;
+			sqe.addr = reinterpret_cast<uint64_t>(&send_msg_);
+			sqe.len = 1;
+			sqe.msg_flags = MSG_NOSIGNAL;
+		},
+		// the handler is kept until the notification of a zero copy send
+		[me = shared_from_this(), buffers = zero_copy_buffers_](const io_uring_cqe &cqe) {
+			if(!(cqe.flags & IORING_CQE_F_NOTIF))
+			{
+				me->handle_gathered_send(cqe);
+			}
+		});
+}
+
+void IoUringSession::handle_gathered_send(const io_uring_cqe &cqe)
+{
+	if(cqe.res <= 0)
+	{
+		spdlog::debug("IoUringSession send failed, reason: {}", std::strerror(-cqe.res));
+		packet_send_done(true);
+		return;
+	}
+
+	// skip what was sent, a short send continues inside an iovec
+	auto sent = static_cast<size_t>(cqe.res);
+	while(send_iovec_index_ < send_iovecs_.size() && sent >= send_iovecs_[send_iovec_index_].iov_len)
+	{
+		sent -= send_iovecs_[send_iovec_index_].iov_len;
+		++send_iovec_index_;
+	}
+	if(sent > 0)
+	{
+		auto &iov = send_iovecs_[send_iovec_index_];
+		iov.iov_base = static_cast<uint8_t *>(iov.iov_base) + sent;
+		iov.iov_len -= sent;
+	}
+
+	if(send_iovec_index_ < send_iovecs_.size())
+	{
+		submit_gathered_send();
+		return;
+	}
+
+	packet_send_done(false);
+}
+
+void IoUringSession::packet_send_done(bool failed)
+{
+	if(!failed)
+	{
+		touch();
+	}
+
+	// payloads sent zero copy stay with the handlers until the kernel let go of them
+	complete_frames(
+		send_packet_queue, frames_in_flight_, failed, zero_copy_buffers_ ? &zero_copy_buffers_->payloads : nullptr);
+	zero_copy_buffers_.reset();
+	frames_in_flight_ = 0;
+
+	if(failed)
+	{
+		// nothing is sent anymore, so the frames still waiting fail as well
+		fail_queued_frames();
+		stop();
+		return;
+	}
+
+	if(!send_packet_queue.empty() || has_queued_frames())
+	{
+		start_packet_send();
+	}
+	// blocked frames are queued behind the ones taken for this send
+	resume_blocked_frames();
+}
+
+void IoUringSession::complete_frames(std::deque<OutgoingFrame> &frames,
+																		size_t count,
+																		bool failed,
+																		std::vector<DataBuffer> *kept_payloads)
+{
+	std::array<size_t, MESSAGE_PRIORITY_COUNT> done_frames{};
+	std::array<size_t, MESSAGE_PRIORITY_COUNT> done_bytes{};
+	for(; count > 0; --count)
+	{
+		const auto priority = static_cast<size_t>(frames.front().priority);
+		++done_frames[priority];
+		done_bytes[priority] += frames.front().payload.size();
+		if(kept_payloads != nullptr)
+		{
+			kept_payloads->push_back(std::move(frames.front().payload));
+		}
+		auto on_write = std::move(frames.front().on_write);
+		frames.pop_front();
+
+		if(on_write)
+		{
+			on_write(failed);
+		}
+	}
+	for(size_t priority = 0; priority < MESSAGE_PRIORITY_COUNT; ++priority)
+	{
+		if(done_frames[priority] > 0)
+		{
+			send_queue_limiter_.release(done_frames[priority], done_bytes[priority], static_cast<MessagePriority>(priority));
+		}
+	}
+}
+
+void IoUringSession::fail_queued_frames()
+{
+	// taken out first, on_write handlers may queue new messages
+	auto frames = std::move(send_packet_queue);
+	send_packet_queue.clear();
+	for(auto &queued : queued_frames_)
+	{
+		std::move(queued.begin(), queued.end(), std::back_inserter(frames));
+		queued.clear();
+	}
+
+	complete_frames(frames, frames.size(), true);
+}
+
+void IoUringSession::do_read()
+{
+	if(!is_open_)
+	{
+		return;
+	}
+
+	// one multishot receive keeps delivering data until it gets cancelled
+	const int fd = fd_;
+	const auto buffer_group = ring_.get_buffer_group();
+	is_recv_armed_ = true;
+	recv_id_ = ring_.submit(
+		[fd, buffer_group](io_uring_sqe &sqe) {
+			sqe.opcode = IORING_OP_RECV;
+			sqe.fd = fd;
+			sqe.ioprio = IORING_RECV_MULTISHOT;
+			sqe.flags = IOSQE_BUFFER_SELECT;
+			sqe.buf_group = buffer_group;
+		},
+		[me = shared_from_this()](const io_uring_cqe &cqe) { me->handle_recv(cqe); });
+}
+
+void IoUringSession::handle_recv(const io_uring_cqe &cqe)
+{
+	if(!(cqe.flags & IORING_CQE_F_MORE))
+	{
+		is_recv_armed_ = false;
+	}
+
+	if(cqe.res > 0)
+	{
+		const auto buffer_id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		touch();
+		consume(ring_.get_recv_buffer(buffer_id), static_cast<size_t>(cqe.res));
+		ring_.recycle_recv_buffer(buffer_id);
+	}
+	// running out of provided buffers or pausing only ends the multishot receive
+	else if(cqe.res != -ENOBUFS && cqe.res != -ECANCELED)
+	{
+		spdlog::debug("IoUringSession read failed, reason: {}", cqe.res == 0 ? "end of file" : std::strerror(-cqe.res));
+		stop();
+		return;
+	}
+
+	if(msg_queue_->is_full())
+	{
+		pause_reading();
+		return;
+	}
+
+	if(!is_recv_armed_ && !is_read_paused_)
+	{
+		do_read();
+	}
+}
+
+void IoUringSession::consume(const uint8_t *data, size_t size)
+{
+	auto &pool = *BoostSession::get_buffer_pool();
+
+	while(size > 0)
+	{
+		if(frame_decoder_.has_partial_frame())
+		{
+			const auto [frame_data, remaining] = frame_decoder_.partial_remaining();
+			const auto count = std::min(size, remaining);
+			std::memcpy(frame_data, data, count);
+			frame_decoder_.commit_partial(count);
+			data += count;
+			size -= count;
+
+			if(count == remaining)
+			{
+				msg_queue_->push(std::make_pair(frame_decoder_.take_partial_frame(), shared_from_this()));
+			}
+			continue;
+		}
+
+		const auto [buffer, space] = frame_decoder_.prepare();
+		const auto count = std::min(size, space);
+		std::memcpy(buffer, data, count);
+		frame_decoder_.commit(count);
+		data += count;
+		size -= count;
+
+		// received data cannot be left in the kernel, so frames are pushed even
+		// if that overshoots the high watermark. Reading pauses afterwards.
+		while(auto frame = frame_decoder_.next_frame(pool))
+		{
+			msg_queue_->push(std::make_pair(std::move(frame.value()), shared_from_this()));
+		}
+	}
+
+	is_frame_pending_ = frame_decoder_.buffered() > 0 || frame_decoder_.has_partial_frame();
+}
+
+void IoUringSession::pause_reading()
+{
+	if(is_read_paused_)
+	{
+		return;
+	}
+
+	is_read_paused_ = true;
+	if(is_recv_armed_)
+	{
+		ring_.cancel(recv_id_);
+	}
+
+	msg_queue_->on_drained([me = shared_from_this()]() {
+		me->ring_.post([me]() {
+			me->is_read_paused_ = false;
+			me->touch();
+			if(!me->is_recv_armed_)
+			{
+				me->do_read();
+			}
+		});
+	});
+}
+
+void IoUringSession::encode_header(FrameHeader &buf, unsigned size) const
+{
+	buf[0] = static_cast<uint8_t>((size >> 24) & 0xFF);
+	buf[1] = static_cast<uint8_t>((size >> 16) & 0xFF);
+	buf[2] = static_cast<uint8_t>((size >> 8) & 0xFF);
+	buf[3] = static_cast<uint8_t>(size & 0xFF);
+}
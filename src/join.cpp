@@ -9,7 +9,7 @@ namespace peerpaste::message
 Join::Join(ConcurrentRoutingTable<Peer> *routing_table, const std::string &address, const std::string &port)
 	: MessagingBase(MessageType::JOIN)
 	, routing_table_(routing_table)
-	, target_(Peer("", address, port))
+	, target_(Peer(NodeId{}, address, port))
 {
 	dependencies_.emplace_back(std::make_pair(std::make_shared<Query>(routing_table, address, port), true));
 }
@@ -46,7 +46,7 @@ void Join::HandleNotification(const RequestObject &request_object, HandlerObject
 void Join::HandleNotification()
 {
 	std::scoped_lock lk{mutex_};
-	const auto MessagePtr = dependencies_.front().first;
+	const auto MessagePtr = get_dependencies().front().first;
 
 	if(MessagePtr == nullptr)
 	{
@@ -80,13 +80,13 @@ void Join::handle_query_notify(MessagingBase *MessagePtr)
 {
 	const auto self = dynamic_cast<Query *>(MessagePtr)->get_future().get().value();
 
-	dependencies_.clear();
+	clear_dependencies();
 	time_point_ = std::chrono::system_clock::now() + DURATION;
-	dependencies_.emplace_back(
-		std::make_pair(std::make_shared<FindSuccessor>(routing_table_, target_, self.get_id()), true));
+	const auto find_successor = std::make_shared<FindSuccessor>(routing_table_, target_, self.get_id());
+	add_dependency(find_successor, true);
 
-	dependencies_.front().first->Attach(weak_from_this());
-	(*dependencies_.front().first)();
+	find_successor->Attach(weak_from_this());
+	(*find_successor)();
 }
 
 void Join::handle_find_successor_notify(MessagingBase *MessagePtr)
@@ -94,13 +94,13 @@ void Join::handle_find_successor_notify(MessagingBase *MessagePtr)
 	const auto successor = dynamic_cast<FindSuccessor *>(MessagePtr)->get_future().get().value();
 	routing_table_->set_successor(successor);
 
-	dependencies_.clear();
+	clear_dependencies();
 	time_point_ = std::chrono::system_clock::now() + DURATION;
-	dependencies_.emplace_back(std::make_pair(std::make_shared<GetSuccessorList>(successor), true));
+	const auto get_successor_list = std::make_shared<GetSuccessorList>(successor);
+	add_dependency(get_successor_list, true);
 
-	dependencies_.front().first->Attach(weak_from_this());
-	// dependencies_.front().first->create_request();
-	(*dependencies_.front().first)();
+	get_successor_list->Attach(weak_from_this());
+	(*get_successor_list)();
 }
 
 void Join::handle_get_successor_list_notify(MessagingBase *MessagePtr)
@@ -116,8 +116,9 @@ void Join::handle_get_successor_list_notify(MessagingBase *MessagePtr)
 void Join::create_request()
 {
 	std::scoped_lock lk{mutex_};
-	dependencies_.front().first->Attach(weak_from_this());
-	(*dependencies_.front().first)();
+	const auto query = get_dependencies().front().first;
+	query->Attach(weak_from_this());
+	(*query)();
 }
 
 void Join::handle_request()
@@ -0,0 +1,200 @@
+#include "peerpaste/loopback_session.hpp"
+#include "peerpaste/boost_session.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstring>
+
+namespace peerpaste
+{
+
+void LoopbackNetwork::attach(const std::string &address, const std::string &port, std::shared_ptr<ReceiveQueue> queue)
+{
+	std::scoped_lock lk{mutex_};
+	nodes_.insert_or_assign({address, port}, std::move(queue));
+}
+
+void LoopbackNetwork::detach(const std::string &address, const std::string &port)
+{
+	std::scoped_lock lk{mutex_};
+	nodes_.erase({address, port});
+}
+
+std::shared_ptr<ReceiveQueue> LoopbackNetwork::find(const std::string &address, const std::string &port) const
+{
+	std::scoped_lock lk{mutex_};
+	const auto search = nodes_.find({address, port});
+	if(search == nodes_.end())
+	{
+		return nullptr;
+	}
+	return search->second;
+}
+
+size_t LoopbackNetwork::size() const
+{
+	std::scoped_lock lk{mutex_};
+	return nodes_.size();
+}
+
+LoopbackSession::LoopbackSession(std::shared_ptr<LoopbackNetwork> network,
+																 std::shared_ptr<ReceiveQueue> msg_queue,
+																 std::string local_address)
+	: network_(std::move(network))
+	, local_address_(std::move(local_address))
+{
+	msg_queue_ = std::move(msg_queue);
+}
+
+void LoopbackSession::write(DataBuffer message, SendPolicy policy, MessagePriority)
+{
+	deliver(std::move(message), policy);
+}
+
+void LoopbackSession::write_to(DataBuffer message,
+															 const std::string &address,
+															 const std::string &port,
+															 SendPolicy policy,
+															 MessagePriority)
+{
+	{
+		std::scoped_lock lk{mutex_};
+		if(accepted_peer_ == nullptr && connecting_peer_.expired())
+		{
+			auto queue = network_->find(address, port);
+			if(queue == nullptr)
+			{
+				spdlog::error("LoopbackSession::write_to no node at {}:{}", address, port);
+				is_open_ = false;
+				return;
+			}
+
+			accepted_peer_ = std::make_shared<LoopbackSession>(network_, std::move(queue), address);
+			accepted_peer_->remote_address_ = local_address_;
+			accepted_peer_->connecting_peer_ = weak_from_this();
+			remote_address_ = address;
+		}
+	}
+
+	deliver(std::move(message), policy);
+}
+
+void LoopbackSession::write_direct(DataBuffer message,
+																	 const std::function<void(bool)> &handler,
+																	 SendPolicy policy,
+																	 MessagePriority)
+{
+	handler(!deliver(std::move(message), policy));
+}
+
+void LoopbackSession::read()
+{
+}
+
+std::string LoopbackSession::get_client_ip() const
+{
+	std::scoped_lock lk{mutex_};
+	return remote_address_;
+}
+
+SendQueueMetrics LoopbackSession::get_send_queue_metrics() const
+{
+	SendQueueMetrics metrics;
+	metrics.dropped_frames = dropped_frames_;
+	return metrics;
+}
+
+bool LoopbackSession::is_open() const
+{
+	if(!is_open_)
+	{
+		return false;
+	}
+
+	// the accepting end closes with its connecting end
+	std::scoped_lock lk{mutex_};
+	return accepted_peer_ != nullptr || !connecting_peer_.expired();
+}
+
+void LoopbackSession::close()
+{
+	is_open_ = false;
+	std::scoped_lock lk{mutex_};
+	if(accepted_peer_ != nullptr)
+	{
+		accepted_peer_->is_open_ = false;
+	}
+}
+
+void LoopbackSession::set_send_limits(const SendLimits &limits)
+{
+	std::scoped_lock lk{mutex_};
+	send_limits_ = limits;
+}
+
+std::shared_ptr<LoopbackSession> LoopbackSession::get_peer() const
+{
+	std::scoped_lock lk{mutex_};
+	if(accepted_peer_ != nullptr)
+	{
+		return accepted_peer_;
+	}
+	return connecting_peer_.lock();
+}
+
+bool LoopbackSession::deliver(DataBuffer message, SendPolicy policy)
+{
+	const auto peer = get_peer();
+	if(!is_open_ || peer == nullptr || !peer->is_open_)
+	{
+		return false;
+	}
+
+	// there is no send queue, so a full receive queue of the peer is what
+	// a full send queue would be for a socket
+	if(peer->msg_queue_->is_full())
+	{
+		switch(policy)
+		{
+			case SendPolicy::DROP:
+				++dropped_frames_;
+				return false;
+			case SendPolicy::CLOSE:
+				spdlog::warn("LoopbackSession peer queue full, closing slow session");
+				++dropped_frames_;
+				close();
+				return false;
+			case SendPolicy::BLOCK:
+			{
+				const auto block_timeout = [this] {
+					std::scoped_lock lk{mutex_};
+					return send_limits_.block_timeout;
+				}();
+				if(!peer->msg_queue_->wait_while_full(std::chrono::steady_clock::now() + block_timeout))
+				{
+					spdlog::warn("LoopbackSession peer queue did not drain in time, closing slow session");
+					++dropped_frames_;
+					close();
+					return false;
+				}
+				// either end might have closed while waiting
+				if(!is_open_ || !peer->is_open_)
+				{
+					return false;
+				}
+				break;
+			}
+		}
+	}
+
+	auto buffer = BoostSession::get_buffer_pool()->acquire(message.size());
+	if(!message.empty())
+	{
+		std::memcpy(buffer.data(), message.data(), message.size());
+	}
+	peer->msg_queue_->push(std::make_pair(std::move(buffer), SessionPtr(peer)));
+	return true;
+}
+
+} // namespace peerpaste
@@ -34,7 +34,14 @@ int main(int argc, char **argv)
 		"port,p", po::value<unsigned>(), "Port to listen on")(
 		"join,j", po::value<std::vector<std::string>>()->multitoken()->composing(), "IP and Port of Host to connect to")(
 		"verbose", "show additional information")("create", "create new ring")("log-messages", "log messages to files")(
-		"debug", "Send routing information to localhost");
+		"debug", "Send routing information to localhost")(
+		"threads,t", po::value<unsigned>()->default_value(4), "Number of network threads")(
+		"per-core", "Run one io_context with its own acceptor per network thread")(
+		"io-uring", "Use io_uring for socket io if the kernel supports it")(
+		"no-udp", "Send maintenance requests over tcp instead of udp")(
+		"chunk-compression", po::value<int>()->default_value(0), "zlib level for file chunks, 0 disables it")(
+		"list-compression", po::value<int>()->default_value(6), "zlib level for file lists, 0 disables it")(
+		"loopback-nodes", po::value<unsigned>(), "Run a ring of this many nodes in this process, without sockets");
 
 	po::variables_map vm;
 	try
@@ -104,11 +111,57 @@ int main(int argc, char **argv)
 		/* util::log(message_in, "Ingoing message"); */
 		/////////////////////////////LOGGING
 
+		if(vm.count("loopback-nodes") && vm.count("port") && vm.count("address"))
+		{
+			// node i listens on port + i, all of them join the first one
+			const auto address = vm["address"].as<std::string>();
+			const auto port = vm["port"].as<unsigned>();
+			const auto network = std::make_shared<peerpaste::LoopbackNetwork>();
+			std::vector<std::unique_ptr<peerpaste::PeerPaste>> nodes;
+			for(unsigned i = 0; i < vm["loopback-nodes"].as<unsigned>(); ++i)
+			{
+				auto node = std::make_unique<peerpaste::PeerPaste>();
+				node->init(address, port + i, network);
+				if(i == 0)
+				{
+					node->create_ring();
+				}
+				else
+				{
+					node->join(address, std::to_string(port));
+				}
+				node->run();
+				nodes.push_back(std::move(node));
+			}
+
+			for(auto &node : nodes)
+			{
+				node->wait_till_finish();
+			}
+			return 0;
+		}
+
 		peerpaste::PeerPaste peerpaste;
 
 		if(vm.count("port") && vm.count("address"))
 		{
-			peerpaste.init(vm["address"].as<std::string>(), vm["port"].as<unsigned>(), 4);
+			const auto io_mode = vm.count("per-core") ? peerpaste::IoMode::PER_CORE : peerpaste::IoMode::SHARED;
+			const auto transport = vm.count("io-uring") ? peerpaste::Transport::IO_URING : peerpaste::Transport::ASIO;
+			peerpaste.init(
+				vm["address"].as<std::string>(), vm["port"].as<unsigned>(), vm["threads"].as<unsigned>(), io_mode, transport);
+
+			peerpaste::CompressionOptions compression_options;
+			compression_options.chunk_level = vm["chunk-compression"].as<int>();
+			compression_options.list_level = vm["list-compression"].as<int>();
+			peerpaste.set_compression_options(compression_options);
+
+			if(vm.count("no-udp"))
+			{
+				for(size_t i = 0; i < MESSAGE_TYPE_COUNT; ++i)
+				{
+					peerpaste.set_message_transport(static_cast<MessageType>(i), peerpaste::MessageTransport::TCP);
+				}
+			}
 		}
 		else
 		{
@@ -11,11 +11,65 @@
 #include "peerpaste/messages/notify.hpp"
 #include "peerpaste/messages/query.hpp"
 
+#include <array>
 #include <memory>
+#include <type_traits>
 
 namespace peerpaste::message
 {
 
+namespace
+{
+
+using CreateFunction = std::unique_ptr<MessagingBase> (*)(ConcurrentRoutingTable<Peer> *routing_table,
+																													StaticStorage *storage,
+																													const RequestObject &request);
+
+template<typename Handler>
+std::unique_ptr<MessagingBase> create_handler(ConcurrentRoutingTable<Peer> *routing_table,
+																							StaticStorage *storage,
+																							const RequestObject &request)
+{
+	if constexpr(std::is_constructible_v<Handler, ConcurrentRoutingTable<Peer> *, StaticStorage *, RequestObject>)
+	{
+		return std::make_unique<Handler>(routing_table, storage, request);
+	}
+	else if constexpr(std::is_constructible_v<Handler, StaticStorage *, RequestObject>)
+	{
+		return std::make_unique<Handler>(storage, request);
+	}
+	else
+	{
+		return std::make_unique<Handler>(routing_table, request);
+	}
+}
+
+template<typename Handler>
+constexpr void add_handler(std::array<CreateFunction, MESSAGE_TYPE_COUNT> &handlers, MessageType type)
+{
+	handlers[static_cast<size_t>(type)] = &create_handler<Handler>;
+}
+
+/*
+ * The handlers of incoming requests indexed by MessageType, types without
+ * one are no valid requests
+ */
+constexpr auto REQUEST_HANDLERS = [] {
+	std::array<CreateFunction, MESSAGE_TYPE_COUNT> handlers{};
+	add_handler<Notification>(handlers, MessageType::NOTIFICATION);
+	add_handler<CheckPredecessor>(handlers, MessageType::CHECK_PREDECESSOR);
+	add_handler<Query>(handlers, MessageType::QUERY);
+	add_handler<FindSuccessor>(handlers, MessageType::FIND_SUCCESSOR);
+	add_handler<GetSuccessorList>(handlers, MessageType::GET_SUCCESSOR_LIST);
+	add_handler<GetPredAndSuccList>(handlers, MessageType::GET_PRED_AND_SUCC_LIST);
+	add_handler<GetSelfAndSuccList>(handlers, MessageType::GET_SELF_AND_SUCC_LIST);
+	add_handler<BroadcastFilelist>(handlers, MessageType::BROADCAST_FILELIST);
+	add_handler<GetFile>(handlers, MessageType::GET_FILE);
+	return handlers;
+}();
+
+} // namespace
+
 MessageFactory::MessageFactory(ConcurrentRoutingTable<Peer> *routing_table, StaticStorage *storage)
 	: routing_table_{routing_table}
 	, storage_{storage}
@@ -30,46 +84,14 @@ std::unique_ptr<MessagingBase> MessageFactory::create_from_request(const Request
 		return nullptr;
 	}
 
-	const auto type{request.get_request_type()};
-
-	if(type == "notify")
+	// message types are in range, the converter maps unknown ones to UNKNOWN
+	const auto create = REQUEST_HANDLERS[static_cast<size_t>(request.get_message_type())];
+	if(create == nullptr)
 	{
-		return std::make_unique<Notification>(routing_table_, request);
-	}
-	if(type == "check_predecessor")
-	{
-		return std::make_unique<CheckPredecessor>(routing_table_, request);
-	}
-	if(type == "query")
-	{
-		return std::make_unique<Query>(routing_table_, request);
-	}
-	if(type == "find_successor")
-	{
-		return std::make_unique<FindSuccessor>(routing_table_, request);
-	}
-	if(type == "get_successor_list")
-	{
-		return std::make_unique<GetSuccessorList>(routing_table_, request);
-	}
-	if(type == "get_predecessor_and_succ_list")
-	{
-		return std::make_unique<GetPredAndSuccList>(routing_table_, request);
-	}
-	if(type == "get_self_and_successor_list")
-	{
-		return std::make_unique<GetSelfAndSuccList>(routing_table_, request);
-	}
-	if(type == "broadcast_filelist")
-	{
-		return std::make_unique<BroadcastFilelist>(routing_table_, storage_, request);
-	}
-	if(type == "get_file")
-	{
-		return std::make_unique<GetFile>(storage_, request);
+		return nullptr;
 	}
 
-	return nullptr;
+	return create(routing_table_, storage_, request);
 }
 
 } // namespace peerpaste::message
@@ -14,7 +14,7 @@ MessagingBase::MessagingBase(MessagingBase &&other)
 	, handler_object_(std::move(other.handler_object_))
 	, request_(std::move(other.request_))
 	, dependencies_(std::move(other.dependencies_))
-	, time_point_(std::move(other.time_point_))
+	, time_point_(other.time_point_.load())
 	, is_done_(other.is_done_.load())
 	, is_request_handler_(other.is_request_handler_.load())
 {
@@ -77,7 +77,7 @@ MESSAGE_STATE MessagingBase::get_state() const noexcept
 
 std::chrono::time_point<std::chrono::system_clock> MessagingBase::get_timeout() const
 {
-	return time_point_;
+	return time_point_.load();
 }
 
 MESSAGE_STATE MessagingBase::check_state()
@@ -88,7 +88,7 @@ MESSAGE_STATE MessagingBase::check_state()
 		return state_;
 	}
 
-	if(std::chrono::system_clock::now() > time_point_)
+	if(std::chrono::system_clock::now() > time_point_.load())
 	{
 		spdlog::debug("Message Timed Out, type: {}", static_cast<int>(type_));
 		state_ = MESSAGE_STATE::TIMEDOUT;
@@ -106,7 +106,8 @@ MESSAGE_STATE MessagingBase::check_state()
 		return false;
 	};
 
-	if(std::any_of(dependencies_.begin(), dependencies_.end(), already_timed_out))
+	const auto dependencies = get_dependencies();
+	if(std::any_of(dependencies.begin(), dependencies.end(), already_timed_out))
 	{
 		spdlog::debug("Message Timed Out, type: {}", static_cast<int>(type_));
 		handle_failed();
@@ -119,7 +120,7 @@ MESSAGE_STATE MessagingBase::check_state()
 
 bool MessagingBase::is_timed_out()
 {
-	if(std::chrono::system_clock::now() > time_point_)
+	if(std::chrono::system_clock::now() > time_point_.load())
 	{
 		return true;
 	}
@@ -139,12 +140,37 @@ bool MessagingBase::is_timed_out()
 		return true;
 	};
 
-	std::for_each(dependencies_.begin(), dependencies_.end(), check_time_out);
+	const auto dependencies = get_dependencies();
+	std::for_each(dependencies.begin(), dependencies.end(), check_time_out);
 
 	return removed_essential_dependency;
 }
 
-void MessagingBase::create_handler_object(const std::string &correlation_id, HandlerFunction handler_function, bool is_persistent /* = false */)
+void MessagingBase::add_dependency(std::shared_ptr<MessagingBase> dependency, bool is_essential)
+{
+	std::scoped_lock lk{dependencies_mutex_};
+	dependencies_.emplace_back(std::move(dependency), is_essential);
+}
+
+void MessagingBase::prepend_dependency(std::shared_ptr<MessagingBase> dependency, bool is_essential)
+{
+	std::scoped_lock lk{dependencies_mutex_};
+	dependencies_.emplace(dependencies_.begin(), std::move(dependency), is_essential);
+}
+
+void MessagingBase::clear_dependencies()
+{
+	std::scoped_lock lk{dependencies_mutex_};
+	dependencies_.clear();
+}
+
+std::vector<std::pair<std::shared_ptr<MessagingBase>, bool>> MessagingBase::get_dependencies() const
+{
+	std::scoped_lock lk{dependencies_mutex_};
+	return dependencies_;
+}
+
+void MessagingBase::create_handler_object(TransactionId correlation_id, HandlerFunction handler_function, bool is_persistent /* = false */)
 {
 	handler_object_ =
 		std::make_unique<HandlerObject<HandlerFunction>>(correlation_id, handler_function, shared_from_this(), is_persistent);
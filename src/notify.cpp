@@ -37,7 +37,7 @@ void Notification::create_request()
 		state_ = MESSAGE_STATE::FAILED;
 		return;
 	}
-	if(self.get_id() == "")
+	if(!self.get_id().is_valid())
 	{
 		state_ = MESSAGE_STATE::FAILED;
 		return;
@@ -50,7 +50,7 @@ void Notification::create_request()
 		return;
 	}
 
-	auto notify_message = std::make_shared<Message>(Message::create_request("notify", {self}));
+	auto notify_message = std::make_shared<Message>(Message::create_request(MessageType::NOTIFICATION, {self}));
 	auto transaction_id = notify_message->get_transaction_id();
 
 	auto handler = std::bind(&Notification::handle_response, this, std::placeholders::_1);
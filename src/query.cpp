@@ -6,7 +6,7 @@ namespace peerpaste::message
 Query::Query(ConcurrentRoutingTable<Peer> *routing_table, const std::string &address, const std::string &port)
 	: MessagingBase(MessageType::QUERY)
 	, routing_table_(routing_table)
-	, target_("", address, port)
+	, target_(NodeId{}, address, port)
 {
 }
 
@@ -42,7 +42,7 @@ void Query::create_request()
 	}
 
 	// Generate Query
-	const auto query_request = std::make_shared<Message>(Message::create_request("query", {self}));
+	const auto query_request = std::make_shared<Message>(Message::create_request(MessageType::QUERY, {self}));
 
 	const auto transaction_id = query_request->get_transaction_id();
 
@@ -70,7 +70,7 @@ void Query::handle_request()
 	auto peer = message->get_peers().front();
 	auto client_ip = request_.value().get_client_ip();
 	auto client_port = peer.get_port();
-	auto client_id = util::generate_sha256(client_ip, client_port);
+	auto client_id = NodeId::from_hex(util::generate_sha256(client_ip, client_port));
 	peer.set_ip(client_ip);
 	peer.set_id(client_id);
 
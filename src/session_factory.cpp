@@ -0,0 +1,135 @@
+#include "peerpaste/session_factory.hpp"
+#include "peerpaste/boost_session.hpp"
+#include "peerpaste/loopback_session.hpp"
+
+#ifdef PEERPASTE_HAS_IO_URING
+#include "peerpaste/io_uring_context.hpp"
+#include "peerpaste/io_uring_session.hpp"
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace peerpaste
+{
+
+SessionFactory::SessionFactory(IoContextPool &io_context_pool, std::shared_ptr<ReceiveQueue> queue, Transport transport)
+	: SessionFactory(io_context_pool, std::vector<std::shared_ptr<ReceiveQueue>>{std::move(queue)}, transport)
+{
+}
+
+SessionFactory::SessionFactory(IoContextPool &io_context_pool,
+															 std::vector<std::shared_ptr<ReceiveQueue>> queues,
+															 Transport transport)
+	: io_context_pool_(io_context_pool)
+	, queues_(std::move(queues))
+	, transport_(transport)
+{
+	if(transport_ != Transport::IO_URING)
+	{
+		return;
+	}
+
+#ifdef PEERPASTE_HAS_IO_URING
+	// one ring per io_context, so per core mode gets a ring per core as well
+	for(size_t i = 0; i < io_context_pool_.size(); ++i)
+	{
+		auto context = IoUringContext::create();
+		if(context == nullptr)
+		{
+			io_uring_contexts_.clear();
+			break;
+		}
+		io_uring_contexts_.push_back(std::move(context));
+	}
+#endif
+
+	if(io_uring_contexts_.empty())
+	{
+		spdlog::warn("io_uring is not available, falling back to asio sessions");
+		transport_ = Transport::ASIO;
+	}
+}
+
+SessionFactory::~SessionFactory()
+{
+	stop();
+}
+
+SessionPtr SessionFactory::create()
+{
+	if(transport_ == Transport::LOOPBACK)
+	{
+		return std::make_shared<LoopbackSession>(loopback_network_, next_queue(), loopback_address_);
+	}
+
+	const auto index = next_++ % io_context_pool_.size();
+	auto &io_context = io_context_pool_.get_io_context(index);
+
+#ifdef PEERPASTE_HAS_IO_URING
+	if(transport_ == Transport::IO_URING)
+	{
+		return std::make_shared<IoUringSession>(*io_uring_contexts_[index], io_context, next_queue());
+	}
+#endif
+
+	return std::make_shared<BoostSession>(io_context, next_queue());
+}
+
+SessionPtr SessionFactory::adopt(boost::asio::ip::tcp::socket socket, size_t index)
+{
+	// the session stays on the io_context that accepted the connection
+	auto &io_context = static_cast<boost::asio::io_context &>(socket.get_executor().context());
+
+#ifdef PEERPASTE_HAS_IO_URING
+	if(transport_ == Transport::IO_URING)
+	{
+		// and on the ring of that io_context, so per core mode keeps it on one core
+		auto &ring = *io_uring_contexts_[index % io_uring_contexts_.size()];
+		return std::make_shared<IoUringSession>(ring, io_context, next_queue(), std::move(socket));
+	}
+#endif
+
+	return std::make_shared<BoostSession>(io_context, next_queue(), std::move(socket));
+}
+
+Transport SessionFactory::get_transport() const
+{
+	return transport_;
+}
+
+void SessionFactory::set_loopback_network(std::shared_ptr<LoopbackNetwork> network, std::string local_address)
+{
+	loopback_network_ = std::move(network);
+	loopback_address_ = std::move(local_address);
+}
+
+const std::shared_ptr<ReceiveQueue> &SessionFactory::next_queue()
+{
+	return queues_[next_queue_++ % queues_.size()];
+}
+
+void SessionFactory::run()
+{
+#ifdef PEERPASTE_HAS_IO_URING
+	for(auto &context : io_uring_contexts_)
+	{
+		context->run();
+	}
+#endif
+}
+
+void SessionFactory::stop()
+{
+#ifdef PEERPASTE_HAS_IO_URING
+	for(auto &context : io_uring_contexts_)
+	{
+		context->stop();
+	}
+	for(auto &context : io_uring_contexts_)
+	{
+		context->join();
+	}
+#endif
+}
+
+} // namespace peerpaste
@@ -45,7 +45,7 @@ void Stabilize::HandleNotification(const RequestObject &request_object, HandlerO
 
 void Stabilize::HandleNotification()
 {
-	const auto MessagePtr = dependencies_.front().first;
+	const auto MessagePtr = get_dependencies().front().first;
 
 	if(MessagePtr == nullptr)
 	{
@@ -134,8 +134,8 @@ void Stabilize::handle_get_pred_and_succ_list_notify(MessagingBase *MessagePtr)
 		auto GetSelfAndSuccListMessage = std::make_shared<GetSelfAndSuccList>(successors_predecessor);
 		GetSelfAndSuccListMessage->Attach(weak_from_this());
 
-		dependencies_.emplace(dependencies_.begin(), std::make_pair(std::move(GetSelfAndSuccListMessage), true));
-		(*dependencies_.front().first)();
+		prepend_dependency(GetSelfAndSuccListMessage, true);
+		(*GetSelfAndSuccListMessage)();
 	}
 	else
 	{
@@ -171,8 +171,8 @@ void Stabilize::create_notification()
 	auto NotifyMessage = std::make_shared<Notification>(routing_table_);
 	NotifyMessage->Attach(weak_from_this());
 
-	dependencies_.emplace(dependencies_.begin(), std::make_pair(std::move(NotifyMessage), true));
-	(*dependencies_.front().first)();
+	prepend_dependency(NotifyMessage, true);
+	(*NotifyMessage)();
 }
 
 void Stabilize::create_request()
@@ -190,8 +190,8 @@ void Stabilize::create_request()
 	auto GetPredAndSuccListMessage = std::make_shared<GetPredAndSuccList>(target);
 	GetPredAndSuccListMessage->Attach(weak_from_this());
 
-	dependencies_.emplace(dependencies_.begin(), std::make_pair(std::move(GetPredAndSuccListMessage), true));
-	(*dependencies_.front().first)();
+	prepend_dependency(GetPredAndSuccListMessage, true);
+	(*GetPredAndSuccListMessage)();
 }
 
 void Stabilize::handle_request()
@@ -202,7 +202,7 @@ void Stabilize::handle_response(RequestObject )
 }
 void Stabilize::handle_failed()
 {
-	if(dependencies_.size() == 1)
+	if(get_dependencies().size() == 1)
 	{
 		routing_table_->pop_front();
 	}
@@ -1,6 +1,9 @@
 #include "peerpaste/storage.hpp"
 #include "peerpaste/cryptowrapper.hpp"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 StaticStorage::StaticStorage(const std::string &id)
 	: id_(id)
 	, storage_path_("/tmp/peerpaste/" + id_ + '/')
@@ -187,27 +190,29 @@ bool StaticStorage::finalize_file(const peerpaste::FileInfo& file_info)
 }
 
 
-std::optional<std::ifstream> StaticStorage::read_file(const peerpaste::FileInfo& file_info)
+std::shared_ptr<const int> StaticStorage::open_file(const peerpaste::FileInfo& file_info)
 {
 	const std::string& filename = file_info.file_name;
 
 	if(!exists(filename))
 	{
 		spdlog::debug("Tried reading nonexisting file");
-		return std::nullopt;
+		return nullptr;
 	}
 
-	std::ifstream Input;
-	Input.open(storage_path_ + filename, std::ios_base::binary | std::ios_base::ate);
+	const int fd = ::open((storage_path_ + filename).c_str(), O_RDONLY | O_CLOEXEC);
 
-	if(!Input)
+	if(fd < 0)
 	{
 		spdlog::error("Failed to read file");
 		spdlog::error("{}",storage_path_ + filename);
-		return std::nullopt;
+		return nullptr;
 	}
 
-	return Input;
+	return std::shared_ptr<const int>(new int(fd), [](const int *fd) {
+		::close(*fd);
+		delete fd;
+	});
 }
 
 
@@ -1,41 +1,141 @@
 #include <algorithm>
+#include <cassert>
 
 #include "peerpaste/thread_pool.hpp"
 
+namespace
+{
+// the pool state and deque of the worker running on this thread
+thread_local const void *current_state = nullptr;
+thread_local size_t current_index = 0;
+} // namespace
+
 ThreadPool::ThreadPool(unsigned thread_count)
-	: done_(false)
 {
-	thread_count = thread_count ? thread_count : std::thread::hardware_concurrency();
+	thread_count = thread_count ? thread_count : std::max(std::thread::hardware_concurrency(), 1u);
+	state_.queues.reserve(thread_count);
+	for(unsigned i = 0; i < thread_count; ++i)
+	{
+		state_.queues.push_back(std::make_unique<WorkQueue>());
+	}
+
 	threads_.reserve(thread_count);
 	for(unsigned i = 0; i < thread_count; ++i)
 	{
-		threads_.push_back(std::thread(&ThreadPool::worker_thread, this));
+		threads_.push_back(std::thread(&ThreadPool::worker_thread, std::ref(state_), i));
 	}
 }
 
 ThreadPool::~ThreadPool()
 {
-	done_ = true;
+	stop();
+}
+
+void ThreadPool::stop()
+{
+	// a worker would have to join itself
+	assert(current_state != &state_);
+
+	{
+		std::scoped_lock lk{state_.park_mutex};
+		state_.done = true;
+	}
+	state_.park_condition.notify_all();
 
 	for(auto &thread : threads_)
 	{
-		thread.join();
+		if(thread.joinable())
+		{
+			thread.join();
+		}
 	}
 }
 
-void ThreadPool::worker_thread()
+size_t ThreadPool::size() const
+{
+	return threads_.size();
+}
+
+void ThreadPool::push_task(std::function<void()> task)
 {
-	while(!done_)
+	auto &state = state_;
+	const bool is_worker = current_state == &state;
+
+	// the workers may be gone already, only their own tasks are still taken
+	if(state.done && !is_worker)
+	{
+		return;
+	}
+
+	// counted first, so the task is never popped before it is counted
+	++state.queued;
+
+	const auto index = is_worker ? current_index : state.next_queue++ % state.queues.size();
+	{
+		auto &queue = *state.queues[index];
+		std::scoped_lock lk{queue.mutex};
+		queue.tasks.push_back(std::move(task));
+	}
+
+	// a worker increments parked before it checks queued, so either it
+	// sees the task or it gets woken up here
+	if(state.parked > 0)
+	{
+		std::scoped_lock lk{state.park_mutex};
+		state.park_condition.notify_one();
+	}
+}
+
+bool ThreadPool::pop_task(State &state, size_t index, std::function<void()> &task)
+{
+	{
+		auto &own = *state.queues[index];
+		std::scoped_lock lk{own.mutex};
+		if(!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for(size_t i = 1; i < state.queues.size(); ++i)
+	{
+		auto &victim = *state.queues[(index + i) % state.queues.size()];
+		std::scoped_lock lk{victim.mutex};
+		if(!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ThreadPool::worker_thread(State &state, size_t index)
+{
+	current_state = &state;
+	current_index = index;
+
+	while(true)
 	{
 		std::function<void()> task;
-		if(work_queue_.try_pop(task))
+		if(pop_task(state, index, task))
 		{
+			--state.queued;
 			task();
+			continue;
 		}
-		else
+
+		std::unique_lock lk{state.park_mutex};
+		++state.parked;
+		state.park_condition.wait(lk, [&state] { return state.done || state.queued > 0; });
+		--state.parked;
+		if(state.done && state.queued == 0)
 		{
-			std::this_thread::yield();
-			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			return;
 		}
 	}
 }
@@ -0,0 +1,367 @@
+#include "peerpaste/udp_transport.hpp"
+#include "peerpaste/boost_session.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <cstring>
+#include <random>
+
+namespace peerpaste
+{
+
+UdpTransport::UdpTransport(boost::asio::io_context &io_context, std::shared_ptr<ReceiveQueue> msg_queue)
+	: io_context_(io_context)
+	, strand_(io_context)
+	, socket_(io_context)
+	, msg_queue_(std::move(msg_queue))
+	// a restarted node must not reuse sequence numbers its peers still remember
+	, next_sequence_(std::random_device{}())
+	, receive_buffer_(MAX_DATAGRAM_SIZE)
+{
+}
+
+bool UdpTransport::open(unsigned short port)
+{
+	boost::system::error_code ec;
+	socket_.open(udp::v4(), ec);
+	if(!ec)
+	{
+		socket_.bind(udp::endpoint(udp::v4(), port), ec);
+	}
+	if(ec)
+	{
+		spdlog::warn("UdpTransport could not bind port {}, using tcp only: {}", port, ec.message());
+		socket_.close(ec);
+		return false;
+	}
+
+	is_open_ = true;
+	boost::asio::post(strand_.wrap([me = shared_from_this()]() { me->receive(); }));
+	return true;
+}
+
+void UdpTransport::close()
+{
+	is_open_ = false;
+	boost::asio::post(strand_.wrap([me = shared_from_this()]() {
+		boost::system::error_code ec;
+		me->socket_.close(ec);
+		me->pending_requests_.clear();
+		me->pending_count_ = 0;
+	}));
+}
+
+bool UdpTransport::is_open() const
+{
+	return is_open_;
+}
+
+unsigned short UdpTransport::get_port() const
+{
+	boost::system::error_code ec;
+	return socket_.local_endpoint(ec).port();
+}
+
+void UdpTransport::set_retransmit_policy(const RetransmitPolicy &policy)
+{
+	boost::asio::post(strand_.wrap([me = shared_from_this(), policy]() { me->retransmit_policy_ = policy; }));
+}
+
+std::optional<UdpTransport::udp::endpoint> UdpTransport::resolve(const std::string &address,
+																																 const std::string &port) const
+{
+	auto endpoints = EndpointCache::from_numeric(address, port);
+	if(!endpoints.has_value())
+	{
+		endpoints = BoostSession::get_endpoint_cache().get(address, port);
+	}
+	if(!endpoints.has_value() || endpoints->empty())
+	{
+		return {};
+	}
+
+	const auto &endpoint = endpoints->front();
+	return udp::endpoint(endpoint.address(), endpoint.port());
+}
+
+size_t UdpTransport::get_pending_requests() const
+{
+	return pending_count_;
+}
+
+std::shared_ptr<DataBuffer> UdpTransport::make_datagram(Kind kind, uint32_t sequence, const DataBuffer &payload)
+{
+	auto datagram = std::make_shared<DataBuffer>(HEADER_SIZE + payload.size());
+	auto &buf = *datagram;
+	buf[0] = static_cast<uint8_t>(kind);
+	buf[1] = static_cast<uint8_t>((sequence >> 24) & 0xFF);
+	buf[2] = static_cast<uint8_t>((sequence >> 16) & 0xFF);
+	buf[3] = static_cast<uint8_t>((sequence >> 8) & 0xFF);
+	buf[4] = static_cast<uint8_t>(sequence & 0xFF);
+	std::copy(payload.begin(), payload.end(), buf.begin() + HEADER_SIZE);
+	return datagram;
+}
+
+SessionPtr UdpTransport::send_request(DataBuffer message, const udp::endpoint &endpoint, FailureHandler on_failed)
+{
+	const auto sequence = next_sequence_++;
+	auto datagram = make_datagram(Kind::REQUEST, sequence, message);
+	++pending_count_;
+
+	boost::asio::post(strand_.wrap(
+		[me = shared_from_this(), sequence, datagram, endpoint, on_failed = std::move(on_failed)]() mutable {
+			PendingRequest request{endpoint,
+														 datagram,
+														 std::make_unique<boost::asio::steady_timer>(me->io_context_),
+														 me->retransmit_policy_.initial_timeout,
+														 1,
+														 std::move(on_failed)};
+			me->pending_requests_.insert_or_assign(sequence, std::move(request));
+			me->transmit(datagram, endpoint);
+			me->arm_retransmit(sequence);
+		}));
+
+	return std::make_shared<UdpSession>(shared_from_this(), endpoint);
+}
+
+void UdpTransport::send_response(const udp::endpoint &endpoint, uint32_t sequence, DataBuffer message)
+{
+	auto datagram = make_datagram(Kind::RESPONSE, sequence, message);
+
+	boost::asio::post(strand_.wrap([me = shared_from_this(), endpoint, sequence, datagram]() {
+		// kept to answer retransmits of the request
+		const auto search = me->received_requests_.find({endpoint, sequence});
+		if(search != me->received_requests_.end())
+		{
+			search->second.response = datagram;
+		}
+		me->transmit(datagram, endpoint);
+	}));
+}
+
+void UdpTransport::transmit(std::shared_ptr<DataBuffer> datagram, const udp::endpoint &endpoint)
+{
+	if(!is_open_)
+	{
+		return;
+	}
+
+	socket_.async_send_to(boost::asio::buffer(*datagram),
+												endpoint,
+												strand_.wrap([datagram](const boost::system::error_code &ec, size_t) {
+													if(ec && ec != boost::asio::error::operation_aborted)
+													{
+														spdlog::debug("UdpTransport send failed: {}", ec.message());
+													}
+												}));
+}
+
+void UdpTransport::arm_retransmit(uint32_t sequence)
+{
+	auto &request = pending_requests_.at(sequence);
+	request.timer->expires_after(request.timeout);
+	request.timer->async_wait(strand_.wrap([me = shared_from_this(), sequence](const boost::system::error_code &ec) {
+		me->handle_retransmit(sequence, ec);
+	}));
+}
+
+void UdpTransport::handle_retransmit(uint32_t sequence, const boost::system::error_code &ec)
+{
+	const auto search = pending_requests_.find(sequence);
+	if(ec || search == pending_requests_.end())
+	{
+		return;
+	}
+
+	auto &request = search->second;
+	if(request.attempts < retransmit_policy_.max_attempts && is_open_)
+	{
+		++request.attempts;
+		request.timeout *= 2;
+		transmit(request.datagram, request.endpoint);
+		arm_retransmit(sequence);
+		return;
+	}
+
+	spdlog::debug("UdpTransport request to {} timed out after {} attempts",
+								request.endpoint.address().to_string(),
+								request.attempts);
+
+	auto on_failed = std::move(request.on_failed);
+	DataBuffer message(request.datagram->begin() + HEADER_SIZE, request.datagram->end());
+	pending_requests_.erase(search);
+	--pending_count_;
+
+	if(on_failed)
+	{
+		on_failed(std::move(message));
+	}
+}
+
+void UdpTransport::receive()
+{
+	if(!is_open_)
+	{
+		return;
+	}
+
+	socket_.async_receive_from(boost::asio::buffer(receive_buffer_),
+														 sender_,
+														 strand_.wrap([me = shared_from_this()](const boost::system::error_code &ec, size_t bytes) {
+															 me->handle_receive(ec, bytes);
+														 }));
+}
+
+void UdpTransport::handle_receive(const boost::system::error_code &ec, size_t bytes)
+{
+	if(ec == boost::asio::error::operation_aborted)
+	{
+		return;
+	}
+
+	// While the dispatcher is behind datagrams are dropped, requests and
+	// responses both get retransmitted by the requesting side
+	if(!ec && bytes >= HEADER_SIZE && !msg_queue_->is_full())
+	{
+		const uint32_t sequence = (static_cast<uint32_t>(receive_buffer_[1]) << 24) |
+															(static_cast<uint32_t>(receive_buffer_[2]) << 16) |
+															(static_cast<uint32_t>(receive_buffer_[3]) << 8) | static_cast<uint32_t>(receive_buffer_[4]);
+		const auto *payload = receive_buffer_.data() + HEADER_SIZE;
+		const auto size = bytes - HEADER_SIZE;
+
+		if(receive_buffer_[0] == static_cast<uint8_t>(Kind::REQUEST))
+		{
+			handle_request(sequence, payload, size);
+		}
+		else if(receive_buffer_[0] == static_cast<uint8_t>(Kind::RESPONSE))
+		{
+			handle_response(sequence, payload, size);
+		}
+	}
+	else if(ec)
+	{
+		spdlog::debug("UdpTransport receive failed: {}", ec.message());
+	}
+
+	receive();
+}
+
+void UdpTransport::handle_request(uint32_t sequence, const uint8_t *payload, size_t size)
+{
+	prune_received_requests();
+
+	const auto [search, inserted] =
+		received_requests_.try_emplace({sender_, sequence}, ReceivedRequest{std::chrono::steady_clock::now(), nullptr});
+	if(!inserted)
+	{
+		// a retransmit, the dispatcher already has the request
+		if(search->second.response != nullptr)
+		{
+			transmit(search->second.response, sender_);
+		}
+		return;
+	}
+
+	push(payload, size, sequence);
+}
+
+void UdpTransport::handle_response(uint32_t sequence, const uint8_t *payload, size_t size)
+{
+	const auto search = pending_requests_.find(sequence);
+	if(search == pending_requests_.end() || search->second.endpoint != sender_)
+	{
+		// late duplicate of a response already handled
+		return;
+	}
+
+	search->second.timer->cancel();
+	pending_requests_.erase(search);
+	--pending_count_;
+
+	push(payload, size, std::nullopt);
+}
+
+void UdpTransport::push(const uint8_t *payload, size_t size, std::optional<uint32_t> reply_to)
+{
+	auto buffer = BoostSession::get_buffer_pool()->acquire(size);
+	std::memcpy(buffer.data(), payload, size);
+	msg_queue_->push(std::make_pair(std::move(buffer), std::make_shared<UdpSession>(shared_from_this(), sender_, reply_to)));
+}
+
+void UdpTransport::prune_received_requests()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if(now - last_prune_ < std::chrono::seconds{1})
+	{
+		return;
+	}
+
+	last_prune_ = now;
+	std::erase_if(received_requests_,
+								[&now](const auto &entry) { return now - entry.second.received > RECEIVED_REQUEST_TTL; });
+}
+
+UdpSession::UdpSession(std::shared_ptr<UdpTransport> transport,
+											 boost::asio::ip::udp::endpoint endpoint,
+											 std::optional<uint32_t> reply_to)
+	: transport_(std::move(transport))
+	, endpoint_(std::move(endpoint))
+	, reply_to_(reply_to)
+{
+}
+
+void UdpSession::write(DataBuffer message, SendPolicy, MessagePriority)
+{
+	if(reply_to_.has_value())
+	{
+		transport_->send_response(endpoint_, reply_to_.value(), std::move(message));
+		return;
+	}
+
+	transport_->send_request(std::move(message), endpoint_);
+}
+
+void UdpSession::write_to(DataBuffer message,
+													const std::string &address,
+													const std::string &port,
+													SendPolicy,
+													MessagePriority)
+{
+	if(auto endpoint = transport_->resolve(address, port))
+	{
+		transport_->send_request(std::move(message), endpoint.value());
+		return;
+	}
+
+	spdlog::warn("UdpSession::write_to cannot send to unresolved address {}", address);
+}
+
+void UdpSession::write_direct(DataBuffer message,
+															const std::function<void(bool)> &handler,
+															SendPolicy policy,
+															MessagePriority priority)
+{
+	write(std::move(message), policy, priority);
+	handler(!transport_->is_open());
+}
+
+void UdpSession::read()
+{
+}
+
+std::string UdpSession::get_client_ip() const
+{
+	return endpoint_.address().to_string();
+}
+
+SendQueueMetrics UdpSession::get_send_queue_metrics() const
+{
+	return {};
+}
+
+bool UdpSession::is_open() const
+{
+	return transport_->is_open();
+}
+
+} // namespace peerpaste
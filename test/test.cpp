@@ -1,13 +1,25 @@
+#include "peerpaste/buffer_pool.hpp"
 #include "peerpaste/concurrent_queue.hpp"
 #include "peerpaste/concurrent_routing_table.hpp"
+#include "peerpaste/connection_pool.hpp"
+#include "peerpaste/frame_decoder.hpp"
+#include "peerpaste/io_context_pool.hpp"
+#ifdef PEERPASTE_HAS_IO_URING
+#include "peerpaste/io_uring_session.hpp"
+#endif
+#include "peerpaste/loopback_session.hpp"
 #include "peerpaste/consumer.hpp"
 #include "peerpaste/message.hpp"
 #include "peerpaste/message_converter.hpp"
 #include "peerpaste/message_handler.hpp"
 #include "peerpaste/peer.hpp"
+#include "peerpaste/thread_pool.hpp"
+#include "peerpaste/weighted_queues.hpp"
 
+#include <future>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <string>
 #include <thread>
 
@@ -21,8 +33,8 @@ TEST_CASE("Testing Header Object", "[peerpaste::message::header]")
 	bool t_flag = true;
 	uint32_t ttl = 1;
 	uint64_t message_length = 10;
-	std::string request_type = "query";
-	std::string transaction_id = "123ABC";
+	MessageType request_type = MessageType::QUERY;
+	TransactionId transaction_id{0x123, 0xABC};
 	std::string version = "1.0.0";
 	std::string response_code = "UNKNOWN";
 
@@ -32,56 +44,60 @@ TEST_CASE("Testing Header Object", "[peerpaste::message::header]")
 	REQUIRE(header.get_ttl() == 1);
 	REQUIRE(header.get_message_length() == 10);
 	REQUIRE(header.get_request_type() == "query");
-	REQUIRE(header.get_transaction_id() == "123ABC");
+	REQUIRE(header.get_transaction_id() == TransactionId{0x123, 0xABC});
 	REQUIRE(header.get_version() == "1.0.0");
 	REQUIRE(header.get_response_code() == "UNKNOWN");
 
 	header.set_t_flag(false);
 	header.set_ttl(2);
 	header.set_message_length(11);
-	header.set_request_type("join");
-	header.set_transaction_id("456DEF");
+	header.set_message_type(MessageType::JOIN);
+	header.set_transaction_id({0x456, 0xDEF});
 	header.set_version("2.0.1");
 	header.set_response_code("KNOWN");
 
 	REQUIRE(header.get_t_flag() == false);
 	REQUIRE(header.get_ttl() == 2);
 	REQUIRE(header.get_message_length() == 11);
+	REQUIRE(header.get_message_type() == MessageType::JOIN);
 	REQUIRE(header.get_request_type() == "join");
-	REQUIRE(header.get_transaction_id() == "456DEF");
+	REQUIRE(header.get_transaction_id() == TransactionId{0x456, 0xDEF});
 	REQUIRE(header.get_version() == "2.0.1");
 	REQUIRE(header.get_response_code() == "KNOWN");
-	REQUIRE(header.stringify() == "0211join456DEF2.0.1KNOWN");
+	REQUIRE(header.stringify() == "0211join00000000000004560000000000000def2.0.1KNOWN");
 }
 
 TEST_CASE("Testing Peer Object", "[peerpaste::message::peer]")
 {
-	std::string id = "123ABC";
+	const NodeId id{{0, 0, 0, 0x123ABC}};
+	const NodeId other_id{{0, 0, 0, 0x456DEF}};
 	std::string ip = "10.0.0.1";
 	std::string port = "1337";
 
 	Peer peer(id, ip, port);
 
-	REQUIRE(peer.get_id() == "123ABC");
+	REQUIRE(peer.get_id() == id);
 	REQUIRE(peer.get_ip() == "10.0.0.1");
 	REQUIRE(peer.get_port() == "1337");
 
 	REQUIRE(not(peer == Peer()));
 	REQUIRE(true == (peer != Peer()));
 
-	peer.set_id("456DEF");
+	peer.set_id(other_id);
 	peer.set_ip("20.2.2.2");
 	peer.set_port("4242");
 
-	REQUIRE(peer.get_id() == "456DEF");
+	REQUIRE(peer.get_id() == other_id);
 	REQUIRE(peer.get_ip() == "20.2.2.2");
 	REQUIRE(peer.get_port() == "4242");
-	REQUIRE(peer.stringify() == "456DEF20.2.2.24242");
+	REQUIRE(other_id.to_string() == std::string(58, '0') + "456DEF");
+	REQUIRE(peer.stringify() == other_id.to_string() + "20.2.2.24242");
 }
 
 TEST_CASE("Testing Message Object", "[peerpaste::message]")
 {
-	std::string id = "123ABC";
+	const NodeId id{{0, 0, 0, 0x123ABC}};
+	const NodeId other_id{{0, 0, 0, 0x456DEF}};
 	std::string ip = "10.0.0.1";
 	std::string port = "1337";
 
@@ -90,8 +106,8 @@ TEST_CASE("Testing Message Object", "[peerpaste::message]")
 	bool t_flag = true;
 	uint32_t ttl = 1;
 	uint64_t message_length = 10;
-	std::string request_type = "query";
-	std::string transaction_id = "123ABC";
+	MessageType request_type = MessageType::QUERY;
+	TransactionId transaction_id{0x123, 0xABC};
 	std::string version = "1.0.0";
 	std::string response_code = "UNKNOWN";
 
@@ -109,7 +125,7 @@ TEST_CASE("Testing Message Object", "[peerpaste::message]")
 	REQUIRE(header_.get_ttl() == 1);
 	REQUIRE(header_.get_message_length() == 10);
 	REQUIRE(header_.get_request_type() == "query");
-	REQUIRE(header_.get_transaction_id() == "123ABC");
+	REQUIRE(header_.get_transaction_id() == TransactionId{0x123, 0xABC});
 	REQUIRE(header_.get_version() == "1.0.0");
 	REQUIRE(header_.get_response_code() == "UNKNOWN");
 
@@ -119,11 +135,11 @@ TEST_CASE("Testing Message Object", "[peerpaste::message]")
 	std::vector<Peer> new_peers;
 	for(auto peer : peers)
 	{
-		REQUIRE(peer.get_id() == "123ABC");
+		REQUIRE(peer.get_id() == id);
 		REQUIRE(peer.get_ip() == "10.0.0.1");
 		REQUIRE(peer.get_port() == "1337");
 
-		peer.set_id("456DEF");
+		peer.set_id(other_id);
 		peer.set_ip("20.2.2.2");
 		peer.set_port("4242");
 		new_peers.push_back(peer);
@@ -132,12 +148,54 @@ TEST_CASE("Testing Message Object", "[peerpaste::message]")
 	message.set_peers(new_peers);
 	for(const auto peer : message.get_peers())
 	{
-		REQUIRE(peer.get_id() == "456DEF");
+		REQUIRE(peer.get_id() == other_id);
 		REQUIRE(peer.get_ip() == "20.2.2.2");
 		REQUIRE(peer.get_port() == "4242");
 	}
 }
 
+TEST_CASE("Testing Message buffers are moved, not copied", "[peerpaste::message]")
+{
+	Message message;
+
+	std::string data(4096, 'x');
+	const auto *data_buffer = data.data();
+	message.set_data(std::move(data));
+	REQUIRE(message.get_data().data() == data_buffer);
+
+	std::vector<Peer> peers{Peer(NodeId{{0, 0, 0, 1}}, "10.0.0.1", "1337")};
+	const auto *peers_buffer = peers.data();
+	message.set_peers(std::move(peers));
+	REQUIRE(message.get_peers().data() == peers_buffer);
+
+	std::vector<peerpaste::FileInfo> files{{"file", 1024}};
+	const auto *files_buffer = files.data();
+	message.set_filelist(std::move(files));
+	REQUIRE(message.get_files().data() == files_buffer);
+
+	Peer peer;
+	std::string ip(64, '1');
+	const auto *ip_buffer = ip.data();
+	peer.set_ip(std::move(ip));
+	REQUIRE(peer.get_ip().data() == ip_buffer);
+	message.add_peer(std::move(peer));
+	REQUIRE(message.get_peers().back().get_ip().data() == ip_buffer);
+
+	RequestObject request;
+	auto shared_message = std::make_shared<Message>(std::move(message));
+	request.set_message(shared_message);
+	REQUIRE(request.get_message().use_count() == 2);
+
+	// the accessor refers to the stored pointer, so it sees a replaced message
+	const auto &stored_message = request.get_message();
+	auto other_message = std::make_shared<Message>();
+	const auto *other_message_ptr = other_message.get();
+	request.set_message(std::move(other_message));
+	REQUIRE(stored_message.get() == other_message_ptr);
+	REQUIRE(stored_message.use_count() == 1);
+	REQUIRE(shared_message.use_count() == 1);
+}
+
 TEST_CASE("Testing ProtobufMessageConverter", "[peeraste::MessageConverter]")
 {
 	// Create a protobuf message
@@ -148,21 +206,21 @@ TEST_CASE("Testing ProtobufMessageConverter", "[peeraste::MessageConverter]")
 	protobuf_header->set_t_flag(true);
 	protobuf_header->set_ttl(10);
 	protobuf_header->set_message_length(15);
-	protobuf_header->set_request_type("query");
-	protobuf_header->set_transaction_id("secret");
-	protobuf_header->set_correlational_id("");
-	protobuf_header->set_version("1.0.0");
+	protobuf_header->set_message_type(static_cast<uint32_t>(MessageType::QUERY));
+	protobuf_header->set_transaction_id_high(1);
+	protobuf_header->set_transaction_id_low(2);
+	protobuf_header->set_version(std::string(ProtobufMessageConverter::WIRE_VERSION));
 	protobuf_header->set_response_code("UNKNOWN");
 
 	// Add first peer
 	auto protobuf_peerinfo1 = protobuf_message->add_peerinfo();
-	protobuf_peerinfo1->set_peer_id("123ABC");
+	protobuf_peerinfo1->set_node_id(NodeId{{0, 0, 0, 0x123ABC}}.to_bytes());
 	protobuf_peerinfo1->set_peer_ip("123ABC");
 	protobuf_peerinfo1->set_peer_port("123ABC");
 
 	// Add second peer
 	auto protobuf_peerinfo2 = protobuf_message->add_peerinfo();
-	protobuf_peerinfo2->set_peer_id("321CBA");
+	protobuf_peerinfo2->set_node_id(NodeId{{0, 0, 0, 0x321CBA}}.to_bytes());
 	protobuf_peerinfo2->set_peer_ip("321CBA");
 	protobuf_peerinfo2->set_peer_port("321CBA");
 
@@ -181,10 +239,11 @@ TEST_CASE("Testing ProtobufMessageConverter", "[peeraste::MessageConverter]")
 	REQUIRE(peerpaste_header.get_t_flag() == true);
 	REQUIRE(peerpaste_header.get_ttl() == 10);
 	REQUIRE(peerpaste_header.get_message_length() == 15);
+	REQUIRE(peerpaste_header.get_message_type() == MessageType::QUERY);
 	REQUIRE(peerpaste_header.get_request_type() == "query");
-	REQUIRE(peerpaste_header.get_transaction_id() == "secret");
-	REQUIRE(peerpaste_header.get_correlational_id() == "");
-	REQUIRE(peerpaste_header.get_version() == "1.0.0");
+	REQUIRE(peerpaste_header.get_transaction_id() == TransactionId{1, 2});
+	REQUIRE(!peerpaste_header.get_correlational_id().is_valid());
+	REQUIRE(peerpaste_header.get_version() == ProtobufMessageConverter::WIRE_VERSION);
 	REQUIRE(peerpaste_header.get_response_code() == "UNKNOWN");
 
 	// Check if Response header get generated the right way
@@ -193,19 +252,19 @@ TEST_CASE("Testing ProtobufMessageConverter", "[peeraste::MessageConverter]")
 	REQUIRE(response_peerpaste_header.get_t_flag() == false);
 	REQUIRE(response_peerpaste_header.get_ttl() == 10);
 	REQUIRE(response_peerpaste_header.get_message_length() == 15);
-	REQUIRE(response_peerpaste_header.get_request_type() == "query");
-	REQUIRE(response_peerpaste_header.get_transaction_id() == "");
-	REQUIRE(response_peerpaste_header.get_correlational_id() == "secret");
-	REQUIRE(response_peerpaste_header.get_version() == "1.0.0");
+	REQUIRE(response_peerpaste_header.get_message_type() == MessageType::QUERY);
+	REQUIRE(!response_peerpaste_header.get_transaction_id().is_valid());
+	REQUIRE(response_peerpaste_header.get_correlational_id() == TransactionId{1, 2});
+	REQUIRE(response_peerpaste_header.get_version() == ProtobufMessageConverter::WIRE_VERSION);
 	REQUIRE(response_peerpaste_header.get_response_code() == "UNKNOWN");
 
 	// Check if peers contain right information
 	auto peerpaste_peers = peerpaste_message->get_peers();
 	REQUIRE(peerpaste_peers.size() == 2);
-	REQUIRE(peerpaste_peers[0].get_id() == "123ABC");
+	REQUIRE(peerpaste_peers[0].get_id() == NodeId{{0, 0, 0, 0x123ABC}});
 	REQUIRE(peerpaste_peers[0].get_ip() == "123ABC");
 	REQUIRE(peerpaste_peers[0].get_port() == "123ABC");
-	REQUIRE(peerpaste_peers[1].get_id() == "321CBA");
+	REQUIRE(peerpaste_peers[1].get_id() == NodeId{{0, 0, 0, 0x321CBA}});
 	REQUIRE(peerpaste_peers[1].get_ip() == "321CBA");
 	REQUIRE(peerpaste_peers[1].get_port() == "321CBA");
 
@@ -213,6 +272,87 @@ TEST_CASE("Testing ProtobufMessageConverter", "[peeraste::MessageConverter]")
 	REQUIRE(buf == converter.SerializedFromMessage(peerpaste_message));
 }
 
+TEST_CASE("Testing file chunks appended to a serialized message", "[peeraste::MessageConverter]")
+{
+	auto message = std::make_shared<Message>();
+	message->set_header(Header(false, 0, 0, MessageType::GET_FILE, TransactionId{}, TransactionId{1, 2}, "", ""));
+
+	ProtobufMessageConverter converter;
+	auto buf = converter.SerializedFromMessage(message);
+	const std::string data(300, 'x');
+	ProtobufMessageConverter::AppendFileChunkHeader(buf, 4096, data.size());
+	buf.insert(buf.end(), data.begin(), data.end());
+
+	// still a regular protobuf message for peers decoding it the old way
+	Request protobuf_message;
+	REQUIRE(protobuf_message.ParseFromArray(buf.data(), buf.size()));
+	REQUIRE(protobuf_message.file_chunk().offset() == 4096);
+	REQUIRE(protobuf_message.file_chunk().data() == data);
+
+	auto decoded = converter.MessageFromSerialized(buf);
+	REQUIRE(decoded->get_header().get_correlational_id() == TransactionId{1, 2});
+	REQUIRE(decoded->get_file_chunk().has_value());
+	REQUIRE(decoded->get_file_chunk()->offset == 4096);
+	REQUIRE(decoded->get_file_chunk()->size == data.size());
+	REQUIRE(std::string(decoded->get_file_chunk()->data.begin(), decoded->get_file_chunk()->data.end()) == data);
+}
+
+TEST_CASE("Testing compressed file chunks and lists", "[peeraste::MessageConverter]")
+{
+	auto message = std::make_shared<Message>();
+	message->set_header(Header(false, 0, 0, MessageType::GET_FILE, TransactionId{}, TransactionId{1, 2}, "", ""));
+	std::string text;
+	while(text.size() < 8192)
+	{
+		text += "a paste of mostly text compresses well. ";
+	}
+	message->set_file_chunk(peerpaste::FileChunk{text.data(), text.size(), 512});
+	for(int i = 0; i < 50; ++i)
+	{
+		message->add_file(peerpaste::FileInfo{"file_" + std::to_string(i), std::string(64, 'f'), 1024, 0});
+	}
+
+	peerpaste::CompressionOptions options;
+	options.chunk_level = 1;
+	ProtobufMessageConverter converter(options);
+	const auto plain = converter.SerializedFromMessage(message, peerpaste::Encoding::IDENTITY);
+	const auto compressed = converter.SerializedFromMessage(message, peerpaste::Encoding::DEFLATE);
+	REQUIRE(compressed.size() * 3 < plain.size());
+
+	for(const auto &buf : {plain, compressed})
+	{
+		auto decoded = converter.MessageFromSerialized(buf);
+		REQUIRE(decoded->get_header().get_accept_encoding() == peerpaste::SUPPORTED_ENCODINGS);
+		REQUIRE(decoded->get_file_chunk().has_value());
+		REQUIRE(decoded->get_file_chunk()->offset == 512);
+		REQUIRE(std::string(decoded->get_file_chunk()->data.begin(), decoded->get_file_chunk()->data.end()) == text);
+		REQUIRE(decoded->get_files().size() == 50);
+		REQUIRE(decoded->get_files().back().file_name == "file_49");
+	}
+
+	// levels of 0 keep everything uncompressed
+	ProtobufMessageConverter disabled({1024, 0, 0});
+	REQUIRE(disabled.SerializedFromMessage(message, peerpaste::Encoding::DEFLATE) == plain);
+}
+
+TEST_CASE("Testing file chunks of default nodes are sent from the file", "[peeraste::MessageConverter]")
+{
+	// the dispatcher only reads a chunk into memory if the converter compresses it,
+	// otherwise the chunk goes to Session::write_file and is sent with sendfile
+	ProtobufMessageConverter converter(peerpaste::CompressionOptions{});
+	REQUIRE(not converter.CompressesFileChunk(peerpaste::SUPPORTED_ENCODINGS, 1024 * 1024));
+	REQUIRE(not converter.CompressesFileChunk(peerpaste::SUPPORTED_ENCODINGS, 4096));
+
+	// file lists are still compressed
+	auto message = std::make_shared<Message>();
+	for(int i = 0; i < 50; ++i)
+	{
+		message->add_file(peerpaste::FileInfo{"file_" + std::to_string(i), std::string(64, 'f'), 1024, 0});
+	}
+	const auto plain = converter.SerializedFromMessage(message, peerpaste::Encoding::IDENTITY);
+	REQUIRE(converter.SerializedFromMessage(message, peerpaste::SUPPORTED_ENCODINGS).size() < plain.size());
+}
+
 TEST_CASE("Testing util::between()", "[util::between()]")
 {
 	std::string a = "a";
@@ -236,6 +376,67 @@ TEST_CASE("Testing util::between()", "[util::between()]")
 	REQUIRE(util::between(num1, num3, c) == true);
 }
 
+TEST_CASE("Testing NodeId", "[NodeId]")
+{
+	constexpr auto low = NodeId::from_hex("00000000000000000000000000000000000000000000000000000000000000FF");
+	constexpr auto high = NodeId::from_hex("0100000000000000000000000000000000000000000000000000000000000000");
+	static_assert(low < high);
+	static_assert(util::between(low, NodeId{{0, 0, 1, 0}}, high));
+	static_assert(!util::between(low, high, high));
+	static_assert(util::between(high, NodeId{{0, 0, 0, 1}}, low));
+
+	const std::string hex = "0123456789ABCDEFFEDCBA98765432100F1E2D3C4B5A69788796A5B4C3D2E1F0";
+	const auto id = NodeId::from_hex(hex);
+	REQUIRE(id.words[0] == 0x0123456789ABCDEF);
+	REQUIRE(id.to_string() == hex);
+	REQUIRE(NodeId::from_bytes(id.to_bytes()) == id);
+	REQUIRE(NodeId::from_hex("0123456789abcdeffedcba98765432100f1e2d3c4b5a69788796a5b4c3d2e1f0") == id);
+	REQUIRE(!NodeId::from_hex("123ABC").is_valid());
+	REQUIRE(NodeId{}.to_string().empty());
+
+	SECTION("ids order like the hex strings")
+	{
+		std::mt19937_64 engine{42};
+		std::vector<NodeId> ids(200);
+		for(auto &random_id : ids)
+		{
+			// shared leading words make the lower words decide
+			random_id.words = {engine() % 2, engine() % 2, engine(), engine()};
+		}
+
+		for(size_t i = 0; i + 2 < ids.size(); ++i)
+		{
+			const auto &a = ids[i], &b = ids[i + 1], &c = ids[i + 2];
+			REQUIRE(util::less(a, b) == (a.to_string() < b.to_string()));
+			REQUIRE(util::between(a, b, c) == util::between(a.to_string(), b.to_string(), c.to_string()));
+		}
+	}
+
+	SECTION("between_mask checks a batch")
+	{
+		const std::vector<NodeId> ids{{{0, 0, 0, 5}}, {{0, 0, 0, 15}}, {{0, 0, 0, 25}}, {{0, 0, 0, 35}}};
+		REQUIRE(util::between_mask(NodeId{{0, 0, 0, 10}}, ids, NodeId{{0, 0, 0, 30}}) == 0b0110);
+		REQUIRE(util::between_mask(NodeId{{0, 0, 0, 30}}, ids, NodeId{{0, 0, 0, 10}}) == 0b1001);
+	}
+
+	SECTION("the routing table finds the closest preceding successor")
+	{
+		peerpaste::ConcurrentRoutingTable<Peer> table;
+		Peer found;
+		REQUIRE(!table.try_get_closest_preceding(NodeId{{0, 0, 0, 40}}, found));
+
+		table.set_self(Peer(NodeId{{0, 0, 0, 10}}, "10.0.0.1", "1"));
+		table.replace_successor_list({Peer(NodeId{{0, 0, 0, 20}}, "10.0.0.2", "1"),
+																	Peer(NodeId{{0, 0, 0, 30}}, "10.0.0.3", "1"),
+																	Peer(NodeId{{0, 0, 0, 50}}, "10.0.0.5", "1")});
+
+		REQUIRE(table.try_get_closest_preceding(NodeId{{0, 0, 0, 40}}, found));
+		REQUIRE(found.get_ip() == "10.0.0.3");
+		REQUIRE(table.try_get_closest_preceding(NodeId{{0, 0, 0, 15}}, found));
+		REQUIRE(found.get_ip() == "10.0.0.1");
+	}
+}
+
 TEST_CASE("Testing peerpaste::ConcurrentQueue", "[peerpaste::ConcurrentQueue]")
 {
 	peerpaste::ConcurrentQueue<int> data_queue;
@@ -249,6 +450,80 @@ TEST_CASE("Testing peerpaste::ConcurrentQueue", "[peerpaste::ConcurrentQueue]")
 	get1.join();
 }
 
+TEST_CASE("Testing ThreadPool", "[ThreadPool]")
+{
+	std::atomic<int> counter = 0;
+
+	SECTION("runs tasks submitted by workers and other threads")
+	{
+		{
+			ThreadPool thread_pool(4);
+			REQUIRE(thread_pool.size() == 4);
+			for(int i = 0; i < 100; ++i)
+			{
+				thread_pool.submit([&thread_pool, &counter] {
+					for(int j = 0; j < 10; ++j)
+					{
+						thread_pool.submit([&counter] { ++counter; });
+					}
+				});
+			}
+		}
+		// queued tasks are run before the workers stop
+		REQUIRE(counter == 1000);
+	}
+
+	SECTION("wakes up parked workers")
+	{
+		ThreadPool thread_pool(2);
+		std::this_thread::sleep_for(std::chrono::milliseconds{20});
+
+		std::promise<void> ran;
+		thread_pool.submit([&ran] { ran.set_value(); });
+		REQUIRE(ran.get_future().wait_for(std::chrono::seconds{1}) == std::future_status::ready);
+	}
+
+	SECTION("stops before it is destroyed")
+	{
+		ThreadPool thread_pool(2);
+		for(int i = 0; i < 10; ++i)
+		{
+			thread_pool.submit([&thread_pool, &counter] { thread_pool.submit([&counter] { ++counter; }); });
+		}
+		thread_pool.stop();
+		REQUIRE(counter == 10);
+
+		// nothing runs the tasks of a stopped pool
+		thread_pool.submit([&counter] { ++counter; });
+		thread_pool.stop();
+		REQUIRE(counter == 10);
+	}
+}
+
+TEST_CASE("Testing peerpaste::WeightedQueues", "[peerpaste::WeightedQueues]")
+{
+	peerpaste::WeightedQueues<int> queues({2, 1, 1});
+	REQUIRE(not queues.pop().has_value());
+
+	for(int i = 0; i < 3; ++i)
+	{
+		queues.push(30 + i, MessagePriority::BULK);
+		queues.push(10 + i, MessagePriority::MAINTENANCE);
+	}
+	queues.push(20, MessagePriority::DEFAULT);
+	REQUIRE(queues.size() == 7);
+
+	std::vector<int> popped;
+	while(auto element = queues.pop())
+	{
+		popped.push_back(element.value());
+	}
+
+	// rounds of two maintenance, one default and one bulk element, empty classes are skipped
+	REQUIRE(popped == std::vector<int>{10, 11, 20, 30, 12, 31, 32});
+	REQUIRE(queues.empty());
+}
+
 TEST_CASE("Testing peerpaste::ConcurrentRoutingTable", "[peerpaste::ConcurrentRoutingTable]")
 {
 	peerpaste::ConcurrentRoutingTable<Peer> ru;
@@ -265,7 +540,7 @@ TEST_CASE("Testing peerpaste::ConcurrentRoutingTable", "[peerpaste::ConcurrentRo
 	REQUIRE(ru.try_get_predecessor(peer2) == false);
 	REQUIRE(ru.try_get_successor(peer3) == false);
 
-	std::string id = "123ABC";
+	const NodeId id{{0, 0, 0, 0x123ABC}};
 	std::string ip = "10.0.0.1";
 	std::string port = "1337";
 	Peer peer(id, ip, port);
@@ -282,9 +557,9 @@ TEST_CASE("Testing peerpaste::ConcurrentRoutingTable", "[peerpaste::ConcurrentRo
 	REQUIRE((peer == peer2) == true);
 	REQUIRE((peer == peer3) == true);
 
-	peer1.set_id("a");
-	peer2.set_id("b");
-	peer3.set_id("c");
+	peer1.set_id(NodeId{{0, 0, 0, 0xA}});
+	peer2.set_id(NodeId{{0, 0, 0, 0xB}});
+	peer3.set_id(NodeId{{0, 0, 0, 0xC}});
 
 	std::thread set1(set_self, peer1);
 	std::thread set2(set_succ, peer2);
@@ -302,3 +577,950 @@ TEST_CASE("Testing peerpaste::ConcurrentRoutingTable", "[peerpaste::ConcurrentRo
 	REQUIRE(ru.try_get_predecessor(peer) == true);
 	REQUIRE((peer == peer3) == true);
 }
+
+TEST_CASE("Testing peerpaste::ConnectionPool", "[peerpaste::ConnectionPool]")
+{
+	peerpaste::IoContextPool io_context_pool(1);
+	auto queue = std::make_shared<ReceiveQueue>();
+	peerpaste::SessionFactory session_factory(io_context_pool, queue);
+	peerpaste::ConnectionPool pool(session_factory);
+
+	const DataBuffer buf{0, 0, 0, 1, 42};
+	auto session1 = pool.write_to(buf, "127.0.0.1", "1337");
+	auto session2 = pool.write_to(buf, "127.0.0.1", "1337");
+	auto session3 = pool.write_to(buf, "127.0.0.1", "1338");
+
+	REQUIRE(session1 == session2);
+	REQUIRE(session1 != session3);
+	REQUIRE(pool.size() == 2);
+
+	// encodings are told apart by port, peers may share an ip
+	REQUIRE(pool.get_accept_encoding("127.0.0.1", "1337") == peerpaste::Encoding::IDENTITY);
+	session1->set_accept_encoding(peerpaste::Encoding::DEFLATE);
+	REQUIRE(pool.get_accept_encoding("127.0.0.1", "1337") == peerpaste::Encoding::DEFLATE);
+	REQUIRE(pool.get_accept_encoding("127.0.0.1", "1338") == peerpaste::Encoding::IDENTITY);
+	REQUIRE(pool.get_accept_encoding("127.0.0.1", "1339") == peerpaste::Encoding::IDENTITY);
+
+	pool.clear();
+	REQUIRE(pool.size() == 0);
+}
+
+TEST_CASE("Testing MessageDispatcher receive lanes", "[MessageDispatcher]")
+{
+	// one decode lane per network thread plus the one of datagrams
+	SECTION("shared io_context")
+	{
+		auto handler = std::make_shared<MessageHandler>("127.0.0.1", 1337);
+		peerpaste::MessageDispatcher dispatcher(handler, 4, peerpaste::IoMode::SHARED);
+		REQUIRE(dispatcher.get_io_context_pool().size() == 1);
+		REQUIRE(dispatcher.get_receive_lane_count() == 5);
+	}
+
+	SECTION("io_context per core")
+	{
+		auto handler = std::make_shared<MessageHandler>("127.0.0.1", 1337);
+		peerpaste::MessageDispatcher dispatcher(handler, 4, peerpaste::IoMode::PER_CORE);
+		REQUIRE(dispatcher.get_receive_lane_count() == 5);
+	}
+}
+
+TEST_CASE("Testing MessageDispatcher message transports", "[MessageDispatcher]")
+{
+	auto handler = std::make_shared<MessageHandler>("127.0.0.1", 1337);
+	peerpaste::MessageDispatcher dispatcher(handler, 1, peerpaste::IoMode::SHARED);
+	REQUIRE(dispatcher.get_udp_transport()->open(0));
+	const Peer peer(NodeId{}, "127.0.0.1", "1338");
+	const DataBuffer message{1, 2, 3};
+
+	REQUIRE(dispatcher.get_message_transport(MessageType::NOTIFICATION) == peerpaste::MessageTransport::UDP);
+	REQUIRE(dispatcher.send_over_udp(MessageType::NOTIFICATION, message, peer, SendPolicy::CLOSE) != nullptr);
+	REQUIRE(dispatcher.send_over_udp(MessageType::GET_FILE, message, peer, SendPolicy::CLOSE) == nullptr);
+
+	dispatcher.set_message_transport(MessageType::NOTIFICATION, peerpaste::MessageTransport::TCP);
+	REQUIRE(dispatcher.get_message_transport(MessageType::NOTIFICATION) == peerpaste::MessageTransport::TCP);
+	REQUIRE(dispatcher.send_over_udp(MessageType::NOTIFICATION, message, peer, SendPolicy::CLOSE) == nullptr);
+}
+
+TEST_CASE("Testing peerpaste::EndpointCache", "[peerpaste::EndpointCache]")
+{
+	REQUIRE(peerpaste::EndpointCache::from_numeric("127.0.0.1", "1337").has_value());
+	REQUIRE(peerpaste::EndpointCache::from_numeric("::1", "1337").value().front().port() == 1337);
+	REQUIRE(not peerpaste::EndpointCache::from_numeric("localhost", "1337").has_value());
+	REQUIRE(not peerpaste::EndpointCache::from_numeric("127.0.0.1", "http").has_value());
+	REQUIRE(not peerpaste::EndpointCache::from_numeric("127.0.0.1", "70000").has_value());
+
+	peerpaste::EndpointCache cache;
+	REQUIRE(not cache.get("localhost", "1337").has_value());
+
+	const auto endpoints = peerpaste::EndpointCache::from_numeric("127.0.0.1", "1337").value();
+	cache.put("localhost", "1337", endpoints);
+	REQUIRE(cache.get("localhost", "1337").value() == endpoints);
+	REQUIRE(not cache.get("localhost", "1338").has_value());
+
+	peerpaste::EndpointCache expired_cache(std::chrono::seconds{0});
+	expired_cache.put("localhost", "1337", endpoints);
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	REQUIRE(not expired_cache.get("localhost", "1337").has_value());
+	REQUIRE(expired_cache.size() == 0);
+}
+
+TEST_CASE("Testing peerpaste::BufferPool", "[peerpaste::BufferPool]")
+{
+	auto pool = std::make_shared<peerpaste::BufferPool>(1, 1024);
+
+	const uint8_t *first_data = nullptr;
+	{
+		auto buffer = pool->acquire(100);
+		REQUIRE(buffer.size() == 100);
+		REQUIRE(buffer.capacity() >= 100);
+		first_data = buffer.data();
+
+		auto moved = std::move(buffer);
+		REQUIRE(buffer.size() == 0);
+		REQUIRE(moved.data() == first_data);
+	}
+	REQUIRE(pool->size() == 1);
+
+	// released storage is reused without reallocating
+	auto reused = pool->acquire(50);
+	REQUIRE(reused.data() == first_data);
+	REQUIRE(pool->size() == 0);
+
+	auto other = pool->acquire(10);
+	reused = peerpaste::PooledBuffer{};
+	other = peerpaste::PooledBuffer{};
+	REQUIRE(pool->size() == 1);
+
+	// buffers above the size limit are not kept
+	{
+		auto big = pool->acquire(4096);
+		pool->acquire(10);
+	}
+	REQUIRE(pool->size() == 1);
+}
+
+TEST_CASE("Testing peerpaste::FrameDecoder", "[peerpaste::FrameDecoder]")
+{
+	auto pool = std::make_shared<peerpaste::BufferPool>();
+	peerpaste::FrameDecoder decoder(16);
+
+	const auto append = [&](const std::vector<uint8_t> &bytes) {
+		auto [data, size] = decoder.prepare();
+		REQUIRE(size >= bytes.size());
+		std::copy(bytes.begin(), bytes.end(), data);
+		decoder.commit(bytes.size());
+	};
+
+	// two complete frames and the beginning of a third one in one read
+	append({0, 0, 0, 2, 'a', 'b', 0, 0, 0, 1, 'c', 0, 0, 0, 3, 'd'});
+
+	auto first = decoder.next_frame(*pool);
+	REQUIRE(first.has_value());
+	REQUIRE(std::string(first->begin(), first->end()) == "ab");
+
+	auto second = decoder.next_frame(*pool);
+	REQUIRE(second.has_value());
+	REQUIRE(std::string(second->begin(), second->end()) == "c");
+
+	REQUIRE(not decoder.next_frame(*pool).has_value());
+	REQUIRE(not decoder.has_partial_frame());
+
+	append({'e', 'f'});
+	auto third = decoder.next_frame(*pool);
+	REQUIRE(third.has_value());
+	REQUIRE(std::string(third->begin(), third->end()) == "def");
+	REQUIRE(decoder.buffered() == 0);
+
+	// frames bigger than the decoder buffer become partial frames
+	append({0, 0, 0, 20, 'g', 'h'});
+	REQUIRE(not decoder.next_frame(*pool).has_value());
+	REQUIRE(decoder.has_partial_frame());
+
+	auto [data, size] = decoder.partial_remaining();
+	REQUIRE(size == 18);
+	std::fill(data, data + size, 'i');
+
+	auto big = decoder.take_partial_frame();
+	REQUIRE(big.size() == 20);
+	REQUIRE(big.data()[0] == 'g');
+	REQUIRE(big.data()[19] == 'i');
+	REQUIRE(not decoder.has_partial_frame());
+	REQUIRE(decoder.buffered() == 0);
+}
+
+TEST_CASE("Testing peerpaste::IoContextPool", "[peerpaste::IoContextPool]")
+{
+	peerpaste::IoContextPool shared_pool(4, peerpaste::IoMode::SHARED);
+	REQUIRE(shared_pool.size() == 1);
+	REQUIRE(&shared_pool.get_io_context() == &shared_pool.get_io_context());
+
+	peerpaste::IoContextPool per_core_pool(3, peerpaste::IoMode::PER_CORE);
+	REQUIRE(per_core_pool.size() == 3);
+	REQUIRE(&per_core_pool.get_io_context() != &per_core_pool.get_io_context());
+
+	std::atomic<int> ran = 0;
+	per_core_pool.run();
+	for(size_t i = 0; i < per_core_pool.size(); ++i)
+	{
+		boost::asio::post(per_core_pool.get_io_context(i), [&ran] { ++ran; });
+	}
+
+	while(ran != 3)
+	{
+		std::this_thread::yield();
+	}
+
+	per_core_pool.stop();
+	per_core_pool.join();
+	REQUIRE(ran == 3);
+}
+
+TEST_CASE("Testing bounded peerpaste::ConcurrentQueue", "[peerpaste::ConcurrentQueue]")
+{
+	peerpaste::ConcurrentQueue<int> data_queue(3, 1);
+	bool drained = false;
+
+	data_queue.push(1);
+	data_queue.push(2);
+	REQUIRE(not data_queue.is_full());
+
+	data_queue.push(3);
+	REQUIRE(data_queue.is_full());
+
+	data_queue.on_drained([&drained] { drained = true; });
+	REQUIRE(not drained);
+
+	// stays full until the low watermark is reached
+	REQUIRE(*data_queue.wait_and_pop() == 1);
+	REQUIRE(data_queue.is_full());
+	REQUIRE(not drained);
+
+	REQUIRE(*data_queue.wait_and_pop() == 2);
+	REQUIRE(not data_queue.is_full());
+	REQUIRE(drained);
+
+	data_queue.push(4);
+	data_queue.push(5);
+	REQUIRE(data_queue.is_full());
+
+	std::thread pusher([&] { data_queue.wait_and_push(6); });
+	REQUIRE(*data_queue.wait_and_pop() == 3);
+	REQUIRE(*data_queue.wait_and_pop() == 4);
+	pusher.join();
+
+	REQUIRE(data_queue.size() == 2);
+	REQUIRE(*data_queue.wait_and_pop() == 5);
+	REQUIRE(*data_queue.wait_and_pop() == 6);
+}
+
+TEST_CASE("Testing peerpaste::ConcurrentQueue push handler", "[peerpaste::ConcurrentQueue]")
+{
+	peerpaste::ConcurrentQueue<int> data_queue;
+	int pushes = 0;
+	REQUIRE(not data_queue.try_pop().has_value());
+
+	data_queue.set_push_handler([&pushes] { ++pushes; });
+	data_queue.push(1);
+	data_queue.wait_and_push(2);
+	REQUIRE(pushes == 2);
+
+	REQUIRE(*data_queue.try_pop() == 1);
+	REQUIRE(*data_queue.try_pop() == 2);
+	REQUIRE(not data_queue.try_pop().has_value());
+
+	data_queue.set_push_handler(nullptr);
+	data_queue.push(3);
+	REQUIRE(pushes == 2);
+	REQUIRE(data_queue.size() == 1);
+}
+
+TEST_CASE("Testing peerpaste::ConcurrentQueue with several producers and consumers", "[peerpaste::ConcurrentQueue]")
+{
+	// a small ring, so producers wrap around and wait for free cells
+	peerpaste::ConcurrentQueue<std::unique_ptr<int>> data_queue(0, 0, 5);
+	REQUIRE(data_queue.capacity() == 8);
+
+	constexpr int COUNT = 20000;
+	std::atomic<long> sum = 0;
+	std::atomic<int> popped = 0;
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&data_queue, t] {
+			for(int i = t; i < COUNT; i += 4)
+			{
+				data_queue.push(std::make_unique<int>(i));
+			}
+		});
+		threads.emplace_back([&data_queue, &sum, &popped] {
+			while(popped < COUNT)
+			{
+				if(auto value = data_queue.wait_for_and_pop(10))
+				{
+					sum += *value.value();
+					++popped;
+				}
+			}
+		});
+	}
+
+	for(auto &thread : threads)
+	{
+		thread.join();
+	}
+	REQUIRE(popped == COUNT);
+	REQUIRE(sum == static_cast<long>(COUNT) * (COUNT - 1) / 2);
+	REQUIRE(data_queue.empty());
+}
+
+TEST_CASE("Testing peerpaste::SendQueueLimiter", "[peerpaste::SendQueueLimiter]")
+{
+	using Reservation = peerpaste::SendQueueLimiter::Reservation;
+
+	SendLimits limits;
+	limits.max_frames = 1;
+
+	peerpaste::SendQueueLimiter limiter;
+	limiter.set_limits(limits);
+
+	REQUIRE(limiter.reserve(10, SendPolicy::BLOCK) == Reservation::ACCEPTED);
+	REQUIRE(limiter.reserve(10, SendPolicy::BLOCK) == Reservation::WOULD_BLOCK);
+	REQUIRE(limiter.reserve(10, SendPolicy::DROP) == Reservation::DROPPED);
+	REQUIRE(limiter.reserve(10, SendPolicy::BLOCK, MessagePriority::MAINTENANCE) == Reservation::ACCEPTED);
+	REQUIRE(not limiter.reserve_blocked(10));
+
+	limiter.release(1, 10);
+
+	// the blocked message is first in line, a new one waits behind it
+	REQUIRE(limiter.reserve(10, SendPolicy::BLOCK) == Reservation::WOULD_BLOCK);
+	REQUIRE(limiter.reserve_blocked(10));
+	limiter.cancel_blocked();
+
+	const auto metrics = limiter.get_metrics();
+	REQUIRE(metrics.queued_frames == 2);
+	REQUIRE(metrics.queued_bytes == 20);
+	REQUIRE(metrics.dropped_frames == 2);
+}
+
+TEST_CASE("Testing BoostSession send queue limits", "[BoostSession]")
+{
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+
+	SendLimits limits;
+	limits.max_frames = 2;
+	limits.max_bytes = 100;
+	limits.block_timeout = std::chrono::milliseconds{10};
+
+	// without a running io_context nothing leaves the send queue
+	auto session = std::make_shared<BoostSession>(io_context, queue);
+	session->set_send_limits(limits);
+
+	session->write(DataBuffer(60), SendPolicy::DROP);
+	session->write(DataBuffer(60), SendPolicy::DROP);
+	session->write(DataBuffer(10), SendPolicy::DROP);
+	session->write(DataBuffer(10), SendPolicy::DROP);
+	session->write(DataBuffer(10), SendPolicy::DROP);
+
+	auto metrics = session->get_send_queue_metrics();
+	REQUIRE(metrics.queued_frames == 2);
+	REQUIRE(metrics.queued_bytes == 70);
+	REQUIRE(metrics.peak_bytes == 70);
+	REQUIRE(metrics.dropped_frames == 3);
+	REQUIRE(session->is_open());
+
+	// blocked messages wait on the session instead of holding up the writer
+	bool failed = false;
+	session->write_direct(DataBuffer(10), [&failed](bool f) { failed = f; }, SendPolicy::BLOCK);
+	REQUIRE(not failed);
+	REQUIRE(session->is_open());
+
+	io_context.run_for(std::chrono::milliseconds{200});
+	REQUIRE(failed);
+	REQUIRE(not session->is_open());
+	REQUIRE(session->get_send_queue_metrics().queued_frames == 0);
+
+	auto closing_session = std::make_shared<BoostSession>(io_context, queue);
+	closing_session->set_send_limits(limits);
+	closing_session->write(DataBuffer(200), SendPolicy::CLOSE);
+	REQUIRE(closing_session->is_open());
+	closing_session->write(DataBuffer(1), SendPolicy::CLOSE);
+	REQUIRE(not closing_session->is_open());
+}
+
+TEST_CASE("Testing BoostSession failed connections", "[BoostSession]")
+{
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+
+	// nobody listens on the port once the acceptor is gone
+	std::string port;
+	{
+		tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+		port = std::to_string(acceptor.local_endpoint().port());
+	}
+
+	auto session = std::make_shared<BoostSession>(io_context, queue);
+	std::vector<bool> results;
+	session->write_direct(DataBuffer(10), [&results](bool failed) { results.push_back(failed); });
+	session->write_direct(
+		DataBuffer(10), [&results](bool failed) { results.push_back(failed); }, SendPolicy::BLOCK, MessagePriority::BULK);
+	session->write_to(DataBuffer(10), "127.0.0.1", port);
+
+	io_context.run_for(std::chrono::milliseconds{500});
+
+	// every queued frame completes and gives back its space in the send queue
+	REQUIRE(not session->is_open());
+	REQUIRE(results == std::vector<bool>{true, true});
+	REQUIRE(session->get_send_queue_metrics().queued_frames == 0);
+	REQUIRE(session->get_send_queue_metrics().queued_bytes == 0);
+}
+
+TEST_CASE("Testing BoostSession send queue priorities", "[BoostSession]")
+{
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+	tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+
+	SendLimits limits;
+	limits.max_frames = 2;
+
+	// nothing gets sent before the connection is established
+	auto client = std::make_shared<BoostSession>(io_context, queue);
+	client->set_send_limits(limits);
+	client->write(DataBuffer{1}, SendPolicy::DROP, MessagePriority::BULK);
+	client->write(DataBuffer{2}, SendPolicy::DROP, MessagePriority::BULK);
+	client->write(DataBuffer{3}, SendPolicy::DROP, MessagePriority::BULK);
+	client->write(DataBuffer{4}, SendPolicy::DROP, MessagePriority::DEFAULT);
+	client->write(DataBuffer{5}, SendPolicy::CLOSE, MessagePriority::MAINTENANCE);
+
+	// the limits apply to every priority on its own
+	auto metrics = client->get_send_queue_metrics();
+	REQUIRE(metrics.queued_frames == 4);
+	REQUIRE(metrics.dropped_frames == 1);
+
+	const auto port = std::to_string(acceptor.local_endpoint().port());
+	client->write_to(DataBuffer{6}, "127.0.0.1", port, SendPolicy::CLOSE, MessagePriority::MAINTENANCE);
+
+	auto server = std::make_shared<BoostSession>(io_context, queue);
+	acceptor.accept(server->get_socket());
+	server->read();
+
+	std::thread thread([&io_context] { io_context.run_for(std::chrono::seconds{5}); });
+	std::vector<DataBuffer> received;
+	for(int i = 0; i < 5; ++i)
+	{
+		if(auto message = queue->wait_for_and_pop(5000))
+		{
+			received.emplace_back(message->first.begin(), message->first.end());
+		}
+	}
+	// the peer address is known once connected
+	REQUIRE(client->get_client_ip() == "127.0.0.1");
+	REQUIRE(std::to_string(client->get_client_port()) == port);
+	REQUIRE(server->get_client_ip() == "127.0.0.1");
+	client.reset();
+	server.reset();
+	io_context.stop();
+	thread.join();
+
+	REQUIRE(received == std::vector<DataBuffer>{{5}, {6}, {4}, {1}, {2}});
+}
+
+TEST_CASE("Testing BoostSession file ranges", "[BoostSession]")
+{
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+	tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+
+	char path[] = "/tmp/peerpaste_test_XXXXXX";
+	const int fd = ::mkstemp(path);
+	REQUIRE(fd >= 0);
+	::unlink(path);
+	DataBuffer content(300 * 1024);
+	for(size_t i = 0; i < content.size(); ++i)
+	{
+		content[i] = static_cast<uint8_t>(i % 251);
+	}
+	REQUIRE(::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+	const auto file = std::shared_ptr<const int>(new int(fd), [](const int *fd) {
+		::close(*fd);
+		delete fd;
+	});
+
+	auto client = std::make_shared<BoostSession>(io_context, queue);
+	bool failed = true;
+	client->write(DataBuffer{1});
+	client->write_file(DataBuffer{2, 3}, FileRange{file, 1000, content.size() - 1000}, [&failed](bool f) { failed = f; });
+	client->write(DataBuffer{4});
+	client->write_to(DataBuffer{5}, "127.0.0.1", std::to_string(acceptor.local_endpoint().port()));
+
+	auto server = std::make_shared<BoostSession>(io_context, queue);
+	acceptor.accept(server->get_socket());
+	server->read();
+
+	std::thread thread([&io_context] { io_context.run_for(std::chrono::seconds{5}); });
+	std::vector<DataBuffer> received;
+	for(int i = 0; i < 4; ++i)
+	{
+		if(auto message = queue->wait_for_and_pop(5000))
+		{
+			received.emplace_back(message->first.begin(), message->first.end());
+		}
+	}
+	client.reset();
+	server.reset();
+	io_context.stop();
+	thread.join();
+
+	REQUIRE(not failed);
+	REQUIRE(received.size() == 4);
+	REQUIRE(received[0] == DataBuffer{1});
+	REQUIRE(received[1].size() == 2 + content.size() - 1000);
+	REQUIRE(received[1][1] == 3);
+	REQUIRE(std::equal(received[1].begin() + 2, received[1].end(), content.begin() + 1000));
+	REQUIRE(received[2] == DataBuffer{4});
+	REQUIRE(received[3] == DataBuffer{5});
+}
+
+TEST_CASE("Testing BoostSession timeouts", "[BoostSession]")
+{
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+
+	tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	tcp::socket idle_peer(io_context);
+	tcp::socket slow_peer(io_context);
+
+	SessionTimeouts timeouts;
+	timeouts.idle = std::chrono::milliseconds{50};
+	timeouts.read = std::chrono::milliseconds{50};
+
+	auto idle_session = std::make_shared<BoostSession>(io_context, queue);
+	idle_peer.connect(acceptor.local_endpoint());
+	acceptor.accept(idle_session->get_socket());
+	idle_session->set_timeouts(timeouts);
+	idle_session->read();
+
+	// only the header of a frame arrives, so the read deadline is hit
+	timeouts.idle = std::chrono::seconds{60};
+	auto slow_session = std::make_shared<BoostSession>(io_context, queue);
+	slow_peer.connect(acceptor.local_endpoint());
+	acceptor.accept(slow_session->get_socket());
+	slow_session->set_timeouts(timeouts);
+	slow_session->read();
+	const std::array<uint8_t, 6> partial{0, 0, 0, 10, 1, 2};
+	boost::asio::write(slow_peer, boost::asio::buffer(partial));
+
+	// a full receive queue pauses reading while the start of the next frame is buffered
+	auto full_queue = std::make_shared<ReceiveQueue>(1);
+	tcp::socket paused_peer(io_context);
+	auto paused_session = std::make_shared<BoostSession>(io_context, full_queue);
+	paused_peer.connect(acceptor.local_endpoint());
+	acceptor.accept(paused_session->get_socket());
+	paused_session->set_timeouts(timeouts);
+	paused_session->read();
+	const std::array<uint8_t, 11> frame_and_partial{0, 0, 0, 1, 7, 0, 0, 0, 10, 1, 2};
+	boost::asio::write(paused_peer, boost::asio::buffer(frame_and_partial));
+
+	io_context.run_for(std::chrono::milliseconds{500});
+
+	REQUIRE(not idle_session->is_open());
+	REQUIRE(not slow_session->is_open());
+	REQUIRE(queue->size() == 0);
+	REQUIRE(paused_session->is_open());
+
+	// once reading resumed the rest of the frame has to arrive in time again
+	REQUIRE(full_queue->try_pop().has_value());
+	io_context.restart();
+	io_context.run_for(std::chrono::milliseconds{500});
+	REQUIRE(not paused_session->is_open());
+}
+
+#ifdef PEERPASTE_HAS_IO_URING
+TEST_CASE("Testing IoUringSession", "[IoUringSession]")
+{
+	auto ring = peerpaste::IoUringContext::create();
+	if(ring == nullptr)
+	{
+		WARN("io_uring is not supported by this kernel");
+		return;
+	}
+	ring->run();
+
+	boost::asio::io_context io_context;
+	auto queue = std::make_shared<ReceiveQueue>();
+	tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+
+	// queued before the connection, the frames go out in one zero copy send.
+	// The small reply is sent with a plain sendmsg.
+	DataBuffer big_message(200 * 1024);
+	for(size_t i = 0; i < big_message.size(); ++i)
+	{
+		big_message[i] = static_cast<uint8_t>(i);
+	}
+
+	auto client = std::make_shared<IoUringSession>(*ring, io_context, queue);
+	client->write_to(DataBuffer(5000, 1), "127.0.0.1", std::to_string(acceptor.local_endpoint().port()));
+	client->write(DataBuffer{2, 3});
+	client->write(big_message);
+	client->read();
+
+	tcp::socket socket(io_context);
+	acceptor.accept(socket);
+	auto server = std::make_shared<IoUringSession>(*ring, io_context, queue, std::move(socket));
+	server->read();
+
+	auto first = queue->wait_for_and_pop(5000);
+	auto second = queue->wait_for_and_pop(5000);
+	auto third = queue->wait_for_and_pop(5000);
+	REQUIRE(first.has_value());
+	REQUIRE(second.has_value());
+	REQUIRE(third.has_value());
+	REQUIRE(first->first.size() == 5000);
+	REQUIRE(second->first.size() == 2);
+	REQUIRE(second->first.data()[1] == 3);
+	REQUIRE(std::equal(third->first.begin(), third->first.end(), big_message.begin(), big_message.end()));
+	REQUIRE(third->second == server);
+
+	third->second->write(DataBuffer{42});
+	auto reply = queue->wait_for_and_pop(5000);
+	REQUIRE(reply.has_value());
+	REQUIRE(reply->first.size() == 1);
+	REQUIRE(reply->second == client);
+	REQUIRE(client->get_send_queue_metrics().queued_frames == 0);
+	REQUIRE(client->get_client_ip() == "127.0.0.1");
+	REQUIRE(server->get_client_ip() == "127.0.0.1");
+
+	ring->stop();
+	ring->join();
+}
+
+TEST_CASE("Testing IoUringSession stopped while connecting", "[IoUringSession]")
+{
+	auto ring = peerpaste::IoUringContext::create();
+	if(ring == nullptr)
+	{
+		WARN("io_uring is not supported by this kernel");
+		return;
+	}
+	ring->run();
+
+	boost::asio::io_context io_context;
+	auto guard = boost::asio::make_work_guard(io_context);
+	std::thread thread([&io_context] { io_context.run(); });
+
+	// the accept queue is full after one connection, further connects hang
+	tcp::acceptor acceptor(io_context);
+	acceptor.open(tcp::v4());
+	acceptor.bind(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+	acceptor.listen(0);
+	tcp::socket filler(io_context);
+	filler.connect(acceptor.local_endpoint());
+
+	auto session = std::make_shared<IoUringSession>(*ring, io_context, std::make_shared<ReceiveQueue>());
+	session->set_timeouts({std::chrono::milliseconds{100}, std::chrono::milliseconds{100}});
+	session->write_to(DataBuffer{1}, "127.0.0.1", std::to_string(acceptor.local_endpoint().port()));
+	std::weak_ptr<IoUringSession> weak_session = session;
+	session.reset();
+
+	// the idle timeout stops the session, which cancels the connect
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{3};
+	while(!weak_session.expired() && std::chrono::steady_clock::now() < deadline)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds{10});
+	}
+	REQUIRE(weak_session.expired());
+
+	ring->stop();
+	ring->join();
+	io_context.stop();
+	thread.join();
+}
+#endif
+
+TEST_CASE("Testing peerpaste::UdpTransport", "[UdpTransport]")
+{
+	boost::asio::io_context io_context;
+	auto guard = boost::asio::make_work_guard(io_context);
+	std::thread thread([&io_context] { io_context.run(); });
+
+	auto client_queue = std::make_shared<ReceiveQueue>();
+	auto server_queue = std::make_shared<ReceiveQueue>();
+	auto client = std::make_shared<peerpaste::UdpTransport>(io_context, client_queue);
+	auto server = std::make_shared<peerpaste::UdpTransport>(io_context, server_queue);
+	REQUIRE(client->open(0));
+	REQUIRE(server->open(0));
+	const auto server_endpoint = client->resolve("127.0.0.1", std::to_string(server->get_port()));
+	REQUIRE(server_endpoint.has_value());
+
+	SECTION("request and response")
+	{
+		client->send_request(DataBuffer{1, 2, 3}, server_endpoint.value());
+		auto request = server_queue->wait_for_and_pop(2000);
+		REQUIRE(request.has_value());
+		REQUIRE(request->first.size() == 3);
+		REQUIRE(request->first.data()[2] == 3);
+
+		request->second->write(DataBuffer{4});
+		auto response = client_queue->wait_for_and_pop(2000);
+		REQUIRE(response.has_value());
+		REQUIRE(response->first.size() == 1);
+		REQUIRE(response->first.data()[0] == 4);
+		REQUIRE(response->second->get_client_ip() == "127.0.0.1");
+		REQUIRE(client->get_pending_requests() == 0);
+	}
+
+	SECTION("retransmits are answered once")
+	{
+		client->set_retransmit_policy({std::chrono::milliseconds{10}, 10});
+		client->send_request(DataBuffer{1}, server_endpoint.value());
+		auto request = server_queue->wait_for_and_pop(2000);
+		REQUIRE(request.has_value());
+
+		// let a few retransmits arrive before answering
+		std::this_thread::sleep_for(std::chrono::milliseconds{100});
+		request->second->write(DataBuffer{2});
+		auto response = client_queue->wait_for_and_pop(2000);
+		REQUIRE(response.has_value());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds{100});
+		REQUIRE(server_queue->size() == 0);
+		REQUIRE(client_queue->size() == 0);
+	}
+
+	SECTION("unanswered requests fail")
+	{
+		server->close();
+		std::this_thread::sleep_for(std::chrono::milliseconds{50});
+
+		std::promise<DataBuffer> failed;
+		client->set_retransmit_policy({std::chrono::milliseconds{5}, 3});
+		client->send_request(DataBuffer{7, 8}, server_endpoint.value(), [&failed](DataBuffer message) {
+			failed.set_value(std::move(message));
+		});
+
+		auto future = failed.get_future();
+		REQUIRE(future.wait_for(std::chrono::seconds{2}) == std::future_status::ready);
+		REQUIRE(future.get() == DataBuffer{7, 8});
+		REQUIRE(client->get_pending_requests() == 0);
+	}
+
+	client->close();
+	server->close();
+	guard.reset();
+	thread.join();
+}
+
+TEST_CASE("Testing peerpaste::LoopbackSession", "[LoopbackSession]")
+{
+	auto network = std::make_shared<peerpaste::LoopbackNetwork>();
+	auto queue_a = std::make_shared<ReceiveQueue>();
+	auto queue_b = std::make_shared<ReceiveQueue>();
+	network->attach("10.0.0.1", "1234", queue_a);
+	network->attach("10.0.0.2", "1234", queue_b);
+	REQUIRE(network->size() == 2);
+
+	SECTION("request and response")
+	{
+		auto session = std::make_shared<peerpaste::LoopbackSession>(network, queue_a, "10.0.0.1");
+		session->write_to(DataBuffer{1, 2, 3}, "10.0.0.2", "1234");
+		REQUIRE(session->is_open());
+		REQUIRE(session->get_client_ip() == "10.0.0.2");
+
+		auto request = queue_b->wait_for_and_pop(100);
+		REQUIRE(request.has_value());
+		REQUIRE(request->first.size() == 3);
+		REQUIRE(request->first.data()[2] == 3);
+		REQUIRE(request->second->get_client_ip() == "10.0.0.1");
+
+		request->second->write(DataBuffer{4});
+		auto response = queue_a->wait_for_and_pop(100);
+		REQUIRE(response.has_value());
+		REQUIRE(response->first.size() == 1);
+		REQUIRE(response->first.data()[0] == 4);
+		REQUIRE(response->second == session);
+
+		session->close();
+		REQUIRE_FALSE(request->second->is_open());
+	}
+
+	SECTION("unknown nodes are not reachable")
+	{
+		auto session = std::make_shared<peerpaste::LoopbackSession>(network, queue_a, "10.0.0.1");
+		session->write_to(DataBuffer{1}, "10.0.0.3", "1234");
+		REQUIRE_FALSE(session->is_open());
+		REQUIRE(queue_b->size() == 0);
+	}
+
+	SECTION("a full peer queue is handled by the send policy")
+	{
+		auto full_queue = std::make_shared<ReceiveQueue>(2, 0);
+		network->attach("10.0.0.4", "1234", full_queue);
+		auto session = std::make_shared<peerpaste::LoopbackSession>(network, queue_a, "10.0.0.1");
+		session->set_send_limits({1024, 1024, std::chrono::milliseconds{50}});
+		session->write_to(DataBuffer{1}, "10.0.0.4", "1234");
+		session->write(DataBuffer{2});
+		REQUIRE(full_queue->is_full());
+
+		session->write(DataBuffer{3}, SendPolicy::DROP);
+		REQUIRE(session->is_open());
+		REQUIRE(session->get_send_queue_metrics().dropped_frames == 1);
+
+		// blocked writes go through once the peer caught up
+		std::thread consumer([&full_queue] {
+			std::this_thread::sleep_for(std::chrono::milliseconds{10});
+			full_queue->try_pop();
+			full_queue->try_pop();
+		});
+		bool failed = true;
+		session->write_direct(DataBuffer{4}, [&failed](bool write_failed) { failed = write_failed; }, SendPolicy::BLOCK);
+		consumer.join();
+		REQUIRE_FALSE(failed);
+		REQUIRE(session->is_open());
+
+		SECTION("blocked writes fail after the block timeout")
+		{
+			session->write(DataBuffer{5});
+			REQUIRE(full_queue->is_full());
+			session->write_direct(DataBuffer{6}, [&failed](bool write_failed) { failed = write_failed; }, SendPolicy::BLOCK);
+			REQUIRE(failed);
+			REQUIRE_FALSE(session->is_open());
+		}
+
+		SECTION("the slow session gets closed")
+		{
+			session->write(DataBuffer{5});
+			session->write(DataBuffer{6}, SendPolicy::CLOSE);
+			REQUIRE_FALSE(session->is_open());
+			REQUIRE(full_queue->size() == 2);
+		}
+
+		network->detach("10.0.0.4", "1234");
+	}
+
+	SECTION("sessions of a factory get the receive queues round robin")
+	{
+		auto queue_c = std::make_shared<ReceiveQueue>();
+		peerpaste::IoContextPool io_context_pool(1);
+		peerpaste::SessionFactory factory(
+			io_context_pool, std::vector<std::shared_ptr<ReceiveQueue>>{queue_a, queue_c}, peerpaste::Transport::LOOPBACK);
+		factory.set_loopback_network(network, "10.0.0.1");
+
+		std::vector<SessionPtr> sessions;
+		for(uint8_t i = 0; i < 4; ++i)
+		{
+			sessions.push_back(factory.create());
+			sessions.back()->write_to(DataBuffer{i}, "10.0.0.2", "1234");
+			auto request = queue_b->wait_for_and_pop(100);
+			REQUIRE(request.has_value());
+			// both answers of a session end up in its queue
+			request->second->write(DataBuffer{i});
+			request->second->write(DataBuffer{i});
+		}
+
+		REQUIRE(queue_a->size() == 4);
+		REQUIRE(queue_c->size() == 4);
+		REQUIRE(queue_a->try_pop()->first.data()[0] == 0);
+		REQUIRE(queue_c->try_pop()->first.data()[0] == 1);
+	}
+
+	network->detach("10.0.0.2", "1234");
+	REQUIRE(network->find("10.0.0.2", "1234") == nullptr);
+}
+
+TEST_CASE("Testing message types on the wire", "[MessageType]")
+{
+	ProtobufMessageConverter converter;
+	const auto decode = [&converter](const Request &protobuf_message) {
+		std::vector<uint8_t> buf(protobuf_message.ByteSizeLong());
+		protobuf_message.SerializeToArray(buf.data(), buf.size());
+		return converter.MessageFromSerialized(buf);
+	};
+
+	Request protobuf_message;
+	auto protobuf_header = protobuf_message.mutable_commonheader();
+	protobuf_header->set_t_flag(true);
+	protobuf_header->set_ttl(0);
+	protobuf_header->set_message_length(0);
+	protobuf_header->set_version(std::string(ProtobufMessageConverter::WIRE_VERSION));
+
+	SECTION("the enum is understood")
+	{
+		protobuf_header->set_message_type(static_cast<uint32_t>(MessageType::GET_FILE));
+		REQUIRE(decode(protobuf_message)->get_message_type() == MessageType::GET_FILE);
+	}
+
+	SECTION("types of newer nodes are unknown")
+	{
+		protobuf_header->set_message_type(MESSAGE_TYPE_COUNT);
+		REQUIRE(decode(protobuf_message)->get_message_type() == MessageType::UNKNOWN);
+	}
+
+	SECTION("messages of older wire versions are dropped")
+	{
+		protobuf_header->set_version("");
+		protobuf_header->set_message_type(static_cast<uint32_t>(MessageType::GET_SUCCESSOR_LIST));
+		REQUIRE(decode(protobuf_message) == nullptr);
+	}
+
+	SECTION("messages that do not parse are dropped")
+	{
+		// the required ttl is missing
+		protobuf_header->clear_ttl();
+		std::vector<uint8_t> buf(protobuf_message.ByteSizeLong());
+		protobuf_message.SerializePartialToArray(buf.data(), buf.size());
+		REQUIRE(converter.MessageFromSerialized(buf) == nullptr);
+		REQUIRE(converter.MessageFromSerialized(DataBuffer{0xFF, 0xFF, 0xFF}) == nullptr);
+	}
+
+	SECTION("the enum is sent")
+	{
+		auto message = std::make_shared<Message>(Message::create_request(MessageType::NOTIFICATION));
+		const auto buf = converter.SerializedFromMessage(message);
+		Request sent;
+		REQUIRE(sent.ParseFromArray(buf.data(), buf.size()));
+		REQUIRE(sent.commonheader().message_type() == static_cast<uint32_t>(MessageType::NOTIFICATION));
+	}
+}
+
+TEST_CASE("Testing transaction ids", "[TransactionId]")
+{
+	const auto first = TransactionId::generate();
+	const auto second = TransactionId::generate();
+	REQUIRE(first.is_valid());
+	REQUIRE(first != second);
+	REQUIRE(first.high == second.high);
+	REQUIRE(first.to_string().size() == 32);
+	REQUIRE(TransactionId{}.to_string().empty());
+
+	// other threads draw a prefix of their own
+	TransactionId other;
+	std::thread([&other] { other = TransactionId::generate(); }).join();
+	REQUIRE(other.high != first.high);
+
+	SECTION("ids survive the wire")
+	{
+		auto request = std::make_shared<Message>(Message::create_request(MessageType::QUERY));
+		auto response = request->generate_response();
+		response->generate_transaction_id();
+
+		ProtobufMessageConverter converter;
+		const auto decoded_request = converter.MessageFromSerialized(converter.SerializedFromMessage(request));
+		const auto decoded_response = converter.MessageFromSerialized(converter.SerializedFromMessage(response));
+		REQUIRE(decoded_request->get_transaction_id() == request->get_transaction_id());
+		REQUIRE(!decoded_request->get_correlational_id().is_valid());
+		REQUIRE(decoded_response->get_transaction_id() == response->get_transaction_id());
+		REQUIRE(decoded_response->get_correlational_id() == request->get_transaction_id());
+	}
+
+	SECTION("handlers are found by id")
+	{
+		peerpaste::ConcurrentSet<HandlerObject<HandlerFunction>, std::less<>> handlers;
+		handlers.insert(HandlerObject<HandlerFunction>{first, [](RequestObject) {}, {}});
+		REQUIRE(handlers.contains(first));
+		REQUIRE(!handlers.contains(second));
+		REQUIRE(handlers.get_and_erase(first).has_value());
+		REQUIRE(!handlers.contains(first));
+	}
+}